@@ -0,0 +1,282 @@
+/* batch.cc - boot the kernel from a script and check its output */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "batch.h"
+
+namespace {
+  // the steps, split at ';' that are not escaped
+  std::vector<std::string> split(const std::string& text) {
+    std::vector<std::string> steps(1);
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] == '\\' && i + 1 < text.size()) {
+        steps.back() += text.substr(i++, 2);
+      } else if (text[i] == ';') {
+        steps.emplace_back();
+      } else {
+        steps.back() += text[i];
+      }
+    }
+    return steps;
+  }
+
+  std::string unescape(const std::string& text) {
+    std::string res;
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] != '\\' || i + 1 == text.size()) {
+        res += text[i];
+        continue;
+      }
+      char c = text[++i];
+      switch (c) {
+      case 'n': res += '\n'; break;
+      case 'r': res += '\r'; break;
+      case 't': res += '\t'; break;
+      case 'x': {
+        std::string hex = text.substr(i + 1, 2);
+        char *end;
+        unsigned long x = strtoul(hex.c_str(), &end, 16);
+        if (hex.size() != 2 || *end != 0) {
+          throw std::invalid_argument("bad escape in '" + text + "'");
+        }
+        res += char(x);
+        i += 2;
+        break;
+      }
+      default: res += c;
+      }
+    }
+    return res;
+  }
+
+  // nearest rank percentile of sorted values
+  double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = ceil(p * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+  }
+}
+
+Batch::Script Batch::parse(const std::string& text) {
+  Script script;
+  for (std::string step : split(text)) {
+    size_t start = step.find_first_not_of(" \t\n");
+    if (start == std::string::npos) continue;
+    step = step.substr(start, step.find_last_not_of(" \t\n") + 1 - start);
+    size_t space = step.find_first_of(" \t");
+    std::string name = step.substr(0, space);
+    std::string arg = space == std::string::npos ? "" :
+                      step.substr(step.find_first_not_of(" \t", space));
+    Step s;
+    s.secs = 0;
+    if (name == "expect") {
+      s.kind = Step::EXPECT;
+    } else if (name == "fail") {
+      s.kind = Step::FAIL;
+    } else if (name == "send") {
+      s.kind = Step::SEND;
+    } else if (name == "timeout") {
+      s.kind = Step::TIMEOUT;
+      char *end;
+      s.secs = strtod(arg.c_str(), &end);
+      if (arg.empty() || *end != 0 || !(s.secs > 0)) {
+        throw std::invalid_argument("bad timeout '" + arg + "'");
+      }
+      script.push_back(s);
+      continue;
+    } else {
+      throw std::invalid_argument("bad step '" + step + "'");
+    }
+    s.text = unescape(arg);
+    if (s.text.empty()) {
+      throw std::invalid_argument(name + " needs a text");
+    }
+    script.push_back(s);
+  }
+  return script;
+}
+
+Batch::Batch(const Script& script, unsigned runs,
+             std::function<void(const std::string& text)> send)
+  : script_(script), runs_(runs), send_(send) {
+  for (size_t i = 0; i < script_.size(); ++i) {
+    if (script_[i].kind == Step::EXPECT || script_[i].kind == Step::FAIL) {
+      matcher_.add(script_[i].text);
+      pattern_step_.push_back(i);
+    }
+  }
+  matcher_.build();
+  // the board may already be waiting for a kernel
+  set_deadline(DEFAULT_TIMEOUT_SECS);
+}
+
+Batch::~Batch() {
+  detach();
+}
+
+void Batch::attach(EventLoop& loop) {
+  loop_ = &loop;
+  arm_timer();
+}
+
+void Batch::detach() {
+  if (loop_ && timer_ != -1) loop_->cancel_timer(timer_);
+  timer_ = -1;
+  loop_ = NULL;
+}
+
+void Batch::set_deadline(double secs) {
+  deadline_set_ = true;
+  deadline_ = EventLoop::Clock::now() +
+              std::chrono::duration_cast<EventLoop::Clock::duration>(
+                std::chrono::duration<double>(secs));
+  arm_timer();
+}
+
+void Batch::clear_deadline() {
+  deadline_set_ = false;
+  arm_timer();
+}
+
+void Batch::arm_timer() {
+  if (!loop_) return;
+  if (timer_ != -1) loop_->cancel_timer(timer_);
+  timer_ = -1;
+  if (!deadline_set_) return;
+  timer_ = loop_->add_timer(deadline_ - EventLoop::Clock::now(), [this]() {
+      timer_ = -1;
+      timeout();
+    });
+}
+
+void Batch::timeout() {
+  deadline_set_ = false;
+  if (phase_ == WAITING) {
+    end_run("the loader didn't ask for the kernel");
+  } else if (phase_ == RUNNING) {
+    end_run("timeout waiting for '" + script_[next_step_].text + "'");
+  }
+}
+
+void Batch::requested() {
+  if (finished()) return;
+  if (phase_ == RUNNING) {
+    end_run("the board restarted");
+    if (finished()) return;
+  }
+  if (phase_ == WAITING) requested_ = EventLoop::Clock::now();
+  phase_ = LOADING;
+  break_wanted_ = false;
+  clear_deadline();
+}
+
+void Batch::started(bool ok) {
+  if (phase_ != LOADING) return;
+  if (!ok) {
+    end_run("the kernel wasn't sent");
+    return;
+  }
+  started_ = EventLoop::Clock::now();
+  phase_ = RUNNING;
+  next_step_ = 0;
+  timeout_secs_ = DEFAULT_TIMEOUT_SECS;
+  matcher_.reset();
+  run_steps();
+}
+
+void Batch::run_steps() {
+  for (; next_step_ < script_.size(); ++next_step_) {
+    const Step& step = script_[next_step_];
+    if (step.kind == Step::SEND) {
+      send_(step.text);
+    } else if (step.kind == Step::TIMEOUT) {
+      timeout_secs_ = step.secs;
+    } else if (step.kind == Step::EXPECT) {
+      set_deadline(timeout_secs_);
+      return;
+    }
+  }
+  end_run("");
+}
+
+void Batch::scan(const char *buf, size_t len) {
+  if (phase_ != RUNNING) return;
+  matcher_.scan(buf, len, [this](size_t id, uint64_t end) {
+      if (phase_ != RUNNING) return;
+      size_t step = pattern_step_[id];
+      if (script_[step].kind == Step::FAIL && step < next_step_) {
+        end_run("found '" + script_[step].text + "'");
+      } else if (step == next_step_ && end > last_match_) {
+        // text seen once only satisfies one expect
+        last_match_ = end;
+        ++next_step_;
+        run_steps();
+      }
+    });
+}
+
+void Batch::end_run(const std::string& error) {
+  auto now = EventLoop::Clock::now();
+  ++runs_done_;
+  if (error.empty()) {
+    ++passed_;
+    double load = std::chrono::duration<double>(started_ - requested_).count();
+    double boot = std::chrono::duration<double>(now - started_).count();
+    load_secs_.push_back(load);
+    boot_secs_.push_back(boot);
+    fprintf(stderr, "\n\r### run %u of %u passed [load %.3f s, boot %.3f s]"
+            "\n\r", runs_done_, runs_, load, boot);
+  } else {
+    fprintf(stderr, "\n\r### run %u of %u failed: %s\n\r", runs_done_, runs_,
+            error.c_str());
+  }
+  phase_ = WAITING;
+  if (finished()) {
+    clear_deadline();
+    report();
+    return;
+  }
+  // the next run starts with the next boot request
+  break_wanted_ = true;
+  set_deadline(DEFAULT_TIMEOUT_SECS);
+}
+
+bool Batch::want_break() {
+  bool res = break_wanted_;
+  break_wanted_ = false;
+  return res;
+}
+
+void Batch::report() {
+  fprintf(stderr, "### %u of %u runs passed", passed_, runs_);
+  if (passed_ > 0) {
+    std::sort(load_secs_.begin(), load_secs_.end());
+    std::sort(boot_secs_.begin(), boot_secs_.end());
+    fprintf(stderr, " [load p50 %.3f s, p99 %.3f s; boot p50 %.3f s, "
+            "p99 %.3f s]", percentile(load_secs_, 0.5),
+            percentile(load_secs_, 0.99), percentile(boot_secs_, 0.5),
+            percentile(boot_secs_, 0.99));
+  }
+  fprintf(stderr, "\n\r");
+}
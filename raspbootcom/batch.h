@@ -0,0 +1,128 @@
+/* batch.h - boot the kernel from a script and check its output */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "matcher.h"
+
+/* Batch mode (--expect) for CI: each time the kernel has been sent it
+ * runs a script against the console and records whether the run
+ * passed. Steps are separated by ';':
+ *
+ *   expect TEXT     wait for TEXT in the console
+ *   fail TEXT       from now on TEXT in the console fails the run
+ *   send TEXT       type TEXT to the kernel
+ *   timeout SECS    time limit of the following expects [60]
+ *
+ * TEXT is the rest of the step, \n, \r, \t, \\, \; and \xHH are
+ * escapes. All patterns go into one Matcher, so the console is scanned
+ * once however many there are. A boot request while the script runs
+ * (the board reset) fails the run.
+ *
+ * After a run the kernel is sent back to the loader with a BREAK for
+ * the next one, until all have been done. Then the times from the boot
+ * request to the kernel start (load) and from there to the end of the
+ * script (boot) of the passed runs are reported.
+ */
+class Batch {
+public:
+  struct Step {
+    enum Kind { EXPECT, FAIL, SEND, TIMEOUT } kind;
+    std::string text;
+    double secs;
+  };
+  typedef std::vector<Step> Script;
+
+  // Parse a script, throws std::invalid_argument.
+  static Script parse(const std::string& text);
+
+  // runs: how often to boot the kernel
+  // send: types text to the kernel
+  Batch(const Script& script, unsigned runs,
+        std::function<void(const std::string& text)> send);
+  ~Batch();
+  Batch(const Batch&) = delete;
+  Batch& operator=(const Batch&) = delete;
+
+  // Use loop for the timeouts until detach().
+  void attach(EventLoop& loop);
+  void detach();
+
+  // The loader asks for a kernel.
+  void requested();
+  // The kernel has been started, or sending it failed.
+  void started(bool ok);
+  // Output of the kernel.
+  void scan(const char *buf, size_t len);
+
+  // A run is over, the kernel should go back to the loader. True once.
+  bool want_break();
+  bool finished() const { return runs_done_ == runs_; }
+  // 0 if all runs passed
+  int exit_code() const { return passed_ == runs_ ? 0 : 1; }
+
+private:
+  enum Phase { WAITING, LOADING, RUNNING };
+  enum {
+    DEFAULT_TIMEOUT_SECS = 60,
+  };
+
+  // run steps up to the next expect
+  void run_steps();
+  // error: why the run failed, empty if it passed
+  void end_run(const std::string& error);
+  void set_deadline(double secs);
+  void clear_deadline();
+  void arm_timer();
+  void timeout();
+  void report();
+
+  Script script_;
+  unsigned runs_;
+  std::function<void(const std::string& text)> send_;
+  Matcher matcher_;
+  // step of each pattern
+  std::vector<size_t> pattern_step_;
+
+  Phase phase_ = WAITING;
+  size_t next_step_ = 0;
+  // end of the match of the last expect, a later one has to end behind
+  uint64_t last_match_ = 0;
+  double timeout_secs_ = DEFAULT_TIMEOUT_SECS;
+  unsigned runs_done_ = 0;
+  unsigned passed_ = 0;
+  bool break_wanted_ = false;
+  EventLoop::Clock::time_point requested_;
+  EventLoop::Clock::time_point started_;
+  // load and boot times of the passed runs
+  std::vector<double> load_secs_;
+  std::vector<double> boot_secs_;
+
+  EventLoop *loop_ = NULL;
+  bool deadline_set_ = false;
+  EventLoop::Clock::time_point deadline_;
+  int timer_ = -1;
+};
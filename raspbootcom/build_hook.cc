@@ -0,0 +1,180 @@
+/* build_hook.cc - run the build when the kernel is wanted or sources change */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "build_hook.h"
+#include "unix_error.h"
+
+BuildHook::BuildHook(const std::string& cmd,
+                     const std::vector<std::string>& dirs) : cmd_(cmd) {
+  if (dirs.empty()) return;
+  inotify_fd_ = UnixError::check("inotify",
+                                 inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+  for (const std::string& dir : dirs) {
+    UnixError::check("watch " + dir,
+                     inotify_add_watch(inotify_fd_, dir.c_str(),
+                                       IN_CLOSE_WRITE | IN_MOVED_TO |
+                                       IN_DELETE));
+  }
+}
+
+BuildHook::~BuildHook() {
+  detach();
+  if (pid_ != -1) {
+    // the build runs in its own process group, stop all of it
+    kill(-pid_, SIGTERM);
+    waitpid(pid_, NULL, 0);
+    close(pid_fd_);
+  }
+  if (inotify_fd_ != -1) close(inotify_fd_);
+}
+
+void BuildHook::attach(EventLoop& loop, std::function<void(bool ok)> done) {
+  loop_ = &loop;
+  done_ = done;
+  if (inotify_fd_ != -1) {
+    loop_->watch(inotify_fd_, POLLIN, [this](short) { changed(); });
+  }
+  if (pid_fd_ != -1) {
+    loop_->watch(pid_fd_, POLLIN, [this](short) { finished(); });
+  }
+  // changes while nobody watched
+  if (dirty_ && inotify_fd_ != -1 && pid_ == -1) start();
+}
+
+void BuildHook::detach() {
+  if (!loop_) return;
+  if (inotify_fd_ != -1) loop_->unwatch(inotify_fd_);
+  if (pid_fd_ != -1) loop_->unwatch(pid_fd_);
+  if (settle_timer_ != -1) loop_->cancel_timer(settle_timer_);
+  settle_timer_ = -1;
+  loop_ = NULL;
+  done_ = nullptr;
+  // a new session asks again
+  waiting_ = false;
+}
+
+BuildHook::State BuildHook::request() {
+  if (pid_ == -1 && (dirty_ || inotify_fd_ == -1)) start();
+  if (pid_ != -1) {
+    waiting_ = true;
+    return BUILDING;
+  }
+  return ok_ ? OK : FAILED;
+}
+
+void BuildHook::start() {
+  if (settle_timer_ != -1) loop_->cancel_timer(settle_timer_);
+  settle_timer_ = -1;
+  dirty_ = false;
+  fprintf(stderr, "### building: %s\n\r", cmd_.c_str());
+  pid_ = UnixError::check("fork", fork());
+  if (pid_ == 0) {
+    // stdout is the console, stdin the user's input
+    setpgid(0, 0);
+    int null_fd = open("/dev/null", O_RDONLY);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    // nothing else of ours, e.g. the serial port
+    syscall(SYS_close_range, 3, ~0U, 0);
+    execl("/bin/sh", "sh", "-c", cmd_.c_str(), (char*)NULL);
+    _exit(127);
+  }
+  setpgid(pid_, pid_);
+  pid_fd_ = UnixError::check("pidfd_open", syscall(SYS_pidfd_open, pid_, 0));
+  if (loop_) loop_->watch(pid_fd_, POLLIN, [this](short) { finished(); });
+}
+
+void BuildHook::finished() {
+  int status;
+  if (UnixError::check_again("waitpid", waitpid(pid_, &status, WNOHANG))
+      <= 0) {
+    return;
+  }
+  if (loop_) loop_->unwatch(pid_fd_);
+  close(pid_fd_);
+  pid_fd_ = -1;
+  // the last of the build's writes, and edits it may have missed
+  if (read_changes()) dirty_ = true;
+  pid_ = -1;
+  ok_ = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!ok_) {
+    fprintf(stderr, "### build failed (%s %d)\n\r",
+            WIFEXITED(status) ? "exit" : "signal",
+            WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status));
+  }
+  if (dirty_) {
+    // a request waits for the sources as they are now
+    start();
+    return;
+  }
+  if (waiting_) {
+    waiting_ = false;
+    if (done_) done_(ok_);
+  }
+}
+
+bool BuildHook::read_changes() {
+  if (inotify_fd_ == -1) return false;
+  bool edited = false;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = UnixError::check_again("read inotify",
+                                       read(inotify_fd_, buf,
+                                            sizeof(buf)))) > 0) {
+    for (char *p = buf; p < buf + len; ) {
+      const struct inotify_event *event = (const struct inotify_event*)p;
+      p += sizeof(*event) + event->len;
+      if (event->len == 0) continue;
+      std::string name = std::to_string(event->wd) + "/" + event->name;
+      if (pid_ == -1) {
+        // a build deleting its output (make clean) doesn't make a source
+        if (!(event->mask & IN_DELETE)) sources_.insert(name);
+        edited = true;
+      } else if (sources_.count(name) != 0) {
+        edited = true;
+      } else if (outputs_.insert(name).second) {
+        // new output, or a new source saved during the build
+        edited = true;
+      }
+    }
+  }
+  return edited;
+}
+
+void BuildHook::changed() {
+  if (!read_changes()) return;
+  dirty_ = true;
+  // the build runs again when it is done
+  if (pid_ != -1) return;
+  if (settle_timer_ != -1) return;
+  settle_timer_ = loop_->add_timer(std::chrono::milliseconds(SETTLE_MS),
+                                   [this]() {
+                                     settle_timer_ = -1;
+                                     if (pid_ == -1) start();
+                                   });
+}
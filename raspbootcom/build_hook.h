@@ -0,0 +1,92 @@
+/* build_hook.h - run the build when the kernel is wanted or sources change */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+
+/* Runs the build command (--build) through /bin/sh. A boot request
+ * waits for it, unless the last build is known to be up to date: the
+ * watched source directories (--watch, not recursive) haven't changed
+ * since it started. Changes start a build in the background right
+ * away, so it is usually done before the board asks. Without watched
+ * directories every request runs the build.
+ *
+ * The build writes to stderr and keeps running across reconnects of
+ * the serial link. Files it writes (e.g. objects next to the sources)
+ * are told apart from edits by name: a file changed while no build
+ * ran is a source, one first seen changing during a build may be
+ * either and is built once more, after that it is the build's own
+ * output. A source changed during a build runs it again before the
+ * request is answered. The build gets no file descriptors but stdin
+ * (/dev/null), stdout and stderr.
+ */
+class BuildHook {
+public:
+  enum State { BUILDING, OK, FAILED };
+
+  BuildHook(const std::string& cmd, const std::vector<std::string>& dirs);
+  ~BuildHook();
+  BuildHook(const BuildHook&) = delete;
+  BuildHook& operator=(const BuildHook&) = delete;
+
+  // Let loop watch the build and the sources until detach(). done is
+  // called when the build a request waits for has finished.
+  void attach(EventLoop& loop, std::function<void(bool ok)> done);
+  void detach();
+
+  // The kernel is wanted: build it unless it is up to date. BUILDING
+  // means done will be called.
+  State request();
+
+private:
+  enum {
+    // wait for more changes (an editor saving several files)
+    SETTLE_MS = 200,
+  };
+
+  void start();
+  void finished();
+  // Read the pending changes. Returns true if a source was edited.
+  bool read_changes();
+  void changed();
+
+  std::string cmd_;
+  int inotify_fd_ = -1;
+  pid_t pid_ = -1;
+  int pid_fd_ = -1;
+  // sources changed since the last build started
+  bool dirty_ = true;
+  bool ok_ = false;
+  bool waiting_ = false;
+  // files changed while no build ran and files only builds changed,
+  // as "WD/NAME"
+  std::set<std::string> sources_;
+  std::set<std::string> outputs_;
+  EventLoop *loop_ = NULL;
+  int settle_timer_ = -1;
+  std::function<void(bool ok)> done_;
+};
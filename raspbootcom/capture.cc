@@ -0,0 +1,406 @@
+/* capture.cc - record serial sessions and play them back through a pty */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+
+#include "capture.h"
+#include "session_log.h"
+#include "unix_error.h"
+
+namespace Capture {
+
+static const char MAGIC[8] = {'R', 'B', 'C', 'A', 'P', '1', '\n', 0};
+
+Recorder::Recorder(std::unique_ptr<Transport> transport,
+                   const std::string& path)
+  : Transport(transport->name(), false), transport_(std::move(transport)) {
+  file_ = fopen(path.c_str(), "we");
+  if (!file_) throw UnixError("open " + path);
+  // big enough to take a burst at line rate without a write
+  setvbuf(file_, NULL, _IOFBF, 1 << 20);
+  fwrite(MAGIC, 1, sizeof(MAGIC), file_);
+  uint64_t start = SessionLog::now();
+  for (int i = 0; i < 8; ++i) fputc(start >> (i * 8), file_);
+  last_ = EventLoop::Clock::now();
+}
+
+Recorder::~Recorder() {
+  fclose(file_);
+  // the fd belongs to transport_
+  fd_ = -1;
+}
+
+void Recorder::put_varint(uint64_t value) {
+  while (value >= 0x80) {
+    fputc(0x80 | (value & 0x7f), file_);
+    value >>= 7;
+  }
+  fputc(value, file_);
+}
+
+void Recorder::record(Type type, const char *buf, size_t len) {
+  EventLoop::Clock::time_point now = EventLoop::Clock::now();
+  fputc(type, file_);
+  put_varint(std::chrono::duration_cast<std::chrono::microseconds>(
+               now - last_).count());
+  last_ = now;
+  if (type == RX || type == TX) {
+    put_varint(len);
+    fwrite(buf, 1, len, file_);
+  } else if (type == BAUD) {
+    put_varint(len);
+  }
+}
+
+bool Recorder::open() {
+  bool res = transport_->open();
+  name_ = transport_->name();
+  fd_ = transport_->fd();
+  return res;
+}
+
+void Recorder::close() {
+  transport_->close();
+  fd_ = -1;
+  // a capture of a session that ended is complete on disk
+  fflush(file_);
+}
+
+ssize_t Recorder::read(char *buf, size_t len) {
+  ssize_t res = transport_->read(buf, len);
+  break_at_ = transport_->break_at();
+  size_t head = break_at_ == -1 ? std::max<ssize_t>(res, 0) : break_at_;
+  if (head > 0) record(RX, buf, head);
+  if (break_at_ != -1) {
+    record(RX_BREAK);
+    if (res > ssize_t(head)) record(RX, buf + head, res - head);
+  }
+  return res;
+}
+
+bool Recorder::reports_break() const {
+  return transport_->reports_break();
+}
+
+ssize_t Recorder::write(const char *buf, size_t len) {
+  ssize_t res = transport_->write(buf, len);
+  if (res > 0) record(TX, buf, res);
+  return res;
+}
+
+bool Recorder::write_pending() const {
+  return transport_->write_pending();
+}
+
+void Recorder::flush() {
+  transport_->flush();
+}
+
+ssize_t Recorder::output_queued() {
+  return transport_->output_queued();
+}
+
+bool Recorder::baud_supported(unsigned baud) const {
+  return transport_->baud_supported(baud);
+}
+
+void Recorder::set_baud(unsigned baud) {
+  transport_->set_baud(baud);
+  record(BAUD, NULL, baud);
+}
+
+bool Recorder::sends_break() const {
+  return transport_->sends_break();
+}
+
+void Recorder::set_break(bool on) {
+  transport_->set_break(on);
+  record(on ? TX_BREAK_ON : TX_BREAK_OFF);
+}
+
+void Recorder::discard_output() {
+  transport_->discard_output();
+}
+
+void Recorder::discard_input() {
+  transport_->discard_input();
+}
+
+Replay::Replay(const std::string& path, bool board, double speed)
+  : path_(path), board_(board), speed_(speed) {
+  int fd = UnixError::check("open " + path_,
+                            ::open(path_.c_str(), O_RDONLY | O_CLOEXEC));
+  struct stat st;
+  UnixError::check("stat " + path_, fstat(fd, &st), [fd]() { close(fd); });
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      throw UnixError("map " + path_, err);
+    }
+    map_ = (const uint8_t*)map;
+  }
+  close(fd);
+  try {
+    parse();
+  } catch (...) {
+    if (map_) munmap((void*)map_, size_);
+    throw;
+  }
+}
+
+Replay::~Replay() {
+  if (map_) munmap((void*)map_, size_);
+}
+
+void Replay::parse() {
+  size_t pos = sizeof(MAGIC) + 8;
+  if (size_ < pos || memcmp(map_, MAGIC, sizeof(MAGIC)) != 0) {
+    throw std::invalid_argument(path_ + " is not a capture");
+  }
+  auto varint = [&]() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= size_) break;
+      uint8_t b = map_[pos++];
+      value |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80)) return value;
+    }
+    throw std::invalid_argument(path_ + ": capture cut short");
+  };
+  uint64_t time = 0;
+  uint64_t other = 0;
+  // a recording cut short by a crash ends in the middle of a record
+  try {
+    while (pos < size_) {
+      Type type = Type(map_[pos++]);
+      time += varint();
+      Record rec{type, time, other, NULL, 0};
+      if (type == RX || type == TX) {
+        rec.len = varint();
+        if (rec.len > size_ - pos) break;
+        rec.data = map_ + pos;
+        pos += rec.len;
+      } else if (type == BAUD) {
+        rec.len = varint();
+      }
+      bool mine = (type == RX || type == RX_BREAK) == board_;
+      if (mine) {
+        if (type == RX || type == TX) play_.push_back(rec);
+      } else if (rec.data) {
+        expect_.emplace_back(rec.data, rec.len);
+        other += rec.len;
+      }
+    }
+  } catch (std::invalid_argument&) {
+  }
+  expect_total_ = other;
+}
+
+void Replay::check(const char *buf, size_t len) {
+  for (size_t i = 0; i < len && mismatch_ == -1; ) {
+    if (expect_index_ == expect_.size()) {
+      // more than in the capture
+      mismatch_ = received_ + i;
+      break;
+    }
+    const std::pair<const uint8_t*, size_t>& e = expect_[expect_index_];
+    size_t n = std::min(len - i, e.second - expect_pos_);
+    if (memcmp(buf + i, e.first + expect_pos_, n) != 0) {
+      size_t k = 0;
+      while (buf[i + k] == char(e.first[expect_pos_ + k])) ++k;
+      mismatch_ = received_ + i + k;
+      break;
+    }
+    i += n;
+    expect_pos_ += n;
+    if (expect_pos_ == e.second) {
+      ++expect_index_;
+      expect_pos_ = 0;
+    }
+  }
+  received_ += len;
+}
+
+int Replay::run(Transport& transport) {
+  typedef EventLoop::Clock Clock;
+  if (!transport.open()) throw UnixError("open " + transport.name());
+  int fd = transport.fd();
+  const char *side = board_ ? "board" : "host";
+  fprintf(stderr, "### replaying the %s of %s on %s\n\r", side, path_.c_str(),
+          transport.name().c_str());
+
+  // start once the other side has opened the pty
+  int inotify_fd = UnixError::check("inotify",
+                                    inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+  auto close_inotify = [&inotify_fd]() {
+    if (inotify_fd != -1) close(inotify_fd);
+    inotify_fd = -1;
+  };
+  UnixError::check("watch " + transport.name(),
+                   inotify_add_watch(inotify_fd, transport.name().c_str(),
+                                     IN_OPEN),
+                   close_inotify);
+
+  EventLoop loop;
+  bool running = true;
+  size_t next = 0;
+  uint64_t played = 0;
+  std::string out;
+  size_t out_pos = 0;
+  Clock::time_point start;
+  Clock::duration shift(0);
+  bool gate_waiting = false;
+  Clock::time_point gate_since;
+  int timer = -1;
+  bool draining = false;
+
+  std::function<void()> step;
+  auto wake_at = [&](Clock::duration delay) {
+    if (timer != -1) loop.cancel_timer(timer);
+    timer = loop.add_timer(delay, [&]() {
+        timer = -1;
+        step();
+      });
+  };
+  auto send = [&]() {
+    while (out_pos < out.size()) {
+      ssize_t res = transport.write(&out[out_pos], out.size() - out_pos);
+      if (res == -1) break;
+      out_pos += res;
+    }
+    if (out_pos == out.size()) {
+      out.clear();
+      out_pos = 0;
+    }
+    loop.set_events(fd, POLLIN | (out.empty() ? 0 : POLLOUT));
+  };
+  step = [&]() {
+    Clock::time_point now = Clock::now();
+    while (next < play_.size()) {
+      const Record& rec = play_[next];
+      if (received_ < rec.gate) {
+        if (!gate_waiting) {
+          gate_waiting = true;
+          gate_since = now;
+        }
+        Clock::duration left = std::chrono::milliseconds(GATE_TIMEOUT_MS) -
+                               (now - gate_since);
+        if (left > Clock::duration(0)) {
+          wake_at(left);
+          break;
+        }
+        ++timeouts_;
+        fprintf(stderr, "### the other side is %llu bytes short, going on\n\r",
+                (unsigned long long)(rec.gate - received_));
+      }
+      if (speed_ > 0) {
+        Clock::time_point due = start + shift +
+          std::chrono::microseconds(uint64_t(rec.time / speed_));
+        // time spent waiting for the other side isn't in the capture
+        if (gate_waiting && due < now) {
+          shift += now - due;
+          due = now;
+        }
+        gate_waiting = false;
+        if (due > now) {
+          wake_at(due - now);
+          break;
+        }
+      }
+      gate_waiting = false;
+      out.append((const char*)rec.data, rec.len);
+      played += rec.len;
+      ++next;
+    }
+    send();
+    if (next == play_.size()) {
+      if (!draining) {
+        draining = true;
+        wake_at(std::chrono::milliseconds(DRAIN_MS));
+      }
+      // done once the other side caught up, or gave up on it
+      if (out.empty() && (timer == -1 || received_ >= expect_total_)) {
+        running = false;
+      }
+    }
+  };
+
+  loop.watch(inotify_fd, POLLIN, [&](short) {
+      char buf[4096];
+      if (read(inotify_fd, buf, sizeof(buf)) <= 0) return;
+      loop.unwatch(inotify_fd);
+      close_inotify();
+      fprintf(stderr, "### the other side opened %s, starting\n\r",
+              transport.name().c_str());
+      loop.add_timer(std::chrono::milliseconds(START_MS), [&]() {
+          start = Clock::now();
+          step();
+        });
+    });
+  loop.watch(fd, POLLIN, [&](short revents) {
+      if (revents & POLLOUT) {
+        send();
+        if (draining) step();
+      }
+      if (!(revents & (POLLIN | POLLERR | POLLHUP))) return;
+      char buf[65536];
+      ssize_t len = transport.read(buf, sizeof(buf));
+      if (len <= 0) return;
+      check(buf, len);
+      // the session went another way, the rest can't be played
+      if (mismatch_ != -1) running = false;
+      // the next record may be waiting for this
+      if (inotify_fd == -1 && (gate_waiting || draining)) step();
+    });
+  while (running) loop.run_once();
+  close_inotify();
+
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  fprintf(stderr, "### played %llu bytes in %.3f s [%.0f byte/s]\n\r",
+          (unsigned long long)played, secs, secs > 0 ? played / secs : 0.0);
+  if (mismatch_ != -1) {
+    fprintf(stderr, "### the other side differs from the capture at byte "
+            "%lld\n\r", (long long)mismatch_);
+  } else if (received_ != expect_total_) {
+    fprintf(stderr, "### the other side sent %llu of %llu bytes\n\r",
+            (unsigned long long)received_, (unsigned long long)expect_total_);
+  } else {
+    fprintf(stderr, "### the other side sent the same %llu bytes as in "
+            "the capture\n\r", (unsigned long long)received_);
+  }
+  if (timeouts_ != 0) {
+    fprintf(stderr, "### waited for it in vain %u times\n\r", timeouts_);
+  }
+  return mismatch_ == -1 && received_ == expect_total_ ? 0 : 1;
+}
+
+}
@@ -0,0 +1,147 @@
+/* capture.h - record serial sessions and play them back through a pty */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "transport.h"
+
+/* A capture (--record=FILE) holds both directions of a session with
+ * their timing. After an 8 byte magic and the start time (u64, micro-
+ * seconds since the epoch, little endian) come records of
+ *
+ *   type u8, delay varint, [length varint, data | baud varint]
+ *
+ * where delay is the time in microseconds since the previous record and
+ * varints are LEB128. RX records are data from the board, TX records
+ * data to it; the BREAK and BAUD records have no data.
+ *
+ * A Replay plays one side of a capture back through a new pty, at the
+ * original speed, scaled, or as fast as possible. Each record waits
+ * until the live other side has sent as much as it had sent before
+ * that record in the capture, so a replayed loader answers the packets
+ * of a live raspbootcom like the real one did. What the other side sends
+ * is compared with the capture, which makes a replay a regression test.
+ */
+namespace Capture {
+  enum Type : uint8_t {
+    RX = 'r',
+    TX = 't',
+    // a BREAK from the board, before the RX data that follows
+    RX_BREAK = 'b',
+    TX_BREAK_ON = 'B',
+    TX_BREAK_OFF = 'E',
+    BAUD = 'S',
+  };
+
+  /* Records everything that goes through a transport. */
+  class Recorder : public Transport {
+  public:
+    Recorder(std::unique_ptr<Transport> transport, const std::string& path);
+    ~Recorder();
+
+    bool open() override;
+    void close() override;
+    bool hotplug() const override { return transport_->hotplug(); }
+    ssize_t read(char *buf, size_t len) override;
+    bool reports_break() const override;
+    ssize_t write(const char *buf, size_t len) override;
+    bool write_pending() const override;
+    void flush() override;
+    ssize_t output_queued() override;
+    bool baud_supported(unsigned baud) const override;
+    void set_baud(unsigned baud) override;
+    bool sends_break() const override;
+    void set_break(bool on) override;
+    void discard_output() override;
+    void discard_input() override;
+
+  private:
+    void record(Type type, const char *buf = NULL, size_t len = 0);
+    void put_varint(uint64_t value);
+
+    std::unique_ptr<Transport> transport_;
+    FILE *file_;
+    EventLoop::Clock::time_point last_;
+  };
+
+  class Replay {
+  public:
+    // board: play the board's side, else raspbootcom's
+    // speed: factor of the original speed, 0 for as fast as possible
+    Replay(const std::string& path, bool board, double speed);
+    ~Replay();
+    Replay(const Replay&) = delete;
+    Replay& operator=(const Replay&) = delete;
+
+    // Play the capture to the transport (a pty) until its end, returns
+    // 0 if the other side sent what it did in the capture.
+    int run(Transport& transport);
+
+  private:
+    enum {
+      // time the other side gets to set up the pty after opening it
+      START_MS = 200,
+      // longest wait for the other side before going on without it
+      GATE_TIMEOUT_MS = 5000,
+      // time the other side gets to finish after the last record
+      DRAIN_MS = 1000,
+    };
+
+    struct Record {
+      Type type;
+      // microseconds since the start
+      uint64_t time;
+      // bytes the other side had sent before
+      uint64_t gate;
+      const uint8_t *data;
+      size_t len;
+    };
+
+    void parse();
+    // compare what the other side sent with the capture
+    void check(const char *buf, size_t len);
+
+    std::string path_;
+    bool board_;
+    double speed_;
+    const uint8_t *map_ = NULL;
+    size_t size_ = 0;
+    // the records of the side to play
+    std::vector<Record> play_;
+    // the data of the other side
+    std::vector<std::pair<const uint8_t*, size_t> > expect_;
+    size_t expect_index_ = 0;
+    size_t expect_pos_ = 0;
+    uint64_t expect_total_ = 0;
+    // bytes the other side sent so far, and where it first differed
+    uint64_t received_ = 0;
+    int64_t mismatch_ = -1;
+    unsigned timeouts_ = 0;
+  };
+}
@@ -0,0 +1,96 @@
+/* channels.cc - byte streams of the kernel besides the console */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+
+#include "channels.h"
+#include "unix_error.h"
+
+#include <stdexcept>
+
+using namespace Protocol;
+
+Channels::Channels() {
+  for (bool& d : dropping_) d = false;
+}
+
+void Channels::add(unsigned channel, const std::string& link) {
+  if (channel >= CHANNEL_MAX) {
+    throw std::invalid_argument("no channel " + std::to_string(channel));
+  }
+  ptys_[channel] = Transport::create(link.empty() ? "pty" : "pty:" + link,
+                                     false);
+  ptys_[channel]->open();
+  fprintf(stderr, "### channel %u on %s\n\r", channel,
+          ptys_[channel]->name().c_str());
+}
+
+Transport *Channels::pty(unsigned channel) {
+  if (!ptys_[channel]) {
+    try {
+      add(channel, "");
+    } catch (UnixError& e) {
+      fprintf(stderr, "### channel %u: %s\n\r", channel, e.what());
+      ptys_[channel].reset();
+    }
+  }
+  return ptys_[channel].get();
+}
+
+std::string Channels::request(const uint8_t *frame, size_t len) {
+  if (len < 2) return "";
+  uint8_t op = frame[0];
+  unsigned channel = frame[1];
+  frame += 2;
+  len -= 2;
+  Transport *tty = channel < CHANNEL_MAX ? pty(channel) : NULL;
+
+  if (op == CH_WRITE) {
+    if (!tty) return "";
+    // Nobody reading the pty must not stall the console, the rest of
+    // the data is lost.
+    ssize_t res = tty->write((const char*)frame, len);
+    if (res < ssize_t(len)) {
+      if (!dropping_[channel]) {
+        fprintf(stderr, "### channel %u is full, dropping data\n\r",
+                channel);
+      }
+      dropping_[channel] = true;
+    } else {
+      dropping_[channel] = false;
+    }
+    return "";
+  }
+
+  if (op == CH_READ) {
+    // the loader waits for a reply, even an empty one
+    std::string data;
+    if (tty && len >= 2) {
+      data.resize(get_u16(frame));
+      ssize_t res = tty->read(&data[0], data.size());
+      data.resize(res > 0 ? res : 0);
+    }
+    uint8_t header[CHANNEL_REPLY_SIZE];
+    header[0] = ESCAPE;
+    header[1] = ESCAPE;
+    header[2] = CHANNEL_REPLY;
+    put_u16(&header[3], data.size());
+    return std::string((const char*)header, sizeof(header)) + data;
+  }
+  return "";
+}
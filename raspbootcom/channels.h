@@ -0,0 +1,54 @@
+/* channels.h - byte streams of the kernel besides the console */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "transport.h"
+#include "../raspbootin/include/protocol.h"
+
+/* The channels of the kernel (FRAME_CHANNEL frames, see protocol.h),
+ * each one a pty. Channels given a symlink are created right away, the
+ * others when the kernel first uses them. The ptys stay across
+ * reconnects of the serial link.
+ */
+class Channels {
+public:
+  Channels();
+  Channels(const Channels&) = delete;
+  Channels& operator=(const Channels&) = delete;
+
+  // Create the pty of a channel now and symlink it to link.
+  void add(unsigned channel, const std::string& link);
+
+  // Handle one frame. Returns the reply to send, if any.
+  std::string request(const uint8_t *frame, size_t len);
+
+private:
+  // The pty of a channel, created on first use. NULL if that failed.
+  Transport *pty(unsigned channel);
+
+  std::unique_ptr<Transport> ptys_[Protocol::CHANNEL_MAX];
+  // reported a full pty since the last write that went through
+  bool dropping_[Protocol::CHANNEL_MAX];
+};
@@ -0,0 +1,250 @@
+/* console_server.cc - control socket and console clients of the daemon mode */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "console_server.h"
+#include "unix_error.h"
+
+namespace {
+  // Remove a socket left over from an earlier daemon at addr. Only such
+  // a socket refuses connections, one that still runs is left alone.
+  void remove_stale(const std::string& path, const struct sockaddr_un& addr) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1) {
+      if (errno == ENOENT) return;
+      throw UnixError("control socket " + path);
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+      throw UnixError("control socket " + path + " is not a socket", EEXIST);
+    }
+    int fd = UnixError::check("control socket",
+                              socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    int res = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    int err = errno;
+    close(fd);
+    if (res == 0) {
+      throw UnixError("control socket " + path + " is in use", EADDRINUSE);
+    }
+    if (err != ECONNREFUSED) throw UnixError("control socket " + path, err);
+    UnixError::check("remove stale " + path, unlink(path.c_str()));
+  }
+}
+
+ConsoleServer::ConsoleServer(const std::string& path)
+  : path_(path), ring_(RING_SIZE) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(addr.sun_path)) {
+    throw UnixError("control socket " + path_, ENAMETOOLONG);
+  }
+  strcpy(addr.sun_path, path_.c_str());
+  remove_stale(path_, addr);
+  listen_fd_ = UnixError::check("control socket",
+                                socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                       SOCK_CLOEXEC, 0));
+  auto on_error = [this]() { close(listen_fd_); };
+  UnixError::check("bind " + path_,
+                   bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)),
+                   on_error);
+  UnixError::check("listen on " + path_, listen(listen_fd_, 8), on_error);
+}
+
+ConsoleServer::~ConsoleServer() {
+  detach();
+  for (const auto& c : clients_) close(c.first);
+  close(listen_fd_);
+  unlink(path_.c_str());
+}
+
+void ConsoleServer::attach(EventLoop& loop, Handler handler,
+                           Input to_target) {
+  loop_ = &loop;
+  handler_ = handler;
+  to_target_ = to_target;
+  loop_->watch(listen_fd_, POLLIN, [this](short) { accept_client(); });
+  for (const auto& c : clients_) watch(c.first);
+}
+
+void ConsoleServer::detach() {
+  if (!loop_) return;
+  loop_->unwatch(listen_fd_);
+  for (const auto& c : clients_) loop_->unwatch(c.first);
+  loop_ = NULL;
+  handler_ = nullptr;
+  to_target_ = nullptr;
+}
+
+void ConsoleServer::watch(int fd) {
+  loop_->watch(fd, POLLIN, [this, fd](short revents) {
+      client_event(fd, revents);
+    });
+  flush(fd, clients_[fd]);
+}
+
+void ConsoleServer::accept_client() {
+  int fd = UnixError::check_again("accept control connection",
+                                  accept4(listen_fd_, NULL, NULL,
+                                          SOCK_NONBLOCK | SOCK_CLOEXEC));
+  if (fd == -1) return;
+  clients_[fd] = Client();
+  watch(fd);
+}
+
+void ConsoleServer::drop(int fd) {
+  if (loop_) loop_->unwatch(fd);
+  close(fd);
+  clients_.erase(fd);
+}
+
+void ConsoleServer::client_event(int fd, short revents) {
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) return;
+  Client& client = it->second;
+  if (revents & POLLOUT) {
+    flush(fd, client);
+    if (clients_.count(fd) == 0) return;
+  }
+  if (!(revents & (POLLIN | POLLERR | POLLHUP))) return;
+  char buf[4096];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  if (len == -1 && (errno == EAGAIN || errno == EINTR)) return;
+  if (len <= 0) {
+    drop(fd);
+    return;
+  }
+  if (client.console) {
+    input_bytes_ += len;
+    if (to_target_) to_target_(buf, len);
+    return;
+  }
+  if (!client.reply.empty()) return;
+  client.line.append(buf, len);
+  size_t eol = client.line.find('\n');
+  if (eol == std::string::npos) {
+    if (client.line.size() > LINE_MAX) drop(fd);
+    return;
+  }
+  std::string rest = client.line.substr(eol + 1);
+  client.line.erase(eol);
+  if (!client.line.empty() && client.line.back() == '\r') {
+    client.line.pop_back();
+  }
+  if (client.line == "console") {
+    client.console = true;
+    // the scrollback first
+    client.pos = head_ > RING_SIZE ? head_ - RING_SIZE : 0;
+    if (!rest.empty() && to_target_) to_target_(rest.data(), rest.size());
+    flush(fd, client);
+    return;
+  }
+  command(fd, client);
+}
+
+void ConsoleServer::command(int fd, Client& client) {
+  client.reply = handler_(client.line);
+  if (client.reply.empty() || client.reply.back() != '\n') {
+    client.reply += '\n';
+  }
+  flush(fd, client);
+}
+
+void ConsoleServer::output(const char *buf, size_t len) {
+  // only the last RING_SIZE bytes can be kept
+  if (len > RING_SIZE) {
+    head_ += len - RING_SIZE;
+    buf += len - RING_SIZE;
+    len = RING_SIZE;
+  }
+  size_t at = head_ & (RING_SIZE - 1);
+  size_t first = std::min<size_t>(len, RING_SIZE - at);
+  memcpy(&ring_[at], buf, first);
+  memcpy(&ring_[0], buf + first, len - first);
+  head_ += len;
+
+  std::vector<int> consoles;
+  for (const auto& c : clients_) {
+    if (c.second.console) consoles.push_back(c.first);
+  }
+  for (int fd : consoles) flush(fd, clients_[fd]);
+}
+
+void ConsoleServer::flush(int fd, Client& client) {
+  if (!loop_) return;
+  if (!client.console) {
+    while (!client.reply.empty()) {
+      ssize_t res = send(fd, client.reply.data(), client.reply.size(),
+                         MSG_NOSIGNAL);
+      if (res == -1) {
+        if (errno == EAGAIN || errno == EINTR) break;
+        drop(fd);
+        return;
+      }
+      client.reply.erase(0, res);
+      if (client.reply.empty()) {
+        drop(fd);
+        return;
+      }
+    }
+    loop_->set_events(fd, POLLIN | (client.reply.empty() ? 0 : POLLOUT));
+    return;
+  }
+  if (head_ - client.pos > RING_SIZE) {
+    // too slow, skip what has been overwritten
+    dropped_ += head_ - RING_SIZE - client.pos;
+    client.pos = head_ - RING_SIZE;
+  }
+  while (client.pos < head_) {
+    size_t at = client.pos & (RING_SIZE - 1);
+    size_t len = std::min<uint64_t>(head_ - client.pos, RING_SIZE - at);
+    ssize_t res = send(fd, &ring_[at], len, MSG_NOSIGNAL);
+    if (res == -1) {
+      if (errno == EAGAIN || errno == EINTR) break;
+      drop(fd);
+      return;
+    }
+    client.pos += res;
+  }
+  loop_->set_events(fd, POLLIN | (client.pos < head_ ? POLLOUT : 0));
+}
+
+std::string ConsoleServer::stats() const {
+  size_t consoles = std::count_if(clients_.begin(), clients_.end(),
+                                  [](const std::pair<const int, Client>& c) {
+                                    return c.second.console;
+                                  });
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "console clients: %zu\n"
+           "console output: %llu bytes\n"
+           "console input: %llu bytes\n"
+           "dropped for slow clients: %llu bytes\n",
+           consoles, (unsigned long long)head_,
+           (unsigned long long)input_bytes_, (unsigned long long)dropped_);
+  return buf;
+}
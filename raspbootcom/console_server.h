@@ -0,0 +1,104 @@
+/* console_server.h - control socket and console clients of the daemon mode */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+
+/* The UNIX socket of the daemon mode (--daemon). A client sends one
+ * line: "console" makes the connection a console, any other line is a
+ * command for the daemon, answered before the connection is closed.
+ *
+ * A console client first gets the scrollback, then the console output
+ * as it comes in. What it sends goes to the kernel. All console output
+ * goes into one ring buffer and every client is written to straight
+ * from there, from its own position. A client that falls a whole ring
+ * behind loses the oldest part, so a slow reader never holds up the
+ * serial line.
+ *
+ * The socket stays across reconnects of the serial link, commands and
+ * input wait while the device is away.
+ */
+class ConsoleServer {
+public:
+  // Runs a command, returns the reply.
+  typedef std::function<std::string(const std::string& command)> Handler;
+  // Input for the kernel.
+  typedef std::function<void(const char *buf, size_t len)> Input;
+
+  explicit ConsoleServer(const std::string& path);
+  ~ConsoleServer();
+  ConsoleServer(const ConsoleServer&) = delete;
+  ConsoleServer& operator=(const ConsoleServer&) = delete;
+
+  // Serve the clients from loop until detach().
+  void attach(EventLoop& loop, Handler handler, Input to_target);
+  void detach();
+
+  // Console output of the board.
+  void output(const char *buf, size_t len);
+  // Client counts and byte counts for the stats command.
+  std::string stats() const;
+
+private:
+  enum {
+    // scrollback, a power of 2
+    RING_SIZE = 1 << 20,
+    // longest command line
+    LINE_MAX = 4096,
+  };
+
+  struct Client {
+    bool console = false;
+    // the command line so far
+    std::string line;
+    // reply still to send, then close
+    std::string reply;
+    // next byte of the ring to send
+    uint64_t pos = 0;
+  };
+
+  void accept_client();
+  void client_event(int fd, short revents);
+  void command(int fd, Client& client);
+  // Send what the client hasn't got yet.
+  void flush(int fd, Client& client);
+  void drop(int fd);
+  void watch(int fd);
+
+  std::string path_;
+  int listen_fd_ = -1;
+  std::vector<char> ring_;
+  // bytes of console output so far, the ring has the last RING_SIZE
+  uint64_t head_ = 0;
+  std::map<int, Client> clients_;
+  EventLoop *loop_ = NULL;
+  Handler handler_;
+  Input to_target_;
+  uint64_t input_bytes_ = 0;
+  uint64_t dropped_ = 0;
+};
@@ -0,0 +1,149 @@
+/* control_client.cc - talk to a raspbootcom daemon over its control socket */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "control_client.h"
+#include "event_loop.h"
+#include "scope.h"
+#include "unix_error.h"
+
+ControlClient::ControlClient(const std::string& path)
+  : path_(path), fd_(connect_daemon()) {
+}
+
+ControlClient::~ControlClient() {
+  close(fd_);
+}
+
+int ControlClient::connect_daemon() const {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(addr.sun_path)) {
+    throw UnixError("control socket " + path_, ENAMETOOLONG);
+  }
+  strcpy(addr.sun_path, path_.c_str());
+  int fd = UnixError::check("control socket",
+                            socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  UnixError::check("connect to " + path_,
+                   connect(fd, (struct sockaddr*)&addr, sizeof(addr)),
+                   [fd]() { close(fd); });
+  return fd;
+}
+
+// write all of len to a blocking fd
+static void send_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t res = UnixError::check_again("write",
+                                         send(fd, buf, len, MSG_NOSIGNAL));
+    if (res == -1) continue;
+    buf += res;
+    len -= res;
+  }
+}
+
+int ControlClient::command(const std::string& line) {
+  std::string request = line + "\n";
+  send_all(fd_, request.data(), request.size());
+  // the daemon closes the connection after the reply
+  char buf[4096];
+  ssize_t len;
+  while ((len = UnixError::check_again("read reply",
+                                       read(fd_, buf, sizeof(buf)))) != 0) {
+    if (len == -1) continue;
+    fwrite(buf, 1, len, stdout);
+  }
+  return 0;
+}
+
+int ControlClient::console() {
+  send_all(fd_, "console\n", 8);
+
+  struct termios old_tio;
+  bool tty = isatty(STDIN_FILENO);
+  if (tty) {
+    UnixError::check("get terminal settings",
+                     tcgetattr(STDIN_FILENO, &old_tio));
+    struct termios new_tio = old_tio;
+    // disable canonical mode (buffered i/o) and local echo
+    new_tio.c_lflag &= (~ICANON & ~ECHO);
+    UnixError::check("set terminal settings",
+                     tcsetattr(STDIN_FILENO, TCSANOW, &new_tio));
+  }
+  SCOPE_EXIT {
+    if (tty) tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+  };
+
+  EventLoop loop;
+  bool running = true;
+  bool escape = false;
+  loop.watch(fd_, POLLIN, [&](short) {
+      char buf[65536];
+      ssize_t len = UnixError::check_again("read from daemon",
+                                           read(fd_, buf, sizeof(buf)));
+      if (len == -1) return;
+      if (len == 0) {
+        fprintf(stderr, "\n\r### daemon closed the console\n\r");
+        running = false;
+        return;
+      }
+      fwrite(buf, 1, len, stdout);
+      fflush(stdout);
+    });
+  loop.watch(STDIN_FILENO, POLLIN, [&](short) {
+      char buf[4096];
+      ssize_t len = UnixError::check_again("read from stdin",
+                                           read(STDIN_FILENO, buf,
+                                                sizeof(buf)));
+      if (len == -1) return;
+      if (len == 0) {
+        running = false;
+        return;
+      }
+      std::string input;
+      for (ssize_t i = 0; i < len; ++i) {
+        if (escape) {
+          escape = false;
+          if (buf[i] == 'q') {
+            running = false;
+            return;
+          }
+          if (buf[i] == 'b') {
+            ControlClient(path_).command("break");
+            continue;
+          }
+          if (buf[i] != ESCAPE_KEY) input += char(ESCAPE_KEY);
+        } else if (buf[i] == ESCAPE_KEY) {
+          escape = true;
+          continue;
+        }
+        input += buf[i];
+      }
+      send_all(fd_, input.data(), input.size());
+    });
+  while (running) loop.run_once();
+  return 0;
+}
@@ -0,0 +1,51 @@
+/* control_client.h - talk to a raspbootcom daemon over its control socket */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <string>
+
+/* The other side of the ConsoleServer (--control). A command is sent
+ * on its own connection and the reply copied to stdout. The console
+ * connects the terminal to the board like raspbootcom itself does; ^] b
+ * sends the daemon a break command, ^] q quits.
+ */
+class ControlClient {
+public:
+  explicit ControlClient(const std::string& path);
+  ~ControlClient();
+  ControlClient(const ControlClient&) = delete;
+  ControlClient& operator=(const ControlClient&) = delete;
+
+  // Run one command, returns the exit code.
+  int command(const std::string& line);
+  // Attach the terminal to the console until ^] q or the daemon quits.
+  int console();
+
+private:
+  enum {
+    ESCAPE_KEY = 0x1d,
+  };
+
+  // a new connection to the daemon
+  int connect_daemon() const;
+
+  std::string path_;
+  int fd_;
+};
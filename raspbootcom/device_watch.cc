@@ -0,0 +1,99 @@
+/* device_watch.cc - wait for a serial device to (re)appear */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "device_watch.h"
+#include "unix_error.h"
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thread>
+
+enum {
+  // multicast groups of NETLINK_KOBJECT_UEVENT
+  GROUP_KERNEL = 1, // sent by the kernel when the device node is created
+  GROUP_UDEV = 2,   // sent by udev after permissions and symlinks are set
+};
+
+DeviceWatcher::DeviceWatcher() {
+  fd_ = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+               NETLINK_KOBJECT_UEVENT);
+  if (fd_ == -1) return;
+
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = GROUP_KERNEL | GROUP_UDEV;
+  if (bind(fd_, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+DeviceWatcher::~DeviceWatcher() {
+  if (fd_ != -1) close(fd_);
+}
+
+void DeviceWatcher::wait(std::chrono::milliseconds timeout) {
+  if (fd_ == -1) {
+    std::this_thread::sleep_for(timeout);
+    return;
+  }
+
+  auto end = std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  end - std::chrono::steady_clock::now()).count();
+    if (left <= 0) return;
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    int res = poll(&pfd, 1, left);
+    if (res == -1) {
+      if (errno == EINTR) return; // let the caller look at keep_running
+      throw UnixError("poll uevents");
+    }
+    if (res == 1 && drain()) return;
+  }
+}
+
+bool DeviceWatcher::drain() {
+  bool found = false;
+  char buf[8192];
+  while (true) {
+    ssize_t len = recv(fd_, buf, sizeof(buf) - 1, 0);
+    if (len == -1) {
+      if (errno == EINTR) continue;
+      // events were dropped, one of them might have been ours
+      if (errno == ENOBUFS) return true;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return found;
+      throw UnixError("read uevent");
+    }
+    buf[len] = 0;
+
+    // Both kernel and udev messages carry NUL separated KEY=VALUE
+    // pairs (udev after a binary header, which never matches below).
+    bool tty = false, gone = false;
+    for (const char *p = buf; p < buf + len; p += strlen(p) + 1) {
+      if (strcmp(p, "SUBSYSTEM=tty") == 0) tty = true;
+      if (strcmp(p, "ACTION=remove") == 0) gone = true;
+    }
+    if (tty && !gone) found = true;
+  }
+}
@@ -0,0 +1,46 @@
+/* device_watch.h - wait for a serial device to (re)appear */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <chrono>
+
+// Listens for kernel and udev uevents of the tty subsystem so a
+// replugged USB serial converter can be reopened as soon as it shows
+// up. Without the netlink socket (e.g. in a container) wait() just
+// sleeps and the caller falls back to polling.
+class DeviceWatcher {
+public:
+  DeviceWatcher();
+  ~DeviceWatcher();
+  DeviceWatcher(const DeviceWatcher&) = delete;
+  DeviceWatcher& operator=(const DeviceWatcher&) = delete;
+
+  // true if uevents are available
+  bool active() const { return fd_ != -1; }
+
+  // Wait until a tty device was added or changed, the timeout expired
+  // or a signal arrived.
+  void wait(std::chrono::milliseconds timeout);
+
+private:
+  // read all queued uevents, returns true if one was for a tty
+  bool drain();
+
+  int fd_;
+};
@@ -0,0 +1,93 @@
+/* event_loop.cc - poll() based event loop */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "event_loop.h"
+#include "unix_error.h"
+
+#include <vector>
+
+void EventLoop::watch(int fd, short events, FdCallback cb) {
+  watches_[fd] = Watch{events, std::move(cb)};
+}
+
+void EventLoop::set_events(int fd, short events) {
+  auto it = watches_.find(fd);
+  if (it != watches_.end()) {
+    it->second.events = events;
+  }
+}
+
+void EventLoop::unwatch(int fd) {
+  watches_.erase(fd);
+}
+
+int EventLoop::add_timer(Clock::duration delay, TimerCallback cb) {
+  int id = next_timer_++;
+  timers_[id] = Timer{Clock::now() + delay, std::move(cb)};
+  return id;
+}
+
+void EventLoop::cancel_timer(int id) {
+  timers_.erase(id);
+}
+
+void EventLoop::run_once() {
+  // wait no longer than the next timer
+  int timeout = -1;
+  auto now = Clock::now();
+  for (const auto& t : timers_) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                t.second.when - now).count();
+    if (ms < 0) ms = 0;
+    if (timeout == -1 || ms < timeout) timeout = ms + 1;
+  }
+
+  std::vector<struct pollfd> fds;
+  for (const auto& w : watches_) {
+    fds.push_back({w.first, w.second.events, 0});
+  }
+
+  int res = poll(fds.data(), fds.size(), timeout);
+  if (res == -1) {
+    if (errno == EINTR) return; // let the caller look at keep_running
+    throw UnixError("poll");
+  }
+
+  // Callbacks may add or remove watches, so look each one up again.
+  for (const auto& pfd : fds) {
+    if (pfd.revents == 0) continue;
+    auto it = watches_.find(pfd.fd);
+    if (it == watches_.end()) continue;
+    FdCallback cb = it->second.cb;
+    cb(pfd.revents);
+  }
+
+  // Timer callbacks may add or cancel timers too.
+  now = Clock::now();
+  std::vector<int> due;
+  for (const auto& t : timers_) {
+    if (t.second.when <= now) due.push_back(t.first);
+  }
+  for (int id : due) {
+    auto it = timers_.find(id);
+    if (it == timers_.end()) continue;
+    TimerCallback cb = std::move(it->second.cb);
+    timers_.erase(it);
+    cb();
+  }
+}
@@ -0,0 +1,58 @@
+/* event_loop.h - poll() based event loop */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <poll.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+
+class EventLoop {
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::function<void(short revents)> FdCallback;
+  typedef std::function<void()> TimerCallback;
+
+  // Watch fd for events, replaces an existing watch for the same fd.
+  void watch(int fd, short events, FdCallback cb);
+  // Change the events an existing watch waits for.
+  void set_events(int fd, short events);
+  void unwatch(int fd);
+
+  // Call cb once after delay. Returns an id for cancel_timer().
+  int add_timer(Clock::duration delay, TimerCallback cb);
+  void cancel_timer(int id);
+
+  // Wait for one round of events (or a signal) and dispatch them.
+  void run_once();
+
+private:
+  struct Watch {
+    short events;
+    FdCallback cb;
+  };
+  struct Timer {
+    Clock::time_point when;
+    TimerCallback cb;
+  };
+  std::map<int, Watch> watches_;
+  std::map<int, Timer> timers_;
+  int next_timer_ = 0;
+};
@@ -0,0 +1,124 @@
+/* gdb_server.cc - forward a GDB connection to the loader's stub */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "gdb_server.h"
+#include "unix_error.h"
+
+#include <string>
+
+GdbServer::GdbServer(EventLoop& loop, unsigned port, Input to_target)
+  : loop_(loop), port_(port), to_target_(to_target) {
+  listen_fd_ = UnixError::check("gdb socket",
+                                socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+                                       SOCK_CLOEXEC, 0));
+  int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port_);
+  auto on_error = [this]() { close(listen_fd_); };
+  UnixError::check("bind gdb port " + std::to_string(port_),
+                   bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)),
+                   on_error);
+  UnixError::check("listen on gdb port", listen(listen_fd_, 1), on_error);
+  loop_.watch(listen_fd_, POLLIN, [this](short) { accept_client(); });
+}
+
+GdbServer::~GdbServer() {
+  drop_client();
+  loop_.unwatch(listen_fd_);
+  close(listen_fd_);
+}
+
+void GdbServer::accept_client() {
+  int fd = UnixError::check_again("accept gdb connection",
+                                  accept4(listen_fd_, NULL, NULL,
+                                          SOCK_NONBLOCK | SOCK_CLOEXEC));
+  if (fd == -1) return;
+  if (client_fd_ != -1) {
+    close(fd);
+    return;
+  }
+  // packets are small and latency matters
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  client_fd_ = fd;
+  out_.clear();
+  fprintf(stderr, "### gdb connected\n\r");
+  loop_.watch(client_fd_, POLLIN, [this](short revents) {
+      client_event(revents);
+    });
+}
+
+void GdbServer::drop_client() {
+  if (client_fd_ == -1) return;
+  loop_.unwatch(client_fd_);
+  close(client_fd_);
+  client_fd_ = -1;
+  out_.clear();
+  fprintf(stderr, "### gdb disconnected\n\r");
+}
+
+void GdbServer::client_event(short revents) {
+  if (revents & POLLOUT) flush();
+  if (client_fd_ == -1) return;
+  if (revents & (POLLIN | POLLERR | POLLHUP)) {
+    char buf[4096];
+    ssize_t len = read(client_fd_, buf, sizeof(buf));
+    if (len == -1 && (errno == EAGAIN || errno == EINTR)) return;
+    if (len <= 0) {
+      drop_client();
+      return;
+    }
+    to_target_(buf, len);
+  }
+}
+
+void GdbServer::send(const std::string& data) {
+  if (client_fd_ == -1) return;
+  out_ += data;
+  if (out_.size() > MAX_BUFFERED) {
+    fprintf(stderr, "### gdb doesn't read, dropping it\n\r");
+    drop_client();
+    return;
+  }
+  flush();
+}
+
+void GdbServer::flush() {
+  while (!out_.empty()) {
+    ssize_t res = ::send(client_fd_, out_.data(), out_.size(), MSG_NOSIGNAL);
+    if (res == -1) {
+      if (errno == EAGAIN || errno == EINTR) break;
+      drop_client();
+      return;
+    }
+    out_.erase(0, res);
+  }
+  loop_.set_events(client_fd_, POLLIN | (out_.empty() ? 0 : POLLOUT));
+}
@@ -0,0 +1,64 @@
+/* gdb_server.h - forward a GDB connection to the loader's stub */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+
+#include "event_loop.h"
+
+/* Lets GDB debug the kernel over the serial line: "target remote :PORT".
+ *
+ * The loader's stub (raspbootin/gdbstub.cc) speaks the GDB remote serial
+ * protocol. Its packets arrive in FRAME_GDB frames and go to the client
+ * as they are, the client's packets go to the serial line unchanged.
+ * Only one client at a time, later connections are refused until it
+ * disconnects. The server listens on localhost only.
+ */
+class GdbServer {
+public:
+  // to_target: write bytes from GDB to the serial line
+  typedef std::function<void(const char *buf, size_t len)> Input;
+
+  GdbServer(EventLoop& loop, unsigned port, Input to_target);
+  ~GdbServer();
+
+  // Data of a FRAME_GDB, dropped if no client is connected.
+  void send(const std::string& data);
+
+private:
+  enum {
+    // drop a client that doesn't read its data
+    MAX_BUFFERED = 1 << 20,
+  };
+
+  void accept_client();
+  void client_event(short revents);
+  void drop_client();
+  void flush();
+
+  EventLoop& loop_;
+  unsigned port_;
+  Input to_target_;
+  int listen_fd_ = -1;
+  int client_fd_ = -1;
+  std::string out_;
+};
@@ -0,0 +1,62 @@
+/* kernel_stream.cc - a kernel read from a pipe while it is produced */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kernel_stream.h"
+#include "unix_error.h"
+
+KernelStream::KernelStream(const std::string& name) : name_(name) {
+  if (name_ == "-") {
+    fd_ = STDIN_FILENO;
+  } else {
+    fd_ = UnixError::check("open kernel",
+                           open(name_.c_str(), O_RDONLY | O_CLOEXEC));
+  }
+  int flags = UnixError::check("get kernel flags", fcntl(fd_, F_GETFL));
+  UnixError::check("set kernel non-blocking",
+                   fcntl(fd_, F_SETFL, flags | O_NONBLOCK));
+}
+
+KernelStream::~KernelStream() {
+  if (fd_ > STDIN_FILENO) close(fd_);
+}
+
+bool KernelStream::is_stream(const char *name) {
+  struct stat st;
+  if (std::string(name) == "-") return true;
+  return stat(name, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+bool KernelStream::read() {
+  if (fd_ == -1) return false;
+  char buf[65536];
+  ssize_t len = UnixError::check_again("reading kernel",
+                                       ::read(fd_, buf, sizeof(buf)));
+  if (len == -1) return true;
+  if (len == 0) {
+    if (fd_ > STDIN_FILENO) close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  data_.insert(data_.end(), buf, buf + len);
+  return true;
+}
@@ -0,0 +1,58 @@
+/* kernel_stream.h - a kernel read from a pipe while it is produced */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* A kernel that arrives through a pipe (stdin or e.g. <(make ...)),
+ * so it can be sent while the build still writes it. The pipe is read
+ * from the event loop as data comes in and everything is kept: a pipe
+ * can only be read once, later boot requests get the same kernel.
+ */
+class KernelStream {
+public:
+  // name: "-" for stdin, or a pipe to open
+  explicit KernelStream(const std::string& name);
+  ~KernelStream();
+  KernelStream(const KernelStream&) = delete;
+  KernelStream& operator=(const KernelStream&) = delete;
+
+  // Is name a pipe rather than a file that can be read again?
+  static bool is_stream(const char *name);
+
+  const std::string& name() const { return name_; }
+  // fd to poll for more data, -1 at the end
+  int fd() const { return fd_; }
+  // Read some of what is available. Returns false once the writer is
+  // done.
+  bool read();
+  bool eof() const { return fd_ == -1; }
+  // the kernel so far
+  const std::vector<uint8_t>& data() const { return data_; }
+
+private:
+  std::string name_;
+  int fd_;
+  std::vector<uint8_t> data_;
+};
@@ -0,0 +1,188 @@
+/* link.cc - adapt baud rate and frame size to the link quality */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "link.h"
+#include "../raspbootin/include/protocol.h"
+
+const size_t LinkController::FRAME_SIZES[NUM_FRAME_SIZES] = {
+  64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+};
+
+namespace {
+  const unsigned ALL_BAUDS[] = {
+    115200, 230400, 460800, 500000, 576000, 921600, 1000000, 1152000,
+    1500000, 2000000, 2500000, 3000000, 3500000, 4000000,
+  };
+
+  std::string links_file() {
+    const char *home = getenv("HOME");
+    if (home == NULL) return "";
+    return std::string(home) + "/.raspbootcom-links";
+  }
+}
+
+LinkController::LinkController(const Transport& transport)
+  : device_(transport.name()) {
+  for (unsigned baud : ALL_BAUDS) {
+    if (transport.baud_supported(baud)) bauds_.push_back(baud);
+  }
+  load();
+  max_baud_idx_ = bauds_.size() - 1;
+}
+
+void LinkController::load() {
+  std::ifstream in(links_file());
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string device;
+    unsigned baud;
+    size_t frame;
+    if (!(fields >> device >> baud >> frame) || device != device_) continue;
+    for (size_t i = 0; i < bauds_.size(); ++i) {
+      if (bauds_[i] == baud) best_baud_idx_ = i;
+    }
+    for (int i = 0; i < NUM_FRAME_SIZES; ++i) {
+      if (FRAME_SIZES[i] == frame) best_frame_idx_ = i;
+    }
+  }
+}
+
+void LinkController::save() {
+  std::string file = links_file();
+  if (file.empty()) return;
+
+  // keep the entries of other devices
+  std::ostringstream out;
+  {
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string device;
+      if ((fields >> device) && device == device_) continue;
+      out << line << "\n";
+    }
+  }
+  out << device_ << " " << bauds_[best_baud_idx_] << " "
+      << FRAME_SIZES[best_frame_idx_] << "\n";
+
+  std::string tmp = file + ".tmp";
+  std::ofstream f(tmp);
+  f << out.str();
+  f.close();
+  if (!f || rename(tmp.c_str(), file.c_str()) == -1) {
+    fprintf(stderr, "### can't save link settings to %s\n\r", file.c_str());
+  }
+}
+
+void LinkController::session_start() {
+  // start where the last session did best
+  baud_idx_ = best_baud_idx_;
+  frame_idx_ = best_frame_idx_;
+  max_baud_idx_ = bauds_.size() - 1;
+  clean_ = errors_ = 0;
+  best_goodput_ = 0;
+  setting_changed();
+}
+
+void LinkController::finish() {
+  save();
+  fprintf(stderr, "### best link: %u baud, %zu byte frames "
+          "[%.0f byte/s]\n\r", bauds_[best_baud_idx_],
+          FRAME_SIZES[best_frame_idx_], best_goodput_);
+}
+
+void LinkController::setting_changed() {
+  measure_start_ = Clock::now();
+  measure_bytes_ = 0;
+  clean_ = 0;
+}
+
+void LinkController::frame_ok(size_t bytes) {
+  measure_bytes_ += bytes;
+  auto secs = std::chrono::duration<double>(
+                Clock::now() - measure_start_).count();
+  // need a few frames for a meaningful number
+  if (secs > 0.1) {
+    double goodput = measure_bytes_ / secs;
+    if (goodput > best_goodput_) {
+      best_goodput_ = goodput;
+      best_baud_idx_ = baud_idx_;
+      best_frame_idx_ = frame_idx_;
+    }
+  }
+
+  if (++clean_ < UP_AFTER) return;
+
+  // The baud rate gains the most, then larger frames save on headers
+  // and round trips.
+  if (baud_idx_ < max_baud_idx_) {
+    ++baud_idx_;
+    errors_ = 0;
+    setting_changed();
+  } else if (frame_idx_ < NUM_FRAME_SIZES - 1) {
+    ++frame_idx_;
+    setting_changed();
+  } else {
+    clean_ = 0;
+  }
+}
+
+void LinkController::frame_error() {
+  // Smaller frames waste less on retransmits.
+  if (frame_idx_ > 0) --frame_idx_;
+  if (++errors_ >= ERRORS_PER_BAUD) {
+    step_down_baud();
+  }
+  setting_changed();
+}
+
+void LinkController::link_error() {
+  step_down_baud();
+  if (frame_idx_ > 0) --frame_idx_;
+  setting_changed();
+}
+
+void LinkController::baud_rejected() {
+  step_down_baud();
+  setting_changed();
+}
+
+void LinkController::baud_confirmed() {
+  setting_changed();
+}
+
+void LinkController::step_down_baud() {
+  // don't come back to a rate that failed during this session
+  if (baud_idx_ > 0) {
+    max_baud_idx_ = baud_idx_ - 1;
+    --baud_idx_;
+  }
+  if (best_baud_idx_ > baud_idx_) {
+    best_baud_idx_ = baud_idx_;
+    best_frame_idx_ = frame_idx_;
+  }
+  errors_ = 0;
+}
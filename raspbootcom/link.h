@@ -0,0 +1,92 @@
+/* link.h - adapt baud rate and frame size to the link quality */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+/* The loader reports the receive errors (overrun, framing, parity,
+ * break) of every frame. The controller uses them to step the baud
+ * rate and the frame size up while frames come through clean and down
+ * when they don't. It measures the goodput at each setting and
+ * remembers the best one per device in ~/.raspbootcom-links so the next
+ * boot starts there.
+ */
+class LinkController {
+public:
+  explicit LinkController(const Transport& transport);
+
+  // Start of a transfer, resets the per session limits.
+  void session_start();
+  // Remember the best setting of the session.
+  void finish();
+
+  unsigned baud() const { return bauds_[baud_idx_]; }
+  size_t frame_size() const { return FRAME_SIZES[frame_idx_]; }
+
+  // A frame arrived without errors.
+  void frame_ok(size_t bytes);
+  // A frame arrived with framing or parity errors.
+  void frame_error();
+  // The link lost sync (overrun, timeout, failed baud switch).
+  void link_error();
+  // The loader can't generate the requested baud rate.
+  void baud_rejected();
+  // The line runs at baud() now.
+  void baud_confirmed();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+  enum {
+    // clean frames before trying the next step up
+    UP_AFTER = 8,
+    // frame errors at one baud rate before stepping it down
+    ERRORS_PER_BAUD = 3,
+    NUM_FRAME_SIZES = 9,
+    // 1024 bytes to start with
+    DEFAULT_FRAME_IDX = 4,
+  };
+  static const size_t FRAME_SIZES[NUM_FRAME_SIZES];
+
+  void load();
+  void save();
+  void step_down_baud();
+  void setting_changed();
+
+  std::string device_;
+  std::vector<unsigned> bauds_;
+  int baud_idx_ = 0;
+  int frame_idx_ = DEFAULT_FRAME_IDX;
+  // highest baud index not known to fail in this session
+  int max_baud_idx_;
+  int clean_ = 0;
+  int errors_ = 0;
+
+  // goodput at the current setting
+  Clock::time_point measure_start_;
+  size_t measure_bytes_ = 0;
+  double best_goodput_ = 0;
+  int best_baud_idx_ = 0;
+  int best_frame_idx_ = DEFAULT_FRAME_IDX;
+};
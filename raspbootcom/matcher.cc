@@ -0,0 +1,74 @@
+/* matcher.cc - find many strings in a stream at once (Aho-Corasick) */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <deque>
+
+#include "matcher.h"
+
+Matcher::Matcher() : next_(256, NONE), found_(1) {
+}
+
+size_t Matcher::add(const std::string& pattern) {
+  uint32_t state = 0;
+  for (char c : pattern) {
+    size_t index = state * 256 + uint8_t(c);
+    if (next_[index] == NONE) {
+      next_[index] = found_.size();
+      found_.emplace_back();
+      next_.resize(next_.size() + 256, NONE);
+    }
+    state = next_[index];
+  }
+  found_[state].push_back(patterns_);
+  return patterns_++;
+}
+
+void Matcher::build() {
+  // Breadth first, so the fallback (longest proper suffix in the trie)
+  // of a state is done before its children. Missing transitions take
+  // the fallback's, which makes the trie a DFA.
+  std::vector<uint32_t> fallback(found_.size(), 0);
+  std::deque<uint32_t> queue;
+  for (int c = 0; c < 256; ++c) {
+    uint32_t& next = next_[c];
+    if (next == NONE) {
+      next = 0;
+    } else {
+      queue.push_back(next);
+    }
+  }
+  while (!queue.empty()) {
+    uint32_t state = queue.front();
+    queue.pop_front();
+    uint32_t back = fallback[state];
+    // the patterns ending in a suffix end here too
+    found_[state].insert(found_[state].end(), found_[back].begin(),
+                         found_[back].end());
+    for (int c = 0; c < 256; ++c) {
+      uint32_t& next = next_[state * 256 + c];
+      if (next == NONE) {
+        next = next_[back * 256 + c];
+      } else {
+        fallback[next] = next_[back * 256 + c];
+        queue.push_back(next);
+      }
+    }
+  }
+  state_ = 0;
+}
@@ -0,0 +1,70 @@
+/* matcher.h - find many strings in a stream at once (Aho-Corasick) */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/* Aho-Corasick automaton, built into a full DFA: one table lookup per
+ * byte and never a step back, whatever the patterns. The state carries
+ * over between scan() calls, so matches across reads are found.
+ */
+class Matcher {
+public:
+  Matcher();
+
+  // Add a pattern (not empty). Returns its id, counting from 0.
+  size_t add(const std::string& pattern);
+  // Build the automaton after the last add().
+  void build();
+  // Forget a partial match.
+  void reset() { state_ = 0; }
+
+  // Scan data, calling match(id, end) for every pattern ending in it.
+  // end counts the bytes scanned so far up to the end of the match.
+  template<typename F>
+  void scan(const char *buf, size_t len, F match) {
+    uint32_t state = state_;
+    for (size_t i = 0; i < len; ++i) {
+      state = next_[state * 256 + uint8_t(buf[i])];
+      if (!found_[state].empty()) {
+        state_ = state;
+        for (size_t id : found_[state]) match(id, pos_ + i + 1);
+      }
+    }
+    state_ = state;
+    pos_ += len;
+  }
+
+private:
+  enum : uint32_t { NONE = ~0U };
+
+  // transitions, 256 per state, state 0 is the root
+  std::vector<uint32_t> next_;
+  // patterns ending in each state
+  std::vector<std::vector<size_t>> found_;
+  size_t patterns_ = 0;
+  uint32_t state_ = 0;
+  // bytes scanned
+  uint64_t pos_ = 0;
+};
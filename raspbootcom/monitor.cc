@@ -0,0 +1,532 @@
+/* monitor.cc - run monitor commands on the loader */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <stdexcept>
+
+#include "monitor.h"
+#include "unix_error.h"
+#include "scope.h"
+#include "../raspbootin/include/crc32.h"
+#include "../raspbootin/include/lz.h"
+#include "../raspbootin/include/protocol.h"
+
+using namespace Protocol;
+
+namespace {
+  uint32_t parse_number(const std::string& word) {
+    char *end;
+    errno = 0;
+    unsigned long x = strtoul(word.c_str(), &end, 0);
+    if (word.empty() || *end != 0 || errno != 0 || x > 0xFFFFFFFFUL) {
+      throw std::invalid_argument("bad number '" + word + "'");
+    }
+    return x;
+  }
+
+  std::vector<uint8_t> make_payload(uint32_t addr) {
+    std::vector<uint8_t> payload(4);
+    put_u32(&payload[0], addr);
+    return payload;
+  }
+
+  void append_u32(std::vector<uint8_t>& payload, uint32_t x) {
+    payload.resize(payload.size() + 4);
+    put_u32(&payload[payload.size() - 4], x);
+  }
+}
+
+Monitor::Script Monitor::parse(const std::string& text) {
+  Script script;
+  std::istringstream commands(text);
+  std::string command;
+  while (std::getline(commands, command, ';')) {
+    std::istringstream in(command);
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word) words.push_back(word);
+    if (words.empty()) continue;
+    if (!script.empty() && script.back().kind == Op::GO) {
+      throw std::invalid_argument("go must be the last command");
+    }
+
+    const std::string& name = words[0];
+    size_t args = words.size() - 1;
+    Op op;
+    op.len = 0;
+    if (name == "peek" && (args == 1 || args == 2)) {
+      op.kind = Op::PEEK;
+      op.len = args == 2 ? parse_number(words[2]) : 1;
+      if (op.len == 0 || op.len > PEEK_MAX) {
+        throw std::invalid_argument("peek: count out of range");
+      }
+    } else if (name == "poke" && args >= 2) {
+      op.kind = Op::POKE;
+      if (args - 1 > (MAX_PAYLOAD - 4) / 4) {
+        throw std::invalid_argument("poke: too many words");
+      }
+      for (size_t i = 2; i < words.size(); ++i) {
+        op.words.push_back(parse_number(words[i]));
+      }
+    } else if (name == "dump" && args == 3) {
+      op.kind = Op::DUMP;
+      op.len = parse_number(words[2]);
+      op.file = words[3];
+    } else if (name == "load" && args == 2) {
+      op.kind = Op::LOAD;
+      op.file = words[2];
+    } else if (name == "fill" && args == 3) {
+      op.kind = Op::FILL;
+      op.len = parse_number(words[2]);
+      uint32_t byte = parse_number(words[3]);
+      if (byte > 0xFF) {
+        throw std::invalid_argument("fill: value is not a byte");
+      }
+      op.words.push_back(byte);
+    } else if (name == "crc" && args == 2) {
+      op.kind = Op::CRC;
+      op.len = parse_number(words[2]);
+    } else if (name == "gdb" && args == 0) {
+      op.kind = Op::GDB;
+    } else if (name == "go" && args == 1) {
+      op.kind = Op::GO;
+    } else {
+      throw std::invalid_argument("bad monitor command '" + command + "'");
+    }
+    op.addr = args > 0 ? parse_number(words[1]) : 0;
+    if ((op.kind == Op::PEEK || op.kind == Op::POKE) && (op.addr & 3)) {
+      throw std::invalid_argument(name + ": address is not word aligned");
+    }
+    script.push_back(op);
+  }
+  return script;
+}
+
+Monitor::Monitor(EventLoop& loop, Transport& transport,
+                 const Script& script, LinkController& link)
+  : loop_(loop), transport_(transport), link_(link), script_(script),
+    baud_(DEFAULT_BAUD) {
+  fprintf(stderr, "\n\r### running monitor script [%zu commands]\n\r",
+          script_.size());
+  link_.session_start();
+  if (link_.baud() != DEFAULT_BAUD) {
+    switch_baud();
+  } else {
+    run_next();
+  }
+}
+
+Monitor::~Monitor() {
+  cancel_timer(reply_timer_);
+  cancel_timer(step_timer_);
+  if (file_fd_ != -1) close(file_fd_);
+}
+
+void Monitor::cancel_timer(int& id) {
+  if (id != -1) {
+    loop_.cancel_timer(id);
+    id = -1;
+  }
+}
+
+void Monitor::set_line_baud(unsigned baud) {
+  transport_.set_baud(baud);
+  baud_ = baud;
+}
+
+void Monitor::settle(std::function<void()> next) {
+  step_timer_ = loop_.add_timer(std::chrono::milliseconds(SETTLE_MS),
+                                [this, next]() {
+                                  step_timer_ = -1;
+                                  next();
+                                });
+}
+
+void Monitor::call(uint8_t cmd, const std::vector<uint8_t>& payload,
+                   size_t reply_len, size_t work_bytes, Handler handler) {
+  uint8_t header[HEADER_SIZE];
+  header[0] = cmd;
+  put_u16(&header[1], payload.size());
+  out_.append((const char*)header, sizeof(header));
+  out_.append((const char*)payload.data(), payload.size());
+  waiting_ = true;
+  handler_ = handler;
+
+  size_t bytes = payload.size() + reply_len + 64;
+  auto timeout = std::chrono::milliseconds(
+                   REPLY_MARGIN_MS + bytes * 2000 / (baud_ / 10) +
+                   work_bytes / WORK_BYTES_PER_MS);
+  reply_timer_ = loop_.add_timer(timeout, [this]() {
+      reply_timer_ = -1;
+      link_failed("timeout waiting for reply");
+    });
+}
+
+void Monitor::link_failed(const char *why) {
+  waiting_ = false;
+  cancel_timer(reply_timer_);
+  if (phase_ == SWITCHING) {
+    fprintf(stderr, "### %s at %u baud, staying at %u baud\n\r",
+            why, baud_, unsigned(DEFAULT_BAUD));
+    break_line([this]() {
+        phase_ = RUNNING;
+        run_next();
+      });
+    return;
+  }
+  fail(why);
+}
+
+void Monitor::fail(const std::string& msg) {
+  fprintf(stderr, "### monitor: %s, skipping the rest of the script\n\r",
+          msg.c_str());
+  waiting_ = false;
+  cancel_timer(reply_timer_);
+  cancel_timer(step_timer_);
+  if (file_fd_ != -1) {
+    close(file_fd_);
+    file_fd_ = -1;
+  }
+  op_ = nullptr;
+  // the loader may be waiting for the rest of a packet
+  break_line([this]() { phase_ = DONE; });
+}
+
+void Monitor::break_line(std::function<void()> next) {
+  out_.clear();
+  out_pos_ = 0;
+  rx_.clear();
+  transport_.discard_output();
+  if (transport_.sends_break()) {
+    transport_.set_break(true);
+  } else {
+    fprintf(stderr, "### %s can't send a BREAK, waiting for the loader "
+            "to time out\n\r", transport_.name().c_str());
+  }
+  step_timer_ = loop_.add_timer(
+    std::chrono::milliseconds(BREAK_MS), [this, next]() {
+      if (transport_.sends_break()) transport_.set_break(false);
+      set_line_baud(DEFAULT_BAUD);
+      transport_.discard_input();
+      settle(next);
+    });
+}
+
+void Monitor::switch_baud() {
+  phase_ = SWITCHING;
+  unsigned baud = link_.baud();
+  std::vector<uint8_t> payload = make_payload(baud);
+  call(CMD_BAUD, payload, 0, 0,
+       [this, baud](uint8_t status, const uint8_t *, size_t) {
+         if (status != ACK) {
+           phase_ = RUNNING;
+           run_next();
+           return;
+         }
+         // check the new rate with a ping
+         set_line_baud(baud);
+         settle([this]() {
+             std::vector<uint8_t> token(1, 'M');
+             call(CMD_PING, token, 1, 0,
+                  [this](uint8_t, const uint8_t *, size_t) {
+                    phase_ = RUNNING;
+                    run_next();
+                  });
+           });
+       });
+}
+
+void Monitor::finish() {
+  if (baud_ == DEFAULT_BAUD) {
+    phase_ = DONE;
+    return;
+  }
+  // the kernel sender starts at the default baud rate
+  phase_ = RETURNING;
+  call(CMD_BAUD, make_payload(DEFAULT_BAUD), 0, 0,
+       [this](uint8_t, const uint8_t *, size_t) {
+         set_line_baud(DEFAULT_BAUD);
+         settle([this]() { phase_ = DONE; });
+       });
+}
+
+void Monitor::report(const char *what, size_t bytes) {
+  auto secs = std::chrono::duration<double>(
+                EventLoop::Clock::now() - start_).count();
+  fprintf(stderr, "### %s %zu byte %s %s [%.1f s, %.0f byte/s]\n\r",
+          what, bytes, op_->kind == Op::DUMP ? "to" : "from",
+          op_->file.c_str(), secs, secs > 0 ? bytes / secs : 0.0);
+}
+
+void Monitor::run_next() {
+  if (next_op_ == script_.size()) {
+    finish();
+    return;
+  }
+  const Op& op = script_[next_op_++];
+  std::vector<uint8_t> payload = make_payload(op.addr);
+  switch (op.kind) {
+  case Op::PEEK:
+    append_u32(payload, op.len);
+    call(CMD_PEEK, payload, 4 * op.len, 0,
+         [this, &op](uint8_t status, const uint8_t *data, size_t len) {
+           if (status != ACK || len != 4 * op.len) {
+             fail("peek rejected");
+             return;
+           }
+           for (uint32_t i = 0; i < op.len; ++i) {
+             if (i % 4 == 0) {
+               fprintf(stderr, "### 0x%08x:", op.addr + 4 * i);
+             }
+             fprintf(stderr, " 0x%08x", get_u32(data + 4 * i));
+             if (i % 4 == 3 || i + 1 == op.len) fprintf(stderr, "\n\r");
+           }
+           run_next();
+         });
+    break;
+  case Op::POKE:
+    for (uint32_t word : op.words) append_u32(payload, word);
+    call(CMD_POKE, payload, 0, 0,
+         [this](uint8_t status, const uint8_t *, size_t) {
+           if (status != ACK) {
+             fail("poke rejected (address inside the loader?)");
+             return;
+           }
+           run_next();
+         });
+    break;
+  case Op::FILL:
+    append_u32(payload, op.len);
+    payload.push_back(op.words[0]);
+    call(CMD_FILL, payload, 0, op.len,
+         [this](uint8_t status, const uint8_t *, size_t) {
+           if (status != ACK) {
+             fail("fill rejected (address inside the loader?)");
+             return;
+           }
+           run_next();
+         });
+    break;
+  case Op::CRC:
+    append_u32(payload, op.len);
+    call(CMD_CRC, payload, 4, op.len,
+         [this, &op](uint8_t status, const uint8_t *data, size_t len) {
+           if (status != ACK || len != 4) {
+             fail("crc rejected");
+             return;
+           }
+           fprintf(stderr, "### crc 0x%08x+0x%x: 0x%08x\n\r", op.addr,
+                   op.len, get_u32(data));
+           run_next();
+         });
+    break;
+  case Op::GDB:
+    call(CMD_GDB, std::vector<uint8_t>(), 0, 0,
+         [this](uint8_t status, const uint8_t *, size_t) {
+           if (status != ACK) {
+             fail("loader has no GDB stub");
+             return;
+           }
+           run_next();
+         });
+    break;
+  case Op::GO:
+    call(CMD_GO, payload, 0, 0,
+         [this, &op](uint8_t status, const uint8_t *, size_t) {
+           if (status != ACK) {
+             fail("go rejected");
+             return;
+           }
+           fprintf(stderr, "### jumping to 0x%08x\n\r", op.addr);
+           // the loader goes back to the default rate for the code
+           set_line_baud(DEFAULT_BAUD);
+           jumped_ = true;
+           phase_ = DONE;
+         });
+    break;
+  case Op::DUMP:
+    op_ = &op;
+    done_ = 0;
+    start_ = EventLoop::Clock::now();
+    file_fd_ = open(op.file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (file_fd_ == -1) {
+      fail(UnixError("open " + op.file).what());
+      return;
+    }
+    dump_chunk();
+    break;
+  case Op::LOAD: {
+    op_ = &op;
+    done_ = 0;
+    start_ = EventLoop::Clock::now();
+    data_.clear();
+    try {
+      int fd = UnixError::check("open " + op.file,
+                                open(op.file.c_str(), O_RDONLY));
+      SCOPE_EXIT {
+        close(fd);
+      };
+      while (true) {
+        char buf[65536];
+        ssize_t len = UnixError::check("reading " + op.file,
+                                       read(fd, buf, sizeof(buf)));
+        if (len == 0) break;
+        data_.insert(data_.end(), buf, buf + len);
+      }
+    } catch (UnixError& e) {
+      fail(e.what());
+      return;
+    }
+    load_chunk();
+    break;
+  }
+  }
+}
+
+void Monitor::dump_chunk() {
+  if (done_ == op_->len) {
+    close(file_fd_);
+    file_fd_ = -1;
+    report("dumped", done_);
+    op_ = nullptr;
+    run_next();
+    return;
+  }
+  uint32_t len = std::min<uint32_t>(DUMP_MAX, op_->len - done_);
+  std::vector<uint8_t> payload = make_payload(op_->addr + done_);
+  append_u32(payload, len);
+  call(CMD_DUMP, payload, 1 + LZ::bound(len), len,
+       [this, len](uint8_t status, const uint8_t *data, size_t size) {
+         if (status != ACK || size < 1) {
+           fail("dump rejected");
+           return;
+         }
+         std::vector<uint8_t> chunk(len);
+         long got = -1;
+         if (data[0] == DUMP_RAW) {
+           if (size - 1 == len) {
+             std::copy(data + 1, data + size, chunk.begin());
+             got = len;
+           }
+         } else if (data[0] == DUMP_LZ) {
+           got = LZ::decompress(data + 1, size - 1, chunk.data(), len);
+         }
+         if (got != long(len)) {
+           fail("corrupt dump data");
+           return;
+         }
+         for (size_t pos = 0; pos < len; ) {
+           ssize_t res = write(file_fd_, &chunk[pos], len - pos);
+           if (res == -1) {
+             fail(UnixError("writing " + op_->file).what());
+             return;
+           }
+           pos += res;
+         }
+         done_ += len;
+         dump_chunk();
+       });
+}
+
+void Monitor::load_chunk() {
+  if (done_ == data_.size()) {
+    // check that everything arrived intact
+    std::vector<uint8_t> payload = make_payload(op_->addr);
+    append_u32(payload, data_.size());
+    call(CMD_CRC, payload, 4, data_.size(),
+         [this](uint8_t status, const uint8_t *data, size_t len) {
+           uint32_t crc = CRC32::update(0, data_.data(), data_.size());
+           if (status != ACK || len != 4 || get_u32(data) != crc) {
+             fail("crc mismatch after load");
+             return;
+           }
+           report("loaded", data_.size());
+           op_ = nullptr;
+           data_.clear();
+           run_next();
+         });
+    return;
+  }
+  uint32_t len = std::min<uint32_t>(MAX_PAYLOAD - 4, data_.size() - done_);
+  std::vector<uint8_t> payload = make_payload(op_->addr + done_);
+  payload.insert(payload.end(), &data_[done_], &data_[done_] + len);
+  call(CMD_WRITE, payload, 0, 0,
+       [this, len](uint8_t status, const uint8_t *, size_t) {
+         if (status != ACK) {
+           fail("load rejected (address inside the loader?)");
+           return;
+         }
+         done_ += len;
+         load_chunk();
+       });
+}
+
+size_t Monitor::receive(const char *buf, size_t len) {
+  if (phase_ == DONE) return 0;
+
+  size_t used = 0;
+  while (used < len) {
+    if (!waiting_) {
+      // nothing expected: noise from a BREAK or baud rate switch
+      return len;
+    }
+    rx_.push_back(buf[used++]);
+    if (rx_[0] != ACK && rx_[0] != NAK) {
+      link_failed("garbled reply");
+      return len;
+    }
+    if (rx_.size() < REPLY_HEADER_SIZE) continue;
+    size_t payload_len = get_u16(&rx_[2]);
+    if (rx_.size() < REPLY_HEADER_SIZE + payload_len) continue;
+
+    std::vector<uint8_t> reply;
+    reply.swap(rx_);
+    waiting_ = false;
+    cancel_timer(reply_timer_);
+    if (reply[1] != 0) {
+      link_failed("receive error");
+      return len;
+    }
+    Handler handler;
+    handler.swap(handler_);
+    handler(reply[0], &reply[REPLY_HEADER_SIZE], payload_len);
+    if (phase_ == DONE) break;
+  }
+  return used;
+}
+
+bool Monitor::want_write() const {
+  return out_pos_ < out_.size() && phase_ != DONE;
+}
+
+void Monitor::writable() {
+  if (!want_write()) return;
+
+  ssize_t res = transport_.write(&out_[out_pos_], out_.size() - out_pos_);
+  if (res == -1) return; // EAGAIN, wait for the next POLLOUT
+  out_pos_ += res;
+  if (out_pos_ == out_.size()) {
+    out_.clear();
+    out_pos_ = 0;
+  }
+}
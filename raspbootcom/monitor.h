@@ -0,0 +1,134 @@
+/* monitor.h - run monitor commands on the loader */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "link.h"
+#include "session.h"
+#include "transport.h"
+
+/* The monitor runs a script of commands on the loader each time it asks
+ * for a kernel, before the kernel is sent. Commands are separated by
+ * ';', numbers may be decimal, 0x hex or 0 octal:
+ *
+ *   peek ADDR [COUNT]      print COUNT (1) words at ADDR
+ *   poke ADDR WORD...      write words to ADDR
+ *   dump ADDR LEN FILE     save LEN bytes at ADDR to FILE
+ *   load ADDR FILE         copy FILE to ADDR and check its CRC
+ *   fill ADDR LEN BYTE     fill LEN bytes at ADDR with BYTE
+ *   crc ADDR LEN           print the CRC-32 of LEN bytes at ADDR
+ *   gdb                    stop the next kernel or go in the GDB stub
+ *   go ADDR                call ADDR like a kernel, must come last
+ *
+ * e.g. "dump 0 0x100000 ram.bin" saves the first MiB of RAM left over
+ * from the last kernel. The monitor runs at the best known baud rate of
+ * the link, dumps are LZ compressed by the loader. If a command fails
+ * the rest of the script is skipped.
+ */
+class Monitor : public Session {
+public:
+  struct Op {
+    enum Kind { PEEK, POKE, DUMP, LOAD, FILL, CRC, GDB, GO } kind;
+    uint32_t addr;
+    uint32_t len;
+    // POKE: the words, FILL: the byte
+    std::vector<uint32_t> words;
+    std::string file;
+  };
+  typedef std::vector<Op> Script;
+
+  // Parse a script, throws std::invalid_argument.
+  static Script parse(const std::string& text);
+
+  Monitor(EventLoop& loop, Transport& transport, const Script& script,
+          LinkController& link);
+  ~Monitor();
+
+  size_t receive(const char *buf, size_t len) override;
+  void writable() override;
+  bool want_write() const override;
+  bool done() const override { return phase_ == DONE; }
+  // Should the kernel be sent next? Not after a go.
+  bool boot_kernel() const { return !jumped_; }
+
+private:
+  enum Phase { SWITCHING, RUNNING, RETURNING, DONE };
+  enum {
+    // replies take at least this long (USB latency, loader work)
+    REPLY_MARGIN_MS = 500,
+    // BREAK length and time for the loader to settle afterwards
+    BREAK_MS = 20,
+    SETTLE_MS = 20,
+    // slowest the loader checksums or fills memory
+    WORK_BYTES_PER_MS = 4000,
+  };
+
+  typedef std::function<void(uint8_t status, const uint8_t *data,
+                             size_t len)> Handler;
+
+  // Send a packet and call handler with the reply.
+  void call(uint8_t cmd, const std::vector<uint8_t>& payload,
+            size_t reply_len, size_t work_bytes, Handler handler);
+  void fail(const std::string& msg);
+  // no usable reply, give up on a baud switch or fail
+  void link_failed(const char *why);
+  // BREAK the loader back to the default baud rate, then call next
+  void break_line(std::function<void()> next);
+  void set_line_baud(unsigned baud);
+  void settle(std::function<void()> next);
+  void cancel_timer(int& id);
+
+  void switch_baud();
+  void run_next();
+  void finish();
+  void dump_chunk();
+  void load_chunk();
+  void report(const char *what, size_t bytes);
+
+  EventLoop& loop_;
+  Transport& transport_;
+  LinkController& link_;
+  Script script_;
+  size_t next_op_ = 0;
+  Phase phase_ = RUNNING;
+  bool jumped_ = false;
+  unsigned baud_;
+
+  std::string out_;
+  size_t out_pos_ = 0;
+  bool waiting_ = false;
+  Handler handler_;
+  std::vector<uint8_t> rx_;
+  int reply_timer_ = -1;
+  int step_timer_ = -1;
+
+  // DUMP and LOAD in progress
+  const Op *op_ = nullptr;
+  int file_fd_ = -1;
+  uint32_t done_ = 0;
+  std::vector<uint8_t> data_;
+  EventLoop::Clock::time_point start_;
+};
@@ -0,0 +1,106 @@
+/* prep.cc - prepare FEC codewords and digests of the kernel in threads */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+
+#include "prep.h"
+#include "../raspbootin/include/rs.h"
+#include "../raspbootin/include/xxh32.h"
+
+ImagePrep::ImagePrep(const std::vector<uint8_t>& image, unsigned fec_parity,
+                     uint32_t verify_block)
+  : image_(image), fec_parity_(fec_parity), verify_block_(verify_block) {
+  if (fec_parity_ != 0) {
+    size_t k = RS::CODEWORD_MAX - fec_parity_;
+    codewords_ = (image_.size() + k - 1) / k;
+    fec_chunks_ = (codewords_ + FEC_CHUNK - 1) / FEC_CHUNK;
+    encoded_.resize(RS::encoded_size(image_.size(), fec_parity_));
+  }
+  size_t blocks = (image_.size() + verify_block_ - 1) / verify_block_;
+  digest_chunks_ = (blocks + DIGEST_CHUNK - 1) / DIGEST_CHUNK;
+  digests_.resize(blocks);
+
+  size_t chunks = fec_chunks_ + digest_chunks_;
+  ready_.reset(new std::atomic<bool>[chunks]);
+  for (size_t i = 0; i < chunks; ++i) ready_[i] = false;
+
+  // leave a CPU for the event loop
+  unsigned n = std::thread::hardware_concurrency();
+  n = n > 1 ? n - 1 : 1;
+  n = std::min<size_t>({n, size_t(MAX_WORKERS), chunks});
+  for (unsigned i = 0; i < n; ++i) {
+    workers_.emplace_back([this]() { work(); });
+  }
+}
+
+ImagePrep::~ImagePrep() {
+  stop_ = true;
+  for (std::thread& t : workers_) t.join();
+}
+
+void ImagePrep::work() {
+  // only use CPU time nobody else wants, never errors out if refused
+  sched_param param = {};
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+  size_t k = RS::CODEWORD_MAX - fec_parity_;
+  while (!stop_) {
+    size_t chunk = next_chunk_++;
+    if (chunk < fec_chunks_) {
+      if (!fec_wanted_) continue;
+      size_t first = chunk * FEC_CHUNK;
+      size_t offset = first * k;
+      size_t len = std::min(FEC_CHUNK * k, image_.size() - offset);
+      RS::encode(&image_[offset], len, fec_parity_,
+                 &encoded_[first * RS::CODEWORD_MAX]);
+    } else if (chunk < fec_chunks_ + digest_chunks_) {
+      size_t first = (chunk - fec_chunks_) * DIGEST_CHUNK;
+      size_t end = std::min<size_t>(first + DIGEST_CHUNK, digests_.size());
+      for (size_t i = first; i < end; ++i) {
+        size_t offset = i * verify_block_;
+        size_t len = std::min<size_t>(verify_block_, image_.size() - offset);
+        digests_[i] = XXH32::hash(&image_[offset], len);
+      }
+    } else {
+      break;
+    }
+    ready_[chunk].store(true, std::memory_order_release);
+  }
+}
+
+const uint8_t *ImagePrep::codeword(size_t index) const {
+  if (index >= codewords_ ||
+      !ready_[index / FEC_CHUNK].load(std::memory_order_acquire)) {
+    return NULL;
+  }
+  return &encoded_[index * RS::CODEWORD_MAX];
+}
+
+bool ImagePrep::digest(size_t index, uint32_t& out) const {
+  if (index >= digests_.size() ||
+      !ready_[fec_chunks_ + index / DIGEST_CHUNK].load(
+        std::memory_order_acquire)) {
+    return false;
+  }
+  out = digests_[index];
+  return true;
+}
@@ -0,0 +1,80 @@
+/* prep.h - prepare FEC codewords and digests of the kernel in threads */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/* Worker threads that compute the Reed-Solomon codewords and the
+ * verify digests of a kernel image ahead of the KernelSender. The
+ * work is cut into chunks, taken in image order from a shared counter,
+ * each with a flag that says it is finished. The sender only looks at
+ * the flags: what isn't ready yet it computes itself, so the line never
+ * waits for the workers. The workers run as SCHED_IDLE threads and
+ * don't take CPU time from the event loop.
+ *
+ * The image must not change while the ImagePrep exists.
+ */
+class ImagePrep {
+public:
+  // fec_parity: Reed-Solomon parity bytes per codeword, 0 for no FEC
+  // verify_block: block size of the CMD_VERIFY digests
+  ImagePrep(const std::vector<uint8_t>& image, unsigned fec_parity,
+            uint32_t verify_block);
+  ~ImagePrep();
+
+  // Codeword index (the image in codewords of 255 - fec_parity data
+  // bytes), NULL if it isn't ready yet.
+  const uint8_t *codeword(size_t index) const;
+  // XXH32 of verify block index, false if it isn't ready yet.
+  bool digest(size_t index, uint32_t& out) const;
+  // The loader has no FEC, skip the codewords still to do.
+  void drop_fec() { fec_wanted_ = false; }
+
+private:
+  enum {
+    // codewords per chunk
+    FEC_CHUNK = 64,
+    // verify blocks per chunk
+    DIGEST_CHUNK = 16,
+    MAX_WORKERS = 8,
+  };
+
+  void work();
+
+  const std::vector<uint8_t>& image_;
+  unsigned fec_parity_;
+  uint32_t verify_block_;
+  size_t codewords_ = 0;
+  size_t fec_chunks_ = 0;
+  size_t digest_chunks_ = 0;
+  std::vector<uint8_t> encoded_;
+  std::vector<uint32_t> digests_;
+  std::unique_ptr<std::atomic<bool>[]> ready_;
+  std::atomic<size_t> next_chunk_{0};
+  std::atomic<bool> fec_wanted_{true};
+  std::atomic<bool> stop_{false};
+  std::vector<std::thread> workers_;
+};
@@ -0,0 +1,240 @@
+/* profiler.cc - symbolize PC samples of the kernel */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cxxabi.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "profiler.h"
+#include "unix_error.h"
+#include "scope.h"
+#include "../raspbootin/include/protocol.h"
+#include "../raspbootin/include/services.h"
+
+using namespace Protocol;
+
+namespace {
+  // read a zigzag varint, false if the frame ends in the middle
+  bool get_varint(const uint8_t *& p, const uint8_t *end, int32_t& x) {
+    uint32_t z = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (p == end) return false;
+      uint8_t b = *p++;
+      z |= uint32_t(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        x = int32_t(z >> 1) ^ -int32_t(z & 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void write_file(const std::string& name, const std::string& text) {
+    FILE *f = fopen(name.c_str(), "w");
+    if (f == NULL) throw UnixError("open " + name);
+    SCOPE_EXIT {
+      fclose(f);
+    };
+    if (fwrite(text.data(), 1, text.size(), f) != text.size()) {
+      throw UnixError("writing " + name);
+    }
+  }
+}
+
+Profiler::Profiler(const std::string& elf, unsigned hz)
+  : elf_(elf), hz_(hz) {
+  load_symbols();
+}
+
+void Profiler::load_symbols() {
+  int fd = UnixError::check("open " + elf_, open(elf_.c_str(), O_RDONLY));
+  SCOPE_EXIT {
+    close(fd);
+  };
+  std::string data;
+  while (true) {
+    char buf[65536];
+    ssize_t len = UnixError::check("reading " + elf_,
+                                   read(fd, buf, sizeof(buf)));
+    if (len == 0) break;
+    data.append(buf, len);
+  }
+
+  auto bad = [this]() {
+    return std::runtime_error(elf_ + ": not a 32 bit little endian ELF "
+                              "file with symbols");
+  };
+  Elf32_Ehdr eh;
+  if (data.size() < sizeof(eh)) throw bad();
+  memcpy(&eh, data.data(), sizeof(eh));
+  if (memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+      eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+      eh.e_ident[EI_DATA] != ELFDATA2LSB ||
+      eh.e_shentsize != sizeof(Elf32_Shdr) ||
+      eh.e_shoff + size_t(eh.e_shnum) * sizeof(Elf32_Shdr) > data.size()) {
+    throw bad();
+  }
+  auto section = [&](size_t i) {
+    Elf32_Shdr sh;
+    memcpy(&sh, data.data() + eh.e_shoff + i * sizeof(sh), sizeof(sh));
+    if (size_t(sh.sh_offset) + sh.sh_size > data.size()) throw bad();
+    return sh;
+  };
+
+  for (size_t i = 0; i < eh.e_shnum; ++i) {
+    Elf32_Shdr symtab = section(i);
+    if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= eh.e_shnum) {
+      continue;
+    }
+    Elf32_Shdr strtab = section(symtab.sh_link);
+    for (size_t off = 0; off + sizeof(Elf32_Sym) <= symtab.sh_size;
+         off += sizeof(Elf32_Sym)) {
+      Elf32_Sym sym;
+      memcpy(&sym, data.data() + symtab.sh_offset + off, sizeof(sym));
+      int type = ELF32_ST_TYPE(sym.st_info);
+      if (type != STT_FUNC && type != STT_NOTYPE) continue;
+      if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= eh.e_shnum ||
+          sym.st_name >= strtab.sh_size) {
+        continue;
+      }
+      // only code, the PC is never anywhere else
+      Elf32_Shdr code = section(sym.st_shndx);
+      if (!(code.sh_flags & SHF_EXECINSTR)) continue;
+      const char *name = data.data() + strtab.sh_offset + sym.st_name;
+      size_t max = strtab.sh_size - sym.st_name;
+      std::string str(name, strnlen(name, max));
+      // skip mapping symbols ($a, $t, $d) and local labels
+      if (str.empty() || str[0] == '$' || str.compare(0, 2, ".L") == 0) {
+        continue;
+      }
+      int status;
+      char *demangled = abi::__cxa_demangle(str.c_str(), NULL, NULL,
+                                            &status);
+      if (demangled) {
+        str = demangled;
+        free(demangled);
+      }
+      // bit 0 of a function marks Thumb code
+      uint32_t addr = type == STT_FUNC ? sym.st_value & ~1u : sym.st_value;
+      bool label = sym.st_size == 0;
+      uint32_t size = label ? code.sh_addr + code.sh_size - addr
+                            : sym.st_size;
+      symbols_.push_back(Symbol{addr, size, str, label});
+    }
+  }
+  if (symbols_.empty()) throw bad();
+
+  std::sort(symbols_.begin(), symbols_.end(),
+            [](const Symbol& a, const Symbol& b) {
+              // sized symbols win over labels at the same address
+              if (a.addr != b.addr) return a.addr < b.addr;
+              return a.size > b.size;
+            });
+  // a label lasts until the next symbol or the end of its section
+  for (size_t i = 0; i + 1 < symbols_.size(); ++i) {
+    Symbol& s = symbols_[i];
+    uint32_t next = symbols_[i + 1].addr;
+    if (s.label && next > s.addr && next - s.addr < s.size) {
+      s.size = next - s.addr;
+    }
+  }
+}
+
+const std::string& Profiler::lookup(uint32_t addr) const {
+  static const std::string loader = "[raspbootin]";
+  static const std::string unknown = "[unknown]";
+  if (addr >= RASPBOOTIN_LOADER_ADDR) return loader;
+  auto it = std::upper_bound(symbols_.begin(), symbols_.end(), addr,
+                             [](uint32_t a, const Symbol& s) {
+                               return a < s.addr;
+                             });
+  if (it == symbols_.begin()) return unknown;
+  --it;
+  if (addr - it->addr >= std::max<uint32_t>(it->size, 1)) return unknown;
+  return it->name;
+}
+
+void Profiler::add_frame(const uint8_t *frame, size_t len) {
+  const uint8_t *p = frame;
+  const uint8_t *end = frame + len;
+  uint32_t pc = KERNEL_ADDR;
+  while (p < end) {
+    int32_t dpc, dlr;
+    if (!get_varint(p, end, dpc) || !get_varint(p, end, dlr)) {
+      corrupt_ = true;
+      return;
+    }
+    pc += dpc;
+    ++samples_[std::make_pair(pc, pc + dlr)];
+    ++total_;
+  }
+}
+
+void Profiler::finish() {
+  if (total_ == 0) return;
+
+  std::map<std::string, unsigned> flat;
+  std::map<std::string, unsigned> folded;
+  for (const auto& s : samples_) {
+    const std::string& func = lookup(s.first.first);
+    flat[func] += s.second;
+    const std::string& caller = lookup(s.first.second);
+    if (caller == func || s.first.second == 0) {
+      folded[func] += s.second;
+    } else {
+      folded[caller + ";" + func] += s.second;
+    }
+  }
+
+  std::vector<std::pair<unsigned, std::string> > sorted;
+  for (const auto& f : flat) sorted.push_back(std::make_pair(f.second,
+                                                             f.first));
+  std::sort(sorted.rbegin(), sorted.rend());
+  std::string text = "# samples    %  function\n";
+  for (const auto& f : sorted) {
+    char line[64];
+    snprintf(line, sizeof(line), "%9u %5.1f  ", f.first,
+             100.0 * f.first / total_);
+    text += line + f.second + "\n";
+  }
+  std::string stacks;
+  for (const auto& f : folded) {
+    stacks += f.first + " " + std::to_string(f.second) + "\n";
+  }
+
+  try {
+    write_file(elf_ + ".profile", text);
+    write_file(elf_ + ".folded", stacks);
+    fprintf(stderr, "### profile: %zu samples (%.1f s at %u Hz)%s, "
+            "written to %s.profile and .folded\n\r", total_,
+            double(total_) / hz_, hz_,
+            corrupt_ ? ", some frames were damaged" : "", elf_.c_str());
+  } catch (UnixError& e) {
+    fprintf(stderr, "### %s\n\r", e.what());
+  }
+  samples_.clear();
+  total_ = 0;
+  corrupt_ = false;
+}
@@ -0,0 +1,69 @@
+/* profiler.h - symbolize PC samples of the kernel */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Collects the PC/LR samples the loader sends while a kernel runs
+ * (FRAME_PROFILE, see protocol.h) and, when the kernel is gone, writes
+ * them out against the symbols of the kernel's ELF file:
+ *
+ *   ELF.profile  flat profile, samples per function
+ *   ELF.folded   caller;function count, for flamegraph.pl
+ *
+ * The stacks are only two deep: the LR names the caller, which is
+ * stale in a leaf function that doesn't save it (the function then
+ * appears under the wrong caller, never the other way around).
+ */
+class Profiler {
+public:
+  // Throws UnixError or std::runtime_error if elf can't be read.
+  Profiler(const std::string& elf, unsigned hz);
+
+  // Add the samples of one frame.
+  void add_frame(const uint8_t *frame, size_t len);
+  // Write the profile of the last kernel, if there are samples.
+  void finish();
+
+private:
+  struct Symbol {
+    uint32_t addr;
+    uint32_t size;
+    std::string name;
+    // no size of its own, ends at the next symbol
+    bool label;
+  };
+
+  void load_symbols();
+  const std::string& lookup(uint32_t addr) const;
+
+  std::string elf_;
+  unsigned hz_;
+  // sorted by address
+  std::vector<Symbol> symbols_;
+  std::map<std::pair<uint32_t, uint32_t>, unsigned> samples_;
+  size_t total_ = 0;
+  bool corrupt_ = false;
+};
@@ -29,14 +29,61 @@
 #include <stdint.h>
 #include <termios.h>
 #include <signal.h>
+#include <poll.h>
+#include <getopt.h>
 
 #include "scope.h"
+#include "unix_error.h"
+#include "event_loop.h"
+#include "sender.h"
+#include "monitor.h"
+#include "transport.h"
+#include "link.h"
+#include "device_watch.h"
+#include "semihost.h"
+#include "profiler.h"
+#include "gdb_server.h"
+#include "batch.h"
+#include "build_hook.h"
+#include "capture.h"
+#include "channels.h"
+#include "console_server.h"
+#include "control_client.h"
+#include "kernel_stream.h"
+#include "session_log.h"
+#include "../raspbootin/include/protocol.h"
+#include "../raspbootin/include/rs.h"
+#include "../raspbootin/include/watchdog.h"
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
 #include <string>
-#include <system_error>
+#include <utility>
+#include <vector>
 
 enum {
       BUF_SIZE = 65536,
+      // ^] starts a command key, ^] b sends the kernel back to the loader
+      ESCAPE_KEY = 0x1d,
+      BREAK_MS = 20,
+      DEFAULT_PROFILE_HZ = 1000,
+      DEFAULT_GDB_PORT = 1234,
+      DEFAULT_FEC_PARITY = 16,
+      // long options without a short one
+      OPT_PROFILE_HZ = 256,
+      OPT_CHANNEL = 257,
+      OPT_BUILD = 258,
+      OPT_WATCH = 259,
+      OPT_REPEAT = 260,
+      OPT_DAEMON = 261,
+      OPT_CONTROL = 262,
+      OPT_LOG = 263,
+      OPT_READ_LOG = 264,
+      OPT_RECORD = 265,
+      OPT_REPLAY = 266,
 };
 
 volatile bool keep_running = true;
@@ -46,110 +93,357 @@ void stop_running(int) {
   keep_running = false;
 }
 
-struct UnixError : public std::system_error::system_error {
-  UnixError(const std::string& what_arg)
-    : std::system_error::system_error(errno, std::generic_category(), what_arg) { }
-  UnixError(const std::string& what_arg, int err_)
-    : std::system_error::system_error(err_, std::generic_category(), what_arg) { }
-
-  template<typename CB>
-  static void maybe_raise(const std::string& what_arg, CB on_error) {
-    if (std::uncaught_exceptions() > 0) {
-      // throwing an exception while unwinding would terminate
-      perror(what_arg.c_str());
-      on_error();
-    } else {
-      int err = errno;
-      on_error();
-      throw UnixError(what_arg, err);
-    }
-  }
-
-  static void maybe_raise(const std::string& what_arg) {
-    maybe_raise(what_arg, [](){});
-  }
+volatile bool back_to_loader = false;
 
-  template<typename CB>
-  static ssize_t check(const std::string& what_arg, ssize_t res, CB on_error) {
-    // fprintf(stderr, "+++ %s\n\r", what_arg.c_str());
-    if (res == -1) {
-      maybe_raise(what_arg, on_error);
-    }
-    return res;
-  }
-
-  static ssize_t check(const std::string& what_arg, ssize_t res) {
-    return check(what_arg, res, [](){});
-  }
-};
-
-// send kernel to rpi
-void send_kernel(int fd, const char *file) {
-  // Open file
-  int file_fd = UnixError::check("open kernel",
-                                 open(file, O_RDONLY));
-  SCOPE_EXIT {
-    close(file_fd);
-  };
-
-  // Get kernel size
-  ssize_t size = UnixError::check("probe kernel size",
-                                  lseek(file_fd, 0L, SEEK_END));
-  if (size > 0x200000) {
-    throw UnixError("kernel too big", 0);
-  }
-  UnixError::check("rewind kernel",
-                   lseek(file_fd, 0L, SEEK_SET));
-  fprintf(stderr, "\n\r### sending kernel %s [%zd byte]\n\r", file, size);
-
-  // send kernel size to RPi
-  for (int i = 0; keep_running & (i < 4); ++i) {
-    char c = (size >> 8 * i) & 0xFF;
-    UnixError::check("sending kernel size",
-                     write(fd, &c, 1));
-  }
-  // wait for OK
-  char ok_buf[2] = {0};
-  for (int i = 0; keep_running && (i < 2); ++i) {
-    UnixError::check("reading kernel size response",
-                     read(fd, &ok_buf[i], 1));
-    if (ok_buf[i] == 0) --i; // retry
-  }
-  if (ok_buf[0] != 'O' || ok_buf[1] != 'K') {
-    fprintf(stderr, "error after sending size, got '%c%c' [0x%02x 0x%02x]\n\r",
-            ok_buf[0], ok_buf[1], uint8_t(ok_buf[0]), uint8_t(ok_buf[1]));
-    return;
-  }
+// handler invoked by SIGUSR1
+void request_loader(int) {
+  back_to_loader = true;
+}
 
-  while(keep_running && (size > 0)) {
-    char buf[BUF_SIZE];
-    ssize_t pos = 0;
-    ssize_t len = UnixError::check("reading kernel",
-                                   read(file_fd, buf, BUF_SIZE));
-    size -= len;
-    while(keep_running && (len > 0)) {
-      ssize_t len2 = UnixError::check("sending kernel",
-                                      write(fd, &buf[pos], len));
-      len -= len2;
-      pos += len2;
-    }
+// write all of buf to a blocking fd (stdout)
+bool write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t res = UnixError::check_again("write to stdout",
+                                         write(fd, buf, len));
+    if (res == 0) return false;
+    if (res == -1) continue;
+    buf += res;
+    len -= res;
   }
-
-  fprintf(stderr, "### finished sending\n\r");
+  return true;
 }
 
 int main(int argc, char *argv[]) {
   try {
-    int serial_fd, max_fd = STDIN_FILENO;
-    fd_set rfds, wfds, efds;
     int breaks = 0;
+    // frame from the loader being received (see protocol.h)
+    int frame_type = 0;
+    std::string frame;
     int exit_code = 0;
 
-    printf("Raspbootcom V1.0\n");
+    const char *prog = argv[0];
+    bool flow_control = false;
+    std::string semihost_dir;
+    Monitor::Script script;
+    const char *profile_elf = NULL;
+    unsigned profile_hz = DEFAULT_PROFILE_HZ;
+    unsigned gdb_port = 0;
+    unsigned fec_parity = 0;
+    unsigned watchdog_ms = 0;
+    // channel number and symlink of the ptys to create up front
+    std::vector<std::pair<unsigned, std::string>> channel_links;
+    // command that builds the kernel and the directories of its sources
+    const char *build_cmd = NULL;
+    std::vector<std::string> watch_dirs;
+    // batch mode: script to run against the console, and how often
+    const char *batch_script = NULL;
+    unsigned repeat = 1;
+    // daemon mode: control socket to serve, or of the daemon to talk to
+    const char *daemon_path = NULL;
+    const char *control_path = NULL;
+    // console log to write, or to read from
+    const char *log_path = NULL;
+    const char *read_log_path = NULL;
+    // capture of the session to write, or to play back
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    static const struct option long_options[] = {
+      {"crtscts", no_argument, NULL, 'c'},
+      {"monitor", required_argument, NULL, 'm'},
+      {"semihost", required_argument, NULL, 's'},
+      {"profile", required_argument, NULL, 'p'},
+      {"profile-hz", required_argument, NULL, OPT_PROFILE_HZ},
+      {"gdb",     optional_argument, NULL, 'g'},
+      {"fec",     optional_argument, NULL, 'f'},
+      {"channel", required_argument, NULL, OPT_CHANNEL},
+      {"watchdog", required_argument, NULL, 'w'},
+      {"build",   required_argument, NULL, OPT_BUILD},
+      {"watch",   required_argument, NULL, OPT_WATCH},
+      {"expect",  required_argument, NULL, 'e'},
+      {"repeat",  required_argument, NULL, OPT_REPEAT},
+      {"daemon",  required_argument, NULL, OPT_DAEMON},
+      {"control", required_argument, NULL, OPT_CONTROL},
+      {"log",     required_argument, NULL, OPT_LOG},
+      {"read-log", required_argument, NULL, OPT_READ_LOG},
+      {"record",  required_argument, NULL, OPT_RECORD},
+      {"replay",  required_argument, NULL, OPT_REPLAY},
+      {"help",    no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ce:f::g::hm:p:s:w:", long_options,
+                              NULL)) != -1) {
+      switch (opt) {
+      case 'c':
+        flow_control = true;
+        break;
+      case 'm':
+        try {
+          Monitor::Script more = Monitor::parse(optarg);
+          script.insert(script.end(), more.begin(), more.end());
+        } catch (std::invalid_argument& e) {
+          fprintf(stderr, "%s: %s\n", prog, e.what());
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'g':
+        gdb_port = optarg ? strtoul(optarg, NULL, 0)
+                          : unsigned(DEFAULT_GDB_PORT);
+        if (gdb_port == 0 || gdb_port > 65535) {
+          fprintf(stderr, "%s: bad gdb port '%s'\n", prog, optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'f':
+        fec_parity = optarg ? strtoul(optarg, NULL, 0)
+                            : unsigned(DEFAULT_FEC_PARITY);
+        if (fec_parity == 0 || fec_parity > RS::PARITY_MAX) {
+          fprintf(stderr, "%s: --fec must be 1-%d\n", prog,
+                  int(RS::PARITY_MAX));
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 's':
+        semihost_dir = optarg;
+        break;
+      case 'w': {
+        double msecs = strtod(optarg, NULL) * 1000;
+        if (!(msecs >= 1 && msecs <= Watchdog::MAX_MSECS)) {
+          fprintf(stderr, "%s: --watchdog must be 0.001-%g seconds\n", prog,
+                  Watchdog::MAX_MSECS / 1000.0);
+          exit(EXIT_FAILURE);
+        }
+        watchdog_ms = msecs;
+        break;
+      }
+      case 'p':
+        profile_elf = optarg;
+        break;
+      case OPT_PROFILE_HZ:
+        profile_hz = strtoul(optarg, NULL, 0);
+        if (profile_hz == 0 || profile_hz > Protocol::PROFILE_MAX_HZ) {
+          fprintf(stderr, "%s: --profile-hz must be 1-%d\n", prog,
+                  int(Protocol::PROFILE_MAX_HZ));
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case OPT_CHANNEL: {
+        char *end;
+        unsigned channel = strtoul(optarg, &end, 0);
+        if (end == optarg || (*end != 0 && *end != ':') ||
+            channel >= Protocol::CHANNEL_MAX) {
+          fprintf(stderr, "%s: bad channel '%s'\n", prog, optarg);
+          exit(EXIT_FAILURE);
+        }
+        channel_links.emplace_back(channel, *end == ':' ? end + 1 : "");
+        break;
+      }
+      case OPT_BUILD:
+        build_cmd = optarg;
+        break;
+      case OPT_WATCH:
+        watch_dirs.push_back(optarg);
+        break;
+      case 'e':
+        batch_script = optarg;
+        break;
+      case OPT_REPEAT:
+        repeat = strtoul(optarg, NULL, 0);
+        if (repeat == 0) {
+          fprintf(stderr, "%s: bad repeat count '%s'\n", prog, optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case OPT_DAEMON:
+        daemon_path = optarg;
+        break;
+      case OPT_CONTROL:
+        control_path = optarg;
+        break;
+      case OPT_LOG:
+        log_path = optarg;
+        break;
+      case OPT_READ_LOG:
+        read_log_path = optarg;
+        break;
+      case OPT_RECORD:
+        record_path = optarg;
+        break;
+      case OPT_REPLAY:
+        replay_path = optarg;
+        break;
+      default:
+        argc = 0; // print usage
+      }
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    if (control_path && argc > 0) {
+      // the rest is a command for the daemon, none attaches the console
+      std::string line;
+      for (int i = 1; i < argc; ++i) {
+        if (i > 1) line += ' ';
+        line += argv[i];
+      }
+      try {
+        ControlClient client(control_path);
+        return line.empty() ? client.console() : client.command(line);
+      } catch (UnixError& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (read_log_path && argc > 0) {
+      try {
+        SessionLog::query(read_log_path,
+                          std::vector<std::string>(argv + 1, argv + argc));
+      } catch (std::exception& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+      return 0;
+    }
+
+    if (replay_path && argc > 0) {
+      // [board|host] [SPEED|max] [LINK], in any order
+      bool board = true;
+      double speed = 1;
+      std::string link;
+      for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        char *end;
+        double value = strtod(argv[i], &end);
+        if (arg == "board" || arg == "host") {
+          board = arg == "board";
+        } else if (arg == "max") {
+          speed = 0;
+        } else if (end != argv[i] && *end == 0 && value > 0) {
+          speed = value;
+        } else {
+          link = arg;
+        }
+      }
+      try {
+        Capture::Replay replay(replay_path, board, speed);
+        std::unique_ptr<Transport> pty =
+          Transport::create(link.empty() ? "pty" : "pty:" + link, false);
+        return replay.run(*pty);
+      } catch (std::exception& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    printf("Raspbootcom V1.1\n");
+
+    if (gdb_port != 0 && argc == 2) {
+      // without a kernel GDB loads one, stop at the default address
+      if (script.empty() || script.back().kind != Monitor::Op::GO) {
+        script.push_back(Monitor::parse("go " + std::to_string(
+                                          Protocol::KERNEL_ADDR))[0]);
+      }
+    }
+    if (gdb_port != 0 && !script.empty() &&
+        script.back().kind == Monitor::Op::GO) {
+      script.insert(script.end() - 1, Monitor::parse("gdb")[0]);
+    }
 
-    if (argc != 3) {
-      printf("USAGE: %s <dev> <file>\n", argv[0]);
-      printf("Example: %s /dev/ttyUSB0 kernel/kernel.img\n", argv[0]);
+    // only the monitor and the daemon run without a kernel
+    if (argc != 3 && !(argc == 2 && (!script.empty() || daemon_path))) {
+      printf("USAGE: %s [options] <dev> <file>\n", prog);
+      printf("       %s --control=SOCKET [COMMAND]\n", prog);
+      printf("       %s --read-log=FILE [boots | boot N | time FROM [TO]]\n",
+             prog);
+      printf("       %s --replay=FILE [board | host] [SPEED | max] [LINK]\n",
+             prog);
+      printf("Example: %s /dev/ttyUSB0 kernel/kernel.img\n", prog);
+      printf("<dev> is a tty, pty[:LINK] (new pty, symlinked to LINK),\n"
+             "tcp://HOST:PORT (raw TCP) or rfc2217://HOST:PORT (telnet)\n");
+      printf("<file> may be - (stdin) or a pipe, it is sent while it is "
+             "written\n");
+      printf("Options:\n");
+      printf("  -c, --crtscts  use RTS/CTS hardware flow control\n"
+             "                 (add raspbootin.crtscts to cmdline.txt)\n");
+      printf("  -f, --fec[=PARITY]  send the kernel with PARITY [%d] "
+             "Reed-Solomon bytes\n"
+             "                 per 255, the loader corrects PARITY/2 "
+             "damaged bytes each\n", int(DEFAULT_FEC_PARITY));
+      printf("  -m, --monitor=SCRIPT  run monitor commands before sending "
+             "the kernel,\n"
+             "                 <file> is optional then. SCRIPT is a ';' "
+             "separated list of\n"
+             "                 peek ADDR [COUNT], poke ADDR WORD..., "
+             "dump ADDR LEN FILE,\n"
+             "                 load ADDR FILE, fill ADDR LEN BYTE, "
+             "crc ADDR LEN, gdb,\n"
+             "                 go ADDR\n");
+      printf("  -s, --semihost=DIR  serve semihosting file operations of "
+             "the kernel\n"
+             "                 from DIR\n");
+      printf("  -p, --profile=ELF  sample the kernel's PC and write "
+             "ELF.profile (flat)\n"
+             "                 and ELF.folded (for flame graphs) when it "
+             "exits\n");
+      printf("      --profile-hz=HZ  sample rate [%d]\n",
+             int(DEFAULT_PROFILE_HZ));
+      printf("  -g, --gdb[=PORT]  stop the kernel at its entry and serve "
+             "GDB on\n"
+             "                 localhost:PORT [%d], <file> is optional, "
+             "GDB's load\n"
+             "                 can send it instead\n", int(DEFAULT_GDB_PORT));
+      printf("      --channel=N[:LINK]  create the pty of channel N (0-%d) "
+             "now and\n"
+             "                 symlink it to LINK, the others are "
+             "created on first use\n", int(Protocol::CHANNEL_MAX) - 1);
+      printf("  -w, --watchdog=SECS  leave the watchdog running, the "
+             "kernel must feed it\n"
+             "                 within SECS (at most %g) or the board "
+             "resets\n", Watchdog::MAX_MSECS / 1000.0);
+      printf("      --build=CMD  run CMD (make ...) when the board asks "
+             "for the kernel\n"
+             "                 and send the kernel once it succeeded\n");
+      printf("      --watch=DIR  run the build in the background when a "
+             "file in DIR\n"
+             "                 changes, requests only wait for a running "
+             "build\n");
+      printf("  -e, --expect=SCRIPT  batch mode: check the console after "
+             "each boot and exit\n"
+             "                 with the result. SCRIPT is a ';' "
+             "separated list of\n"
+             "                 expect TEXT, fail TEXT, send TEXT, "
+             "timeout SECS\n");
+      printf("      --repeat=N  boot N times in batch mode, BREAKing "
+             "the kernel back\n"
+             "                 to the loader, and report boot times\n");
+      printf("      --daemon=SOCKET  keep running without a terminal, "
+             "serve commands\n"
+             "                 (load FILE, break, baud N, stats) and "
+             "console clients on\n"
+             "                 the UNIX socket SOCKET, <file> is "
+             "optional\n");
+      printf("      --control=SOCKET  run COMMAND in the daemon at SOCKET, "
+             "without one\n"
+             "                 attach to its console (^] q quits)\n");
+      printf("      --log=FILE  append the console output to the "
+             "compressed log FILE,\n"
+             "                 with an index of the boots in FILE.idx\n");
+      printf("      --read-log=FILE  list the boots in FILE, or print the "
+             "output of boot\n"
+             "                 N (or last) or between two times "
+             "(YYYY-MM-DD HH:MM\n"
+             "                 [:SS] or @SECONDS)\n");
+      printf("      --record=FILE  record both directions of the line "
+             "with their timing\n");
+      printf("      --replay=FILE  play the board's (or host's) side of a "
+             "recording through\n"
+             "                 a new pty (symlinked to LINK) once the "
+             "other side opens it,\n"
+             "                 at SPEED times the original speed [1] or "
+             "as fast as possible\n");
+      printf("Press ^] b or send SIGUSR1 to return a running kernel to "
+             "the loader.\n");
       exit(EXIT_FAILURE);
     }
 
@@ -176,155 +470,582 @@ int main(int argc, char *argv[]) {
                        tcsetattr(STDIN_FILENO, TCSANOW, &new_tio));
     }
 
+    // the daemon's load command replaces the kernel
+    std::string kernel_file = argc == 3 ? argv[2] : "";
+    const char *kernel = argc == 3 ? kernel_file.c_str() : NULL;
+    // a kernel from a pipe is sent while it comes in, and kept
+    std::unique_ptr<KernelStream> stream;
+    if (kernel && KernelStream::is_stream(kernel)) {
+      try {
+        stream.reset(new KernelStream(kernel));
+      } catch (UnixError& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+    std::unique_ptr<BuildHook> build;
+    if (build_cmd) {
+      if (!kernel || stream) {
+        fprintf(stderr, "%s: --build needs a kernel file\n", prog);
+        exit(EXIT_FAILURE);
+      }
+      try {
+        build.reset(new BuildHook(build_cmd, watch_dirs));
+      } catch (UnixError& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+    // stdin may be the kernel rather than the console
+    bool console_input = !stream || stream->fd() != STDIN_FILENO;
+
+    Batch::Script steps;
+    if (batch_script) {
+      try {
+        steps = Batch::parse(batch_script);
+      } catch (std::invalid_argument& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+      // nobody types in batch mode
+      console_input = false;
+    }
+    std::unique_ptr<ConsoleServer> server;
+    if (daemon_path) {
+      try {
+        server.reset(new ConsoleServer(daemon_path));
+      } catch (UnixError& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+      // the console belongs to the clients
+      console_input = false;
+    }
+    std::unique_ptr<SessionLog::Writer> log;
+    if (log_path) {
+      try {
+        log.reset(new SessionLog::Writer(log_path));
+      } catch (UnixError& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+    // for the daemon's stats
+    unsigned long boot_requests = 0;
+    unsigned long kernels_booted = 0;
+    unsigned long kernels_failed = 0;
+    // types into the console of the current connection
+    std::function<void(const char*, size_t)> send_input;
+    std::unique_ptr<Batch> batch;
+    if (batch_script) {
+      batch.reset(new Batch(steps, repeat, [&](const std::string& text) {
+            if (send_input) send_input(text.data(), text.size());
+          }));
+    }
+    std::unique_ptr<Transport> transport =
+      Transport::create(argv[1], flow_control);
+    if (record_path) {
+      try {
+        transport.reset(new Capture::Recorder(std::move(transport),
+                                              record_path));
+      } catch (UnixError& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    // baud rate and frame size are tuned per device
+    LinkController link(*transport);
+
+    Semihost semihost(semihost_dir);
+
+    Channels channels;
+    for (const auto& c : channel_links) {
+      channels.add(c.first, c.second);
+    }
+
+    std::unique_ptr<Profiler> profiler;
+    if (profile_elf) {
+      try {
+        profiler.reset(new Profiler(profile_elf, profile_hz));
+      } catch (std::exception& e) {
+        fprintf(stderr, "%s: %s\n", prog, e.what());
+        exit(EXIT_FAILURE);
+      }
+    }
+    SCOPE_EXIT {
+      if (profiler) profiler->finish();
+    };
+
     // add signal handlers to stop running when interrupted
     signal(SIGINT, stop_running);
     signal(SIGTERM, stop_running);
+    // a BREAK returns a kernel using the loader's services to the loader
+    signal(SIGUSR1, request_loader);
+
+    // reopen the device as soon as it is plugged in again
+    DeviceWatcher watcher;
 
     while(keep_running) {
       // Open serial device
-      if ((serial_fd = open(argv[1], O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
-        // udev takes a while to change ownership
-        // so sometimes one gets EACCESS
-        if (errno == ENOENT || errno == ENODEV || errno == EACCES) {
-          fprintf(stderr, "\r### Waiting for %s...\r", argv[1]);
-          sleep(1);
-          continue;
-        } else
-          throw UnixError("open serial");
+      if (!transport->open()) {
+        fprintf(stderr, "\r### Waiting for %s...\r", argv[1]);
+        // Uevents wake us up right away, the timeout only covers
+        // missed events. Without them this polls.
+        bool polling = transport->hotplug() && !watcher.active();
+        watcher.wait(std::chrono::milliseconds(polling ? 250 : 1000));
+        continue;
       }
       SCOPE_EXIT {
-        close(serial_fd);
+        transport->close();
       };
+      int serial_fd = transport->fd();
 
-      // The termios structure, to be configured for serial interface.
-      struct termios termios;
+      // Ready to listen
+      fprintf(stderr, "### Listening on %s     \n\r",
+              transport->name().c_str());
 
-      // must be a tty
-      if (!isatty(serial_fd)) {
-        fprintf(stderr, "%s is not a tty\n\r", argv[1]);
-        keep_running = false;
-        break;
+      EventLoop loop;
+      // the monitor runs first, then the sender
+      std::unique_ptr<Monitor> monitor;
+      std::unique_ptr<KernelSender> sender;
+      auto session = [&]() -> Session* {
+        if (monitor) return monitor.get();
+        return sender.get();
+      };
+      auto start_sender = [&]() {
+        if (!kernel) return;
+        // the kernel may have to be built first
+        BuildHook::State state = build ? build->request() : BuildHook::OK;
+        if (state == BuildHook::FAILED) {
+          fprintf(stderr, "\n\r### build failed, not sending the kernel\n\r");
+          return;
+        }
+        try {
+          sender.reset(new KernelSender(loop, *transport, kernel,
+                                        stream.get(), link,
+                                        profiler ? profile_hz : 0,
+                                        gdb_port != 0, fec_parity,
+                                        watchdog_ms,
+                                        state == BuildHook::BUILDING));
+        } catch (UnixError& e) {
+          fprintf(stderr, "### %s\n\r", e.what());
+        }
+      };
+      if (build) {
+        build->attach(loop, [&](bool ok) {
+            if (!sender) return;
+            if (!ok) {
+              // the loader asks again after its timeout
+              fprintf(stderr, "### build failed, not sending the kernel\n\r");
+              sender.reset();
+              return;
+            }
+            try {
+              sender->file_ready();
+            } catch (UnixError& e) {
+              fprintf(stderr, "### %s\n\r", e.what());
+              sender.reset();
+            }
+          });
       }
+      SCOPE_EXIT {
+        if (build) build->detach();
+      };
+      // Data held back while a kernel is being sent or the link is
+      // busy. Replies to the loader and GDB's packets go out ahead of
+      // console input, the loader skips input while it waits for one.
+      std::string pending_control;
+      std::string pending_input;
+      // A link that reports BREAKs needs one before the boot request,
+      // once it has shown it passes them on.
+      bool break_seen = false;
+      bool request_armed = false;
+      bool escape = false;
+      bool reopen = false;
 
-      // Get the attributes.
-      UnixError::check("get attributes",
-                       tcgetattr(serial_fd, &termios));
+      // Write a queue until the serial queue is full. Returns true
+      // once all of it went out.
+      auto send_queued = [&](std::string& queue) {
+        size_t done = 0;
+        while (done < queue.size()) {
+          ssize_t res = transport->write(&queue[done], queue.size() - done);
+          if (res == -1) break;
+          done += res;
+        }
+        queue.erase(0, done);
+        return queue.empty();
+      };
 
-      // So, we poll.
-      termios.c_cc[VTIME] = 0;
-      termios.c_cc[VMIN] = 0;
+      auto send_pending = [&]() {
+        // don't mix anything into the kernel
+        if (session()) return;
+        if (send_queued(pending_control)) send_queued(pending_input);
+      };
 
-      // 8N1 mode, no input/output/line processing masks.
-      termios.c_iflag = 0;
-      termios.c_oflag = 0;
-      termios.c_cflag = CS8 | CREAD | CLOCAL;
-      termios.c_lflag = 0;
+      auto forward_input = [&](const char *buf, size_t len) {
+        pending_input.append(buf, len);
+        send_pending();
+      };
 
-      // Set the baud rate.
-      UnixError::check("set BAUD rate (in)",
-                       cfsetispeed(&termios, B115200));
-      UnixError::check("set BAUD rate (out)",
-                       cfsetospeed(&termios, B115200));
+      send_input = forward_input;
+      if (batch) batch->attach(loop);
+      SCOPE_EXIT {
+        send_input = nullptr;
+        if (batch) batch->detach();
+      };
 
-      // Write the attributes.
-      UnixError::check("set attributes",
-                       tcsetattr(serial_fd, TCSAFLUSH, &termios));
+      // commands of the daemon's clients
+      auto control = [&](const std::string& line) -> std::string {
+        size_t space = line.find(' ');
+        std::string cmd = line.substr(0, space);
+        std::string arg = space == std::string::npos ? ""
+                                                     : line.substr(space + 1);
+        if (cmd == "load" && !arg.empty()) {
+          if (build) return "error: the kernel comes from --build";
+          if (KernelStream::is_stream(arg.c_str())) {
+            return "error: " + arg + " is not a file";
+          }
+          // the sender reads from the stream
+          if (session()) return "error: busy with the loader";
+          kernel_file = arg;
+          kernel = kernel_file.c_str();
+          if (stream) {
+            loop.unwatch(stream->fd());
+            stream.reset();
+          }
+          back_to_loader = true;
+          return "loading " + kernel_file;
+        } else if (cmd == "break" && arg.empty()) {
+          if (!transport->sends_break()) {
+            return "error: " + transport->name() + " can't send a BREAK";
+          }
+          back_to_loader = true;
+          return "ok";
+        } else if (cmd == "baud" && !arg.empty()) {
+          if (session()) return "error: busy with the loader";
+          unsigned baud = strtoul(arg.c_str(), NULL, 0);
+          if (baud == 0) return "error: bad baud rate '" + arg + "'";
+          try {
+            transport->set_baud(baud);
+          } catch (std::exception& e) {
+            return std::string("error: ") + e.what();
+          }
+          return "ok";
+        } else if (cmd == "stats" && arg.empty()) {
+          char buf[512];
+          snprintf(buf, sizeof(buf),
+                   "device: %s\n"
+                   "kernel: %s\n"
+                   "state: %s\n"
+                   "boot requests: %lu\n"
+                   "kernels booted: %lu\n"
+                   "kernels failed: %lu\n",
+                   transport->name().c_str(), kernel ? kernel : "(none)",
+                   monitor ? "monitor" : sender ? "sending" : "console",
+                   boot_requests, kernels_booted, kernels_failed);
+          return buf + server->stats();
+        }
+        return "error: unknown command '" + line + "', try load FILE, "
+               "break, baud N or stats";
+      };
+      if (server) server->attach(loop, control, forward_input);
+      SCOPE_EXIT {
+        if (server) server->detach();
+      };
 
-      // Ready to listen
-      fprintf(stderr, "### Listening on %s     \n\r", argv[1]);
+      auto forward_control = [&](const char *buf, size_t len) {
+        pending_control.append(buf, len);
+        send_pending();
+      };
 
-      // select needs the largeds FD + 1
-      if (serial_fd > STDIN_FILENO) {
-        max_fd = serial_fd + 1;
-      } else {
-        max_fd = STDIN_FILENO + 1;
+      // GDB talks to the stub like the user to the kernel
+      std::unique_ptr<GdbServer> gdb;
+      if (gdb_port != 0) {
+        gdb.reset(new GdbServer(loop, gdb_port, forward_control));
       }
 
-      while(keep_running) {
-        // Watch stdin and serial for input.
-        FD_ZERO(&rfds);
-        FD_SET(STDIN_FILENO, &rfds);
-        FD_SET(serial_fd, &rfds);
-
-        // Watch stdin and dev for error.
-        FD_ZERO(&efds);
-        FD_SET(STDIN_FILENO, &efds);
-        FD_SET(serial_fd, &efds);
-
-        // Wait for something to happend
-        ssize_t num_fds = UnixError::check("select",
-                                           select(max_fd, &rfds, &wfds, &efds,
-                                                  NULL));
-        (void)num_fds;
-        //fprintf(stderr, "==> %zd\n\r", num_fds);
-        // check for errors
-        if (FD_ISSET(STDIN_FILENO, &efds)) {
-          fprintf(stderr, "error on STDIN\n");
-          keep_running = false;
-          exit_code = 1;
-          break;
+      // a complete frame from the loader
+      auto handle_frame = [&](int type, const std::string& payload) {
+        std::string reply;
+        if (type == Protocol::FRAME_GDB) {
+          if (gdb) gdb->send(payload);
+          return;
+        } else if (type == Protocol::FRAME_SEMIHOST) {
+          reply = semihost.request((const uint8_t*)payload.data(),
+                                   payload.size());
+        } else if (type == Protocol::FRAME_CHANNEL) {
+          reply = channels.request((const uint8_t*)payload.data(),
+                                   payload.size());
+        } else if (type == Protocol::FRAME_PROFILE) {
+          if (profiler) {
+            profiler->add_frame((const uint8_t*)payload.data(),
+                                payload.size());
+          }
+          return;
         }
-        if (FD_ISSET(serial_fd, &efds)) {
-          fprintf(stderr, "error on device\n");
-          keep_running = false;
-          exit_code = 1;
-          break;
+        forward_control(reply.data(), reply.size());
+      };
+
+      // console text, the batch script looks at it too
+      auto show = [&](const char *buf, size_t len) {
+        if (batch) batch->scan(buf, len);
+        if (log) log->write(buf, len);
+        if (server) {
+          server->output(buf, len);
+          return true;
         }
-        // input from the user, copy to RPi
-        if (FD_ISSET(STDIN_FILENO, &rfds)) {
-          char c;
-          ssize_t len = UnixError::check("read from stdin",
-                                         read(STDIN_FILENO, &c, 1));
-          if (len == 0) {
-            keep_running = false;
-            break;
-          }
-          //fprintf(stderr, "stdin: '%c' [%02x]\n\r", c, uint8_t(c));
-          len = UnixError::check("write to serial",
-                                 write(serial_fd, &c, 1));
-          if (len == 0) {
-            break;
+        return write_all(STDOUT_FILENO, buf, len);
+      };
+
+      // output from the RPi, copy to STDOUT
+      auto console_output = [&](const char *buf, size_t len) {
+        // Text goes straight through up to the next ESCAPE. 3 ESCAPEs
+        // are the boot request, 2 and a frame type start a frame. On a
+        // link that reports BREAKs, the request counts only right after
+        // one. ESCAPEs that turn out to be text are written late.
+        size_t start = 0;
+        size_t i = 0;
+        while (i < len) {
+          if (frame_type != 0) {
+            // u16 length, payload
+            size_t want = 2;
+            if (frame.size() >= 2) {
+              want += Protocol::get_u16((const uint8_t*)frame.data());
+            }
+            size_t n = std::min(want - frame.size(), len - i);
+            frame.append(&buf[i], n);
+            i += n;
+            start = i;
+            if (frame.size() >= 2 &&
+                frame.size() == 2u + Protocol::get_u16(
+                                       (const uint8_t*)frame.data())) {
+              int type = frame_type;
+              frame_type = 0;
+              handle_frame(type, frame.substr(2));
+              frame.clear();
+            }
+            continue;
           }
-        }
-        // output from the RPi, copy to STDOUT
-        if (FD_ISSET(serial_fd, &rfds)) {
-          char c;
-          ssize_t len = UnixError::check("read from serial",
-                                         read(serial_fd, &c, 1));
-          if (len == 0) {
-            break;
+          if (breaks == 0) {
+            const char *esc = (const char*)memchr(&buf[i], '\x03', len - i);
+            if (esc == NULL) {
+              request_armed = false;
+              break;
+            }
+            if (esc != &buf[i]) request_armed = false;
+            i = esc - buf;
           }
-          //fprintf(stderr, "serial: '%c' [%02x]\n\r", c, uint8_t(c));
-          // scan output for tripple break (^C^C^C)
-          // send kernel on tripple break, otherwise output text
-          if (c == '\x03') {
-            ++breaks;
-            if (breaks == 3) {
-              send_kernel(serial_fd, argv[2]);
+          if (buf[i] != '\x03') {
+            if (breaks == 2 && (buf[i] == Protocol::FRAME_SEMIHOST ||
+                                buf[i] == Protocol::FRAME_PROFILE ||
+                                buf[i] == Protocol::FRAME_GDB ||
+                                buf[i] == Protocol::FRAME_CHANNEL)) {
+              frame_type = buf[i];
               breaks = 0;
+              start = ++i;
+              continue;
+            }
+            // not a tripple break after all
+            request_armed = false;
+            if (!show("\x03\x03\x03", breaks)) {
+              keep_running = false;
+              return;
             }
-          } else {
-            while (breaks > 0) {
-              ssize_t len = UnixError::check("write to stdout",
-                                             write(STDOUT_FILENO,
-                                                   "\x03\x03\x03",
-                                                   breaks));
-              if (len == 0) {
+            start = i;
+            breaks = 0;
+            continue;
+          }
+          // flush text before the break
+          if (breaks == 0) {
+            if (!show(&buf[start], i - start)) {
+              keep_running = false;
+              return;
+            }
+          }
+          start = ++i;
+          ++breaks;
+          if (breaks == 3) {
+            breaks = 0;
+            if (break_seen && !request_armed) {
+              // a kernel printing ^C^C^C
+              if (!show("\x03\x03\x03", 3)) {
                 keep_running = false;
-                break;
+                return;
               }
-              breaks -= len;
+              continue;
             }
-            if (keep_running) {
-              ssize_t len = UnixError::check("write to stdout",
-                                             write(STDOUT_FILENO, &c, 1));
-              if (len == 0) {
-                keep_running = false;
-                break;
+            request_armed = false;
+            // the last kernel is gone, and nothing waits for replies
+            if (profiler) profiler->finish();
+            if (batch) batch->requested();
+            ++boot_requests;
+            if (log) log->mark_boot();
+            pending_control.clear();
+            if (script.empty()) {
+              start_sender();
+            } else {
+              monitor.reset(new Monitor(loop, *transport, script, link));
+            }
+            // anything after the break is the reply to the first packet
+            size_t used = session() ? session()->receive(&buf[start],
+                                                         len - start)
+                                    : 0;
+            start += used;
+            i = start;
+          }
+        }
+        if (breaks == 0 &&
+            !show(&buf[start], len - start)) {
+          keep_running = false;
+        }
+      };
+
+      if (stream && !stream->eof()) {
+        int stream_fd = stream->fd();
+        loop.watch(stream_fd, POLLIN, [&, stream_fd](short) {
+            if (!stream->read()) loop.unwatch(stream_fd);
+            if (sender) sender->stream_data();
+          });
+      }
+
+      if (console_input) {
+        loop.watch(STDIN_FILENO, POLLIN, [&](short revents) {
+            if (revents & (POLLERR | POLLNVAL)) {
+              fprintf(stderr, "error on STDIN\n");
+              keep_running = false;
+              exit_code = 1;
+              return;
+            }
+            // input from the user, copy to RPi
+            char buf[BUF_SIZE];
+            ssize_t len = UnixError::check_again("read from stdin",
+                                                 read(STDIN_FILENO, buf,
+                                                      sizeof(buf)));
+            if (len == -1) return;
+            if (len == 0) {
+              keep_running = false;
+              return;
+            }
+            std::string input;
+            for (ssize_t i = 0; i < len; ++i) {
+              if (escape) {
+                escape = false;
+                if (buf[i] == 'b') {
+                  back_to_loader = true;
+                  continue;
+                }
+                if (buf[i] != ESCAPE_KEY) input += char(ESCAPE_KEY);
+              } else if (buf[i] == ESCAPE_KEY) {
+                escape = true;
+                continue;
               }
+              input += buf[i];
             }
+            forward_input(input.data(), input.size());
+          });
+      }
+
+      loop.watch(serial_fd, POLLIN, [&](short revents) {
+          if (revents & POLLNVAL) {
+            fprintf(stderr, "error on device\n");
+            keep_running = false;
+            exit_code = 1;
+            return;
+          }
+          if (revents & POLLOUT) {
+            transport->flush();
+            if (transport->write_pending()) {
+              // still busy with earlier data
+            } else if (session()) {
+              session()->writable();
+            } else {
+              send_pending();
+            }
+          }
+          if (revents & (POLLIN | POLLERR | POLLHUP)) {
+            char buf[BUF_SIZE];
+            ssize_t len = transport->read(buf, sizeof(buf));
+            if (len == 0) {
+              // device went away, try to reopen it
+              reopen = true;
+              return;
+            }
+            // a BREAK from the loader splits the data
+            ssize_t brk = transport->break_at();
+            if (len == -1 && brk == -1) return;
+            if (len == -1) len = 0;
+            size_t head = brk == -1 ? len : brk;
+            size_t used = session() ? session()->receive(buf, head) : 0;
+            console_output(&buf[used], head - used);
+            if (brk != -1) {
+              if (session()) {
+                // The loader gave up on us (timeout or watchdog reset)
+                // and asks again, start over.
+                fprintf(stderr, "\n\r### loader restarted\n\r");
+                monitor.reset();
+                sender.reset();
+                transport->set_baud(Protocol::DEFAULT_BAUD);
+              }
+              // The boot request follows, drop a frame cut short by a
+              // reset. From now on ^C^C^C needs the BREAK.
+              break_seen = true;
+              request_armed = true;
+              breaks = 0;
+              frame_type = 0;
+              frame.clear();
+              used = session() ? session()->receive(&buf[head], len - head)
+                               : 0;
+              console_output(&buf[head + used], len - head - used);
+            }
+          }
+        });
+
+      while(keep_running && !reopen) {
+        if (monitor && monitor->done()) {
+          bool boot = monitor->boot_kernel();
+          monitor.reset();
+          if (boot) {
+            start_sender();
+          } else if (batch) {
+            batch->started(true);
+          }
+        }
+        if (sender && sender->done()) {
+          ++(sender->booted() ? kernels_booted : kernels_failed);
+          if (batch) batch->started(sender->booted());
+          sender.reset();
+        }
+        if (batch) {
+          // nothing sends the kernel (e.g. the build failed)
+          if (!session()) batch->started(false);
+          if (batch->finished()) {
+            keep_running = false;
+            exit_code = batch->exit_code();
+            break;
+          }
+          if (!session() && batch->want_break()) back_to_loader = true;
+        }
+        if (back_to_loader) {
+          back_to_loader = false;
+          if (!session() && !transport->sends_break()) {
+            fprintf(stderr, "\n\r### %s can't send a BREAK, reset the "
+                    "board\n\r", transport->name().c_str());
+          } else if (!session()) {
+            fprintf(stderr, "\n\r### BREAK, back to the loader\n\r");
+            transport->set_break(true);
+            loop.add_timer(std::chrono::milliseconds(BREAK_MS), [&]() {
+                transport->set_break(false);
+              });
           }
         }
+        // Watch for POLLOUT only while there is something to send.
+        bool want_write = transport->write_pending() ||
+                          (session() ? session()->want_write()
+                                     : !pending_control.empty() ||
+                                       !pending_input.empty());
+        loop.set_events(serial_fd, POLLIN | (want_write ? POLLOUT : 0));
+        loop.run_once();
       }
     } 
     return exit_code;
@@ -0,0 +1,200 @@
+/* semihost.cc - serve semihosting file operations to the RPi */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "semihost.h"
+#include "unix_error.h"
+#include "../raspbootin/include/protocol.h"
+
+#include <vector>
+
+using namespace Protocol;
+
+Semihost::Semihost(const std::string& dir) {
+  if (dir.empty()) return;
+  dir_fd_ = UnixError::check("open semihosting directory " + dir,
+                             ::open(dir.c_str(),
+                                    O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+}
+
+Semihost::~Semihost() {
+  for (const auto& f : files_) {
+    close(f.second.fd);
+  }
+  if (dir_fd_ != -1) close(dir_fd_);
+}
+
+std::string Semihost::reply(int32_t result, int err,
+                            const std::string& data) {
+  uint8_t header[SEMIHOST_REPLY_SIZE];
+  header[0] = ESCAPE;
+  header[1] = ESCAPE;
+  header[2] = SEMIHOST_REPLY;
+  put_u32(&header[3], result);
+  put_u32(&header[7], err);
+  put_u16(&header[11], data.size());
+  return std::string((const char*)header, sizeof(header)) + data;
+}
+
+int Semihost::open_file(const std::string& name, int flags) {
+  if (dir_fd_ == -1) {
+    errno = EACCES;
+    return -1;
+  }
+  // "/foo" means foo in the sandbox
+  std::string path = name;
+  while (!path.empty() && path[0] == '/') path.erase(0, 1);
+  if (path.empty()) path = ".";
+
+  struct open_how how;
+  memset(&how, 0, sizeof(how));
+  how.flags = flags | O_CLOEXEC;
+  // openat2() insists on mode 0 unless a file may be created
+  how.mode = (flags & O_CREAT) ? 0644 : 0;
+  how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+  int fd = syscall(SYS_openat2, dir_fd_, path.c_str(), &how, sizeof(how));
+  if (fd != -1 || errno != ENOSYS) return fd;
+
+  // Kernel older than 5.6: walk the path one part at a time, refusing
+  // ".." and symlinks, which is what RESOLVE_BENEATH would check.
+  int dir = dir_fd_;
+  size_t start = 0;
+  while (true) {
+    size_t end = path.find('/', start);
+    std::string part = path.substr(start, end - start);
+    if (part == "..") {
+      errno = EACCES;
+      fd = -1;
+    } else if (end == std::string::npos) {
+      fd = openat(dir, part.c_str(), flags | O_CLOEXEC | O_NOFOLLOW, 0644);
+    } else if (part.empty() || part == ".") {
+      start = end + 1;
+      continue;
+    } else {
+      fd = openat(dir, part.c_str(),
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (dir != dir_fd_) {
+      int err = errno;
+      close(dir);
+      errno = err;
+    }
+    if (fd == -1 || end == std::string::npos) return fd;
+    dir = fd;
+    start = end + 1;
+  }
+}
+
+std::string Semihost::request(const uint8_t *frame, size_t len) {
+  if (len < 5) return reply(-1, EINVAL);
+  uint8_t op = frame[0];
+  uint32_t handle = get_u32(&frame[1]);
+  const uint8_t *args = &frame[5];
+  len -= 5;
+
+  if (op == SH_OPEN) {
+    // fopen() modes "r", "rb", "r+", "r+b", "w", ..., "a+b"
+    uint32_t mode = handle;
+    int access = (mode & 2) ? O_RDWR : (mode < 4 ? O_RDONLY : O_WRONLY);
+    int flags = access;
+    if (mode >= 4 && mode < 8) flags |= O_CREAT | O_TRUNC;
+    if (mode >= 8) flags |= O_CREAT | O_APPEND;
+    if (mode > 11) return reply(-1, EINVAL);
+    std::string name((const char*)args, len);
+    int fd = open_file(name, flags);
+    if (fd == -1) return reply(-1, errno);
+    uint32_t h = next_handle_++;
+    files_[h] = File{fd, 0};
+    return reply(h, 0);
+  }
+
+  auto it = files_.find(handle);
+  if (it == files_.end()) {
+    if (op == SH_WRITE || op == SH_UNREAD) return "";
+    return reply(-1, EBADF);
+  }
+  File& file = it->second;
+
+  switch (op) {
+  case SH_CLOSE: {
+    int err = file.write_error;
+    if (close(file.fd) == -1 && err == 0) err = errno;
+    files_.erase(it);
+    return reply(err ? -1 : 0, err);
+  }
+  case SH_WRITE:
+    while (len > 0 && file.write_error == 0) {
+      ssize_t res = write(file.fd, args, len);
+      if (res == -1) {
+        if (errno != EINTR) file.write_error = errno;
+        continue;
+      }
+      args += res;
+      len -= res;
+    }
+    return "";
+  case SH_READ: {
+    if (len < 8) return reply(-1, EINVAL);
+    size_t want = get_u32(&args[0]);
+    size_t max = get_u32(&args[4]);
+    // the reply length is a u16
+    if (max > 0xFFFF) max = 0xFFFF;
+    if (want > max) want = max;
+    // read ahead as far as the loader can take
+    std::string data(max, '\0');
+    size_t got = 0;
+    while (got < max) {
+      size_t count = max - got;
+      ssize_t res = read(file.fd, &data[got], count);
+      if (res == -1 && errno == EINTR) continue;
+      if (res == -1) {
+        if (got > 0) break;
+        return reply(-1, errno);
+      }
+      if (res == 0) break;
+      got += res;
+      // nothing more ready right now, enough if want is met
+      if (got >= want && size_t(res) < count) break;
+    }
+    data.resize(got);
+    return reply(got, 0, data);
+  }
+  case SH_SEEK:
+    if (len < 4) return reply(-1, EINVAL);
+    if (lseek(file.fd, get_u32(args), SEEK_SET) == -1) {
+      return reply(-1, errno);
+    }
+    return reply(0, 0);
+  case SH_FLEN: {
+    struct stat st;
+    if (fstat(file.fd, &st) == -1) return reply(-1, errno);
+    return reply(st.st_size, 0);
+  }
+  case SH_UNREAD:
+    if (len >= 4) lseek(file.fd, -(off_t)get_u32(args), SEEK_CUR);
+    return "";
+  default:
+    return reply(-1, ENOSYS);
+  }
+}
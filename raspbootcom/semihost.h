@@ -0,0 +1,56 @@
+/* semihost.h - serve semihosting file operations to the RPi */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+/* File operations for ARM semihosting calls of the kernel, forwarded by
+ * the loader as FRAME_SEMIHOST frames (see protocol.h). Files are only
+ * opened below the sandbox directory, absolute names are taken relative
+ * to it and ".." or symlinks can't leave it. Without a directory every
+ * open fails with EACCES.
+ */
+class Semihost {
+public:
+  explicit Semihost(const std::string& dir);
+  ~Semihost();
+  Semihost(const Semihost&) = delete;
+  Semihost& operator=(const Semihost&) = delete;
+
+  // Handle one frame. Returns the reply to send, if any.
+  std::string request(const uint8_t *frame, size_t len);
+
+private:
+  struct File {
+    int fd;
+    // first error of a write, reported by close
+    int write_error;
+  };
+
+  std::string reply(int32_t result, int err, const std::string& data = "");
+  int open_file(const std::string& name, int flags);
+
+  int dir_fd_ = -1;
+  std::map<uint32_t, File> files_;
+  uint32_t next_handle_ = 16;
+};
@@ -0,0 +1,766 @@
+/* sender.cc - send kernel.img to the RPi from within the event loop */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "sender.h"
+#include "unix_error.h"
+#include "scope.h"
+#include "../raspbootin/include/protocol.h"
+#include "../raspbootin/include/rs.h"
+#include "../raspbootin/include/xxh32.h"
+#include "../raspbootin/include/crc32.h"
+
+using namespace Protocol;
+
+KernelSender::KernelSender(EventLoop& loop, Transport& transport,
+                           const char *file, KernelStream *stream,
+                           LinkController& link,
+                           unsigned profile_hz, bool debug,
+                           unsigned fec_parity, unsigned watchdog_ms,
+                           bool wait)
+  : loop_(loop), transport_(transport), link_(link), baud_(DEFAULT_BAUD),
+    profile_hz_(profile_hz), debug_(debug), fec_parity_(fec_parity),
+    watchdog_ms_(watchdog_ms),
+    bytes_per_sec_(DEFAULT_BAUD / 10), file_(file), stream_(stream) {
+  link_.session_start();
+  start_ = EventLoop::Clock::now();
+  if (wait) {
+    fprintf(stderr, "\n\r### waiting for the build of %s\n\r", file);
+    keep_alive();
+    return;
+  }
+  if (!stream_) {
+    read_file();
+  } else if (stream_->eof()) {
+    image_ = stream_->data();
+  } else {
+    // a pipe is read by the event loop, start with what is there
+    image_ = stream_->data();
+    streaming_ = true;
+    fprintf(stderr, "\n\r### streaming kernel %s [%zu byte so far]\n\r",
+            file, image_.size());
+    send_load();
+    return;
+  }
+  fprintf(stderr, "\n\r### sending kernel %s [%zu byte]\n\r", file,
+          image_.size());
+  finish_image();
+  send_load();
+}
+
+void KernelSender::read_file() {
+  // Read the whole kernel, blocks may have to be sent again.
+  int file_fd = UnixError::check("open kernel",
+                                 open(file_.c_str(), O_RDONLY));
+  SCOPE_EXIT {
+    close(file_fd);
+  };
+  while (true) {
+    char buf[65536];
+    ssize_t len = UnixError::check("reading kernel",
+                                   read(file_fd, buf, sizeof(buf)));
+    if (len == 0) break;
+    image_.insert(image_.end(), buf, buf + len);
+  }
+}
+
+void KernelSender::file_ready() {
+  if (complete_ || done()) return;
+  read_file();
+  fprintf(stderr, "### sending kernel %s [%zu byte]\n\r", file_.c_str(),
+          image_.size());
+  finish_image();
+  if (phase_ == LOADING && pending_.empty()) send_load();
+}
+
+KernelSender::~KernelSender() {
+  cancel_timer(throttle_timer_);
+  cancel_timer(reply_timer_);
+  cancel_timer(step_timer_);
+  cancel_timer(keepalive_timer_);
+}
+
+void KernelSender::finish_image() {
+  complete_ = true;
+  image_crc_ = CRC32::update(0, image_.data(), image_.size());
+  size_t max_blocks = (MAX_PAYLOAD - 8) / 4;
+  while ((image_.size() + verify_block_ - 1) / verify_block_ > max_blocks) {
+    verify_block_ *= 2;
+  }
+  prep_.reset(new ImagePrep(image_, fec_parity_, verify_block_));
+}
+
+void KernelSender::stream_data() {
+  if (!stream_ || complete_ || done()) return;
+  const std::vector<uint8_t>& data = stream_->data();
+  image_.insert(image_.end(), data.begin() + image_.size(), data.end());
+  if (stream_->eof()) {
+    fprintf(stderr, "### end of kernel %s [%zu byte]\n\r",
+            stream_->name().c_str(), image_.size());
+    finish_image();
+    // a loader that can't stream waits for the whole kernel
+    if (phase_ == LOADING && !streaming_ && pending_.empty()) {
+      send_load();
+      return;
+    }
+  }
+  next_step();
+}
+
+void KernelSender::keep_alive() {
+  if (keepalive_timer_ != -1) return;
+  keepalive_timer_ = loop_.add_timer(
+    std::chrono::milliseconds(KEEPALIVE_MS), [this]() {
+      keepalive_timer_ = -1;
+      if ((phase_ == LOADING || phase_ == STREAMING) && pending_.empty()) {
+        send_ping();
+      }
+    });
+}
+
+void KernelSender::cancel_timer(int& id) {
+  if (id != -1) {
+    loop_.cancel_timer(id);
+    id = -1;
+  }
+}
+
+void KernelSender::fail(const char *msg) {
+  fprintf(stderr, "### %s\n\r", msg);
+  phase_ = FAILED;
+  cancel_timer(reply_timer_);
+  cancel_timer(step_timer_);
+  cancel_timer(keepalive_timer_);
+  // the console runs at the default baud rate
+  if (baud_ != DEFAULT_BAUD) {
+    set_line_baud(DEFAULT_BAUD);
+  }
+}
+
+void KernelSender::send_load() {
+  if (!features_known_) send_packet(CMD_FEATURES, NULL, 0);
+  if (streaming_) {
+    send_packet(CMD_LOAD, NULL, 0);
+    return;
+  }
+  uint8_t payload[8];
+  put_u32(&payload[0], image_.size());
+  if (!resume_) {
+    send_packet(CMD_LOAD, payload, 4);
+    return;
+  }
+  put_u32(&payload[4], image_crc_);
+  send_packet(CMD_RESUME, payload, sizeof(payload));
+}
+
+void KernelSender::handle_resume(uint8_t status, const uint8_t *data,
+                                 size_t len) {
+  if (status != ACK) {
+    // an old loader (or the kernel is too big, CMD_LOAD tells)
+    resume_ = false;
+    send_load();
+    return;
+  }
+  load_acked_ = true;
+  phase_ = STREAMING;
+  if (len < 4 || get_u32(data) == 0) return;
+  uint32_t block = get_u32(data);
+  size_t blocks = (image_.size() + block - 1) / block;
+  if (len - 4 < (blocks + 7) / 8) return;
+
+  resume_block_ = block;
+  resumed_.assign(blocks, false);
+  uint32_t have = 0;
+  for (size_t i = 0; i < blocks; ++i) {
+    if (!(data[4 + i / 8] & (1 << (i % 8)))) continue;
+    resumed_[i] = true;
+    have += std::min<size_t>(block, image_.size() - i * block);
+  }
+  if (have != 0) {
+    fprintf(stderr, "### resuming, the loader has %u of %zu bytes\n\r",
+            have, image_.size());
+  }
+  acked_ += have;
+}
+
+bool KernelSender::resumed(uint32_t offset) const {
+  return resume_block_ != 0 && resumed_[offset / resume_block_];
+}
+
+bool KernelSender::next_fresh(size_t frame, uint32_t& offset,
+                              uint32_t& len) {
+  while (next_offset_ < image_.size() && resumed(next_offset_)) {
+    next_offset_ = std::min<size_t>((next_offset_ / resume_block_ + 1) *
+                                    resume_block_, image_.size());
+  }
+  if (next_offset_ >= image_.size()) return false;
+  // only whole frames of a kernel still coming in
+  if (!complete_ && image_.size() - next_offset_ < frame) return false;
+  offset = next_offset_;
+  len = std::min<size_t>(frame, image_.size() - offset);
+  if (fec_parity_ != 0) {
+    // back onto the codeword grid after a block the loader had
+    size_t k = RS::CODEWORD_MAX - fec_parity_;
+    if (offset % k != 0) len = std::min<size_t>(len, k - offset % k);
+  }
+  // stop in front of the next block the loader has
+  if (resume_block_ != 0) {
+    for (uint32_t b = offset / resume_block_ + 1;
+         b < resumed_.size() && b * resume_block_ < offset + len; ++b) {
+      if (resumed_[b]) {
+        len = b * resume_block_ - offset;
+        break;
+      }
+    }
+  }
+  next_offset_ += len;
+  return true;
+}
+
+void KernelSender::set_line_baud(unsigned baud) {
+  transport_.set_baud(baud);
+  baud_ = baud;
+  bytes_per_sec_ = baud / 10;
+}
+
+void KernelSender::send_packet(uint8_t cmd, const uint8_t *payload,
+                               size_t len, uint32_t offset,
+                               uint32_t block_len) {
+  uint8_t header[HEADER_SIZE];
+  header[0] = cmd;
+  put_u16(&header[1], len);
+  out_.append((const char*)header, sizeof(header));
+  out_.append((const char*)payload, len);
+  pending_.push_back(Pending{cmd, offset, block_len});
+  inflight_ += block_len;
+  if (pending_.size() == 1) arm_reply_timer();
+}
+
+void KernelSender::arm_reply_timer() {
+  cancel_timer(reply_timer_);
+  if (pending_.empty()) return;
+
+  // everything queued has to go out before the reply can come back
+  size_t bytes = out_.size() - out_pos_ + inflight_ + 64;
+  auto timeout = std::chrono::milliseconds(
+                   REPLY_MARGIN_MS + bytes * 2000 / bytes_per_sec_);
+  reply_timer_ = loop_.add_timer(timeout, [this]() {
+      reply_timer_ = -1;
+      resync("timeout waiting for reply");
+    });
+}
+
+size_t KernelSender::receive(const char *buf, size_t len) {
+  if (phase_ == DONE || phase_ == FAILED) return 0;
+
+  size_t used = 0;
+  while (used < len) {
+    if (pending_.empty()) {
+      // nothing expected: noise from a BREAK or baud rate switch
+      return len;
+    }
+    rx_.push_back(buf[used++]);
+    if (rx_[0] != ACK && rx_[0] != NAK) {
+      resync("garbled reply");
+      return len;
+    }
+    if (rx_.size() < REPLY_HEADER_SIZE) continue;
+    size_t payload_len = get_u16(&rx_[2]);
+    if (payload_len > MAX_PAYLOAD) {
+      resync("garbled reply");
+      return len;
+    }
+    if (rx_.size() < REPLY_HEADER_SIZE + payload_len) continue;
+
+    std::vector<uint8_t> reply;
+    reply.swap(rx_);
+    handle_reply(reply[0], reply[1], &reply[REPLY_HEADER_SIZE],
+                 payload_len);
+    if (phase_ == DONE || phase_ == FAILED) break;
+  }
+  if (phase_ == RESYNC && pending_.empty()) return len;
+  return used;
+}
+
+void KernelSender::handle_reply(uint8_t status, uint8_t errors,
+                                const uint8_t *data, size_t len) {
+  Pending p = pending_.front();
+  pending_.pop_front();
+  inflight_ -= p.len;
+  arm_reply_timer();
+
+  if (p.cmd == CMD_BLOCK || p.cmd == CMD_BLOCK_FEC) {
+    if (errors & (RX_OE | RX_BE)) {
+      // bytes got lost, the loader is out of step with us
+      retransmit_.push_back(std::make_pair(p.offset, p.len));
+      resync("overrun");
+      return;
+    }
+    if (p.cmd == CMD_BLOCK_FEC) {
+      // The loader only ACKs a block with an intact header, framing and
+      // parity errors were in the codewords and have been corrected.
+      if (status == ACK && len == 2) {
+        corrected_ += get_u16(data);
+        acked_ += p.len;
+        link_.frame_ok(p.len);
+      } else if (status == NAK && len <= 1) {
+        // too many errors to correct, or a damaged header
+        retransmit_.push_back(std::make_pair(p.offset, p.len));
+        link_.frame_error();
+      } else {
+        fail("loader rejected a block");
+        return;
+      }
+      next_step();
+      return;
+    }
+    if (errors) {
+      retransmit_.push_back(std::make_pair(p.offset, p.len));
+      link_.frame_error();
+    } else if (status == ACK) {
+      acked_ += p.len;
+      link_.frame_ok(p.len);
+    } else {
+      fail("loader rejected a block");
+      return;
+    }
+    next_step();
+    return;
+  }
+
+  if (errors) {
+    resync("receive error");
+    return;
+  }
+
+  switch (p.cmd) {
+  case CMD_LOAD:
+    if (status != ACK && streaming_) {
+      fprintf(stderr, "### loader can't stream, waiting for the end of "
+              "the kernel\n\r");
+      streaming_ = false;
+    }
+    if (status != ACK && !complete_) {
+      keep_alive();
+      return;
+    }
+    if (status != ACK) {
+      fail("kernel too big for the loader");
+      return;
+    }
+    load_acked_ = true;
+    phase_ = STREAMING;
+    break;
+  case CMD_FEATURES:
+    // an old loader NAKs it and has none of them
+    features_known_ = true;
+    features_ = status == ACK && len == 4 ? get_u32(data) : 0;
+    if (fec_parity_ != 0 && !(features_ & FEATURE_FEC)) {
+      fprintf(stderr, "### loader has no FEC, sending plain blocks\n\r");
+      fec_parity_ = 0;
+      if (prep_) prep_->drop_fec();
+    }
+    return;
+  case CMD_RESUME:
+    handle_resume(status, data, len);
+    if (phase_ == LOADING) return;
+    break;
+  case CMD_SIZE:
+    if (status != ACK) {
+      fail("kernel too big for the loader");
+      return;
+    }
+    break;
+  case CMD_BAUD:
+    if (status != ACK) {
+      link_.baud_rejected();
+      phase_ = STREAMING;
+      break;
+    }
+    // The loader switches right after its reply, follow it and check
+    // the new rate with a ping.
+    set_line_baud(link_.baud());
+    step_timer_ = loop_.add_timer(std::chrono::milliseconds(SETTLE_MS),
+                                  [this]() {
+                                    step_timer_ = -1;
+                                    send_ping();
+                                  });
+    return;
+  case CMD_PING:
+    if (status != ACK || len != 1 || data[0] != ping_token_) {
+      // a late reply from before the BREAK, keep waiting
+      pending_.push_front(p);
+      arm_reply_timer();
+      return;
+    }
+    if (phase_ == SWITCHING) link_.baud_confirmed();
+    if (load_acked_) {
+      phase_ = STREAMING;
+    } else {
+      phase_ = LOADING;
+      if (complete_ || streaming_) {
+        send_load();
+      } else {
+        keep_alive();
+      }
+      return;
+    }
+    break;
+  case CMD_PROFILE:
+    if (status != ACK) {
+      fprintf(stderr, "### loader can't profile at %u Hz\n\r", profile_hz_);
+    }
+    return;
+  case CMD_GDB:
+    if (status != ACK) {
+      fprintf(stderr, "### loader has no GDB stub\n\r");
+    }
+    return;
+  case CMD_WATCHDOG:
+    if (status != ACK) {
+      fprintf(stderr, "### loader has no watchdog\n\r");
+    }
+    return;
+  case CMD_VERIFY:
+    handle_verify(status, data, len);
+    if (phase_ == FAILED) return;
+    break;
+  case CMD_BOOT: {
+    if (status != ACK) {
+      fail("loader refused to boot");
+      return;
+    }
+    // the loader goes back to the default rate for the kernel
+    if (baud_ != DEFAULT_BAUD) {
+      set_line_baud(DEFAULT_BAUD);
+    }
+    link_.finish();
+    auto secs = std::chrono::duration<double>(
+                  EventLoop::Clock::now() - start_).count();
+    fprintf(stderr, "### finished sending [%.1f s, %.0f byte/s, "
+            "%d resyncs", secs, secs > 0 ? image_.size() / secs : 0.0,
+            resyncs_);
+    if (fec_parity_ != 0) {
+      fprintf(stderr, ", %lu bytes corrected", corrected_);
+    }
+    fprintf(stderr, "]\n\r");
+    phase_ = DONE;
+    return;
+  }
+  }
+  next_step();
+}
+
+void KernelSender::next_step() {
+  if (phase_ != STREAMING) return;
+
+  // change the baud rate once nothing is in flight
+  if (link_.baud() != baud_) {
+    if (pending_.empty()) start_baud_switch();
+    return;
+  }
+
+  // keep enough in flight to cover the round trip
+  size_t frame = frame_size();
+  size_t window = std::max(2 * frame, bytes_per_sec_ / 20);
+  while (inflight_ < window) {
+    uint32_t offset, len;
+    if (!retransmit_.empty()) {
+      offset = retransmit_.front().first;
+      len = retransmit_.front().second;
+      retransmit_.pop_front();
+    } else if (!next_fresh(frame, offset, len)) {
+      break;
+    }
+    send_block(offset, len);
+  }
+
+  if (!complete_) {
+    if (pending_.empty()) keep_alive();
+    return;
+  }
+  if (streaming_) {
+    uint8_t size[4];
+    put_u32(size, image_.size());
+    send_packet(CMD_SIZE, size, sizeof(size));
+    streaming_ = false;
+  }
+  if (acked_ == image_.size() && pending_.empty()) {
+    if (!verified_ && !(features_ & FEATURE_VERIFY)) {
+      fprintf(stderr, "### loader can't verify the kernel\n\r");
+      verified_ = true;
+    }
+    if (!verified_) {
+      send_verify();
+      return;
+    }
+    phase_ = BOOTING;
+    if (profile_hz_ != 0) {
+      uint8_t hz[4];
+      put_u32(hz, profile_hz_);
+      send_packet(CMD_PROFILE, hz, sizeof(hz));
+    }
+    if (debug_) send_packet(CMD_GDB, NULL, 0);
+    if (watchdog_ms_ != 0) {
+      uint8_t msecs[4];
+      put_u32(msecs, watchdog_ms_);
+      send_packet(CMD_WATCHDOG, msecs, sizeof(msecs));
+    }
+    send_packet(CMD_BOOT, NULL, 0);
+  }
+}
+
+size_t KernelSender::max_block() const {
+  if (fec_parity_ == 0) return MAX_PAYLOAD - 4;
+  // whole codewords, then whatever data fits into a shortened one
+  size_t room = MAX_PAYLOAD - FEC_HEADER_SIZE;
+  size_t full = room / RS::CODEWORD_MAX;
+  size_t rest = room % RS::CODEWORD_MAX;
+  return full * (RS::CODEWORD_MAX - fec_parity_) +
+         (rest > fec_parity_ ? rest - fec_parity_ : 0);
+}
+
+size_t KernelSender::frame_size() const {
+  size_t frame = std::min(link_.frame_size(), max_block());
+  if (fec_parity_ == 0) return frame;
+  // A frame smaller than a codeword goes into one shortened codeword,
+  // encoded inline. Larger ones are whole codewords, the prepared ones
+  // start on multiples of k.
+  size_t k = RS::CODEWORD_MAX - fec_parity_;
+  if (frame < k) return frame;
+  return frame / k * k;
+}
+
+void KernelSender::send_block(uint32_t offset, uint32_t len) {
+  if (fec_parity_ == 0) {
+    std::vector<uint8_t> payload(4 + len);
+    put_u32(&payload[0], offset);
+    std::copy(&image_[offset], &image_[offset] + len, &payload[4]);
+    send_packet(CMD_BLOCK, payload.data(), payload.size(), offset, len);
+    return;
+  }
+  std::vector<uint8_t> payload(FEC_HEADER_SIZE +
+                               RS::encoded_size(len, fec_parity_));
+  put_u32(&payload[0], offset);
+  payload[4] = fec_parity_;
+  put_u32(&payload[5], CRC32::update(0, &payload[0], 5));
+  size_t k = RS::CODEWORD_MAX - fec_parity_;
+  if (offset % k != 0) {
+    RS::encode(&image_[offset], len, fec_parity_, &payload[FEC_HEADER_SIZE]);
+  } else {
+    uint8_t *out = &payload[FEC_HEADER_SIZE];
+    for (uint32_t pos = offset; pos < offset + len; pos += k) {
+      size_t n = std::min<size_t>(k, offset + len - pos);
+      const uint8_t *cw = prep_ ? prep_->codeword(pos / k) : NULL;
+      // a shortened codeword only matches at the end of the image
+      if (cw != NULL && (n == k || pos + n == image_.size())) {
+        std::copy(cw, cw + n + fec_parity_, out);
+      } else {
+        RS::encode(&image_[pos], n, fec_parity_, out);
+      }
+      out += n + fec_parity_;
+    }
+  }
+  send_packet(CMD_BLOCK_FEC, payload.data(), payload.size(), offset, len);
+}
+
+void KernelSender::send_verify() {
+  phase_ = VERIFYING;
+  size_t blocks = (image_.size() + verify_block_ - 1) / verify_block_;
+  std::vector<uint8_t> payload(8 + 4 * blocks);
+  put_u32(&payload[0], verify_block_);
+  put_u32(&payload[4], image_crc_);
+  for (size_t i = 0; i < blocks; ++i) {
+    uint32_t digest;
+    if (!prep_->digest(i, digest)) {
+      size_t offset = i * verify_block_;
+      size_t len = std::min<size_t>(verify_block_, image_.size() - offset);
+      digest = XXH32::hash(&image_[offset], len);
+    }
+    put_u32(&payload[8 + 4 * i], digest);
+  }
+  send_packet(CMD_VERIFY, payload.data(), payload.size());
+}
+
+void KernelSender::handle_verify(uint8_t status, const uint8_t *data,
+                                 size_t len) {
+  phase_ = STREAMING;
+  if (status == ACK) {
+    verified_ = true;
+    return;
+  }
+  if (++verify_failures_ > MAX_VERIFY_FAILURES) {
+    fail("kernel keeps failing verification");
+    return;
+  }
+  if (len < 4) {
+    // the request didn't match the kernel, ask again
+    fprintf(stderr, "### loader rejected the verify request, sending it "
+            "again\n\r");
+    return;
+  }
+  // At most VERIFY_MAX_BAD of count blocks are listed, the rest show up
+  // in the next verify. That is progress while count keeps shrinking.
+  uint32_t count = get_u32(data);
+  size_t listed = std::min<size_t>(count, (len - 4) / 4);
+  if (count > listed && (verify_bad_ == 0 || count < verify_bad_)) {
+    --verify_failures_;
+  }
+  verify_bad_ = count;
+  std::vector<uint32_t> bad;
+  if (listed != 0) {
+    for (size_t i = 0; i < listed; ++i) {
+      uint32_t index = get_u32(&data[4 + 4 * i]);
+      if (size_t(index) * verify_block_ < image_.size()) bad.push_back(index);
+    }
+    // each block only once, even from a damaged reply
+    std::sort(bad.begin(), bad.end());
+    bad.erase(std::unique(bad.begin(), bad.end()), bad.end());
+  }
+  if (bad.empty()) {
+    // only the CRC-32 failed: send it all again
+    for (size_t i = 0; i * verify_block_ < image_.size(); ++i) {
+      bad.push_back(i);
+    }
+    fprintf(stderr, "### kernel failed verification, sending all of it "
+            "again\n\r");
+  } else {
+    fprintf(stderr, "### %u blocks failed verification (first: block %u "
+            "of %u bytes), sending %zu of them again\n\r", count, bad[0],
+            verify_block_, bad.size());
+  }
+
+  size_t frame = frame_size();
+  for (uint32_t index : bad) {
+    uint32_t offset = index * verify_block_;
+    uint32_t end = std::min<size_t>(offset + verify_block_, image_.size());
+    acked_ -= end - offset;
+    for (; offset < end; offset += frame) {
+      uint32_t n = std::min<uint32_t>(frame, end - offset);
+      retransmit_.push_back(std::make_pair(offset, n));
+    }
+  }
+}
+
+void KernelSender::send_ping() {
+  ++ping_token_;
+  send_packet(CMD_PING, &ping_token_, 1);
+}
+
+void KernelSender::start_baud_switch() {
+  phase_ = SWITCHING;
+  uint8_t baud[4];
+  put_u32(baud, link_.baud());
+  send_packet(CMD_BAUD, baud, sizeof(baud));
+}
+
+void KernelSender::resync(const char *why) {
+  if (++resyncs_ > MAX_RESYNCS) {
+    fail("giving up, the link keeps failing");
+    return;
+  }
+  fprintf(stderr, "### %s at %u baud, resyncing\n\r", why, baud_);
+  link_.link_error();
+
+  // whatever was in flight has to be sent again
+  for (const Pending& p : pending_) {
+    if (p.cmd == CMD_BLOCK || p.cmd == CMD_BLOCK_FEC) {
+      retransmit_.push_back(std::make_pair(p.offset, p.len));
+    } else if (p.cmd == CMD_SIZE) {
+      streaming_ = true;
+    }
+  }
+  pending_.clear();
+  inflight_ = 0;
+  out_.clear();
+  out_pos_ = 0;
+  rx_.clear();
+  cancel_timer(reply_timer_);
+  cancel_timer(step_timer_);
+  phase_ = RESYNC;
+
+  // A BREAK puts the loader back to the default baud rate. Without one
+  // it drops the partial packet when its receive times out.
+  transport_.discard_output();
+  if (transport_.sends_break()) {
+    transport_.set_break(true);
+  } else {
+    fprintf(stderr, "### %s can't send a BREAK, waiting for the loader "
+            "to time out\n\r", transport_.name().c_str());
+  }
+  step_timer_ = loop_.add_timer(
+    std::chrono::milliseconds(BREAK_MS), [this]() {
+      if (transport_.sends_break()) transport_.set_break(false);
+      set_line_baud(DEFAULT_BAUD);
+      transport_.discard_input();
+      step_timer_ = loop_.add_timer(
+        std::chrono::milliseconds(SETTLE_MS), [this]() {
+          step_timer_ = -1;
+          send_ping();
+        });
+    });
+}
+
+bool KernelSender::want_write() const {
+  return out_pos_ < out_.size() && !throttled_ && !done();
+}
+
+size_t KernelSender::room() {
+  // keep roughly 20ms of data queued, enough to never let the line idle
+  size_t target = bytes_per_sec_ / 50;
+  if (target < 256) target = 256;
+
+  ssize_t queued = transport_.output_queued();
+  if (queued == -1) {
+    // no local queue to speak of, rely on POLLOUT alone
+    return out_.size();
+  }
+  if (size_t(queued) < target) return target - queued;
+
+  // Queue is full: stop asking for POLLOUT until about half of it
+  // has drained.
+  size_t excess = queued - target / 2;
+  auto delay = std::chrono::microseconds(excess * 1000000 / bytes_per_sec_);
+  throttled_ = true;
+  throttle_timer_ = loop_.add_timer(delay, [this]() {
+      throttle_timer_ = -1;
+      throttled_ = false;
+    });
+  return 0;
+}
+
+void KernelSender::writable() {
+  if (!want_write()) return;
+
+  size_t max = room();
+  if (max == 0) return;
+  size_t len = out_.size() - out_pos_;
+  if (len > max) len = max;
+  ssize_t res = transport_.write(&out_[out_pos_], len);
+  if (res == -1) return; // EAGAIN, wait for the next POLLOUT
+  out_pos_ += res;
+  if (out_pos_ == out_.size()) {
+    out_.clear();
+    out_pos_ = 0;
+  }
+}
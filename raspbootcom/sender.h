@@ -0,0 +1,211 @@
+/* sender.h - send kernel.img to the RPi from within the event loop */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "kernel_stream.h"
+#include "link.h"
+#include "prep.h"
+#include "session.h"
+#include "transport.h"
+
+/* The transfer is a state machine driven by the event loop. It speaks
+ * the packet protocol from raspbootin/include/protocol.h:
+ *
+ *   LOADING -> STREAMING -> VERIFYING -> BOOTING -> DONE
+ *
+ * While streaming it keeps a window of CMD_BLOCK packets in flight and
+ * lets the LinkController pick baud rate and frame size from the
+ * errors the loader reports. Damaged frames are sent again, with FEC
+ * only those the loader couldn't correct. When the
+ * link loses sync (overrun, timeout, failed baud switch) the sender
+ * sends a BREAK, which puts both sides back to the default baud rate
+ * (RESYNC), and continues from there. Before booting the loader checks
+ * the kernel against digests of its blocks, damaged blocks are sent
+ * again. The kernel is announced with its CRC-32 as ID, so blocks the
+ * loader still has from an interrupted attempt are skipped.
+ *
+ * Codewords and digests come from the ImagePrep threads when they are
+ * ready. With FEC the frames are whole codewords of the image, so the
+ * prepared ones fit; whatever isn't prepared yet is encoded inline.
+ *
+ * A kernel from a KernelStream is announced without a size and sent in
+ * whole frames as it comes in, the size (CMD_SIZE) and the digests
+ * follow at its end. Pings keep the loader waiting meanwhile, as they
+ * do while the kernel file is still being built.
+ *
+ * To keep the latency for the console low it never fills the tty
+ * queue by more than a few milliseconds worth of data (TIOCOUTQ).
+ */
+class KernelSender : public Session {
+public:
+  // stream: the kernel comes from this pipe, NULL to read file
+  // profile_hz: ask the loader to sample the kernel, 0 for no profile
+  // debug: stop the kernel at its entry in the loader's GDB stub
+  // fec_parity: Reed-Solomon parity bytes per codeword, 0 for no FEC
+  // watchdog_ms: leave the loader's watchdog running for the kernel
+  // wait: file isn't ready yet, read it on file_ready()
+  KernelSender(EventLoop& loop, Transport& transport, const char *file,
+               KernelStream *stream, LinkController& link,
+               unsigned profile_hz = 0,
+               bool debug = false, unsigned fec_parity = 0,
+               unsigned watchdog_ms = 0, bool wait = false);
+  ~KernelSender();
+
+  size_t receive(const char *buf, size_t len) override;
+  void writable() override;
+  bool want_write() const override;
+  bool done() const override { return phase_ == DONE || phase_ == FAILED; }
+  // the kernel has been started
+  bool booted() const { return phase_ == DONE; }
+
+  // More of the KernelStream has arrived (or its end).
+  void stream_data();
+  // The kernel file has been built, send it.
+  void file_ready();
+
+private:
+  enum Phase {
+    LOADING, STREAMING, SWITCHING, RESYNC, VERIFYING, BOOTING, DONE, FAILED
+  };
+  enum {
+    // replies take at least this long (USB latency, loader work)
+    REPLY_MARGIN_MS = 500,
+    // BREAK length and time for the loader to settle afterwards
+    BREAK_MS = 20,
+    SETTLE_MS = 20,
+    MAX_RESYNCS = 10,
+    // smallest block CMD_VERIFY has a digest for
+    VERIFY_BLOCK = 4096,
+    MAX_VERIFY_FAILURES = 3,
+    // ping a loader waiting for more of a stream, it gives up after 5s
+    KEEPALIVE_MS = 1000,
+  };
+
+  // a packet waiting for its reply
+  struct Pending {
+    uint8_t cmd;
+    uint32_t offset;
+    uint32_t len;
+  };
+
+  void fail(const char *msg);
+  void read_file();
+  // the whole kernel is known, compute its ID and digests
+  void finish_image();
+  // ping the loader once nothing else is in flight for a while
+  void keep_alive();
+  // announce the kernel, with CMD_RESUME unless the loader refused it,
+  // ask for the loader's features first
+  void send_load();
+  void handle_resume(uint8_t status, const uint8_t *data, size_t len);
+  // pick the next block never sent before, false if there is none
+  bool next_fresh(size_t frame, uint32_t& offset, uint32_t& len);
+  // the loader has the block of offset from an earlier attempt
+  bool resumed(uint32_t offset) const;
+  void send_packet(uint8_t cmd, const uint8_t *payload, size_t len,
+                   uint32_t offset = 0, uint32_t block_len = 0);
+  void handle_reply(uint8_t status, uint8_t errors,
+                    const uint8_t *data, size_t len);
+  // queue whatever comes next
+  void next_step();
+  // send the block at offset
+  void send_block(uint32_t offset, uint32_t len);
+  // largest block that fits into one packet
+  size_t max_block() const;
+  // block size for the next frames
+  size_t frame_size() const;
+  // ask the loader to check the whole kernel
+  void send_verify();
+  void handle_verify(uint8_t status, const uint8_t *data, size_t len);
+  void send_ping();
+  void start_baud_switch();
+  void resync(const char *why);
+  void set_line_baud(unsigned baud);
+  // (re)start the timeout for the oldest pending reply
+  void arm_reply_timer();
+  void cancel_timer(int& id);
+  // bytes that may be written without overfilling the tty queue
+  size_t room();
+
+  EventLoop& loop_;
+  Transport& transport_;
+  LinkController& link_;
+  Phase phase_ = LOADING;
+  unsigned baud_;
+  unsigned profile_hz_;
+  bool debug_;
+  unsigned fec_parity_;
+  unsigned watchdog_ms_;
+  // bytes the loader corrected
+  unsigned long corrected_ = 0;
+  // Feature flags from CMD_FEATURES
+  bool features_known_ = false;
+  uint32_t features_ = 0;
+  size_t bytes_per_sec_;
+
+  std::string file_;
+  KernelStream *stream_;
+  std::vector<uint8_t> image_;
+  // image_ is the whole kernel
+  bool complete_ = false;
+  // the kernel was announced without a size, CMD_SIZE is still due
+  bool streaming_ = false;
+  uint32_t image_crc_;
+  std::unique_ptr<ImagePrep> prep_;
+  bool resume_ = true;
+  // blocks of resume_block_ bytes the loader already had
+  uint32_t resume_block_ = 0;
+  std::vector<bool> resumed_;
+  // next offset never sent before
+  uint32_t next_offset_ = 0;
+  // damaged blocks to send again
+  std::deque<std::pair<uint32_t, uint32_t> > retransmit_;
+  uint32_t acked_ = 0;
+  uint32_t inflight_ = 0;
+  bool load_acked_ = false;
+  bool verified_ = false;
+  uint32_t verify_block_ = VERIFY_BLOCK;
+  int verify_failures_ = 0;
+  // bad blocks the last verify reported
+  uint32_t verify_bad_ = 0;
+
+  std::string out_;
+  size_t out_pos_ = 0;
+  std::deque<Pending> pending_;
+  std::vector<uint8_t> rx_;
+  uint8_t ping_token_ = 0;
+  int resyncs_ = 0;
+
+  int throttle_timer_ = -1;
+  int reply_timer_ = -1;
+  int step_timer_ = -1;
+  int keepalive_timer_ = -1;
+  bool throttled_ = false;
+  EventLoop::Clock::time_point start_;
+};
@@ -0,0 +1,138 @@
+/* serial.cc - configure the serial port */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <termios.h>
+
+#include "serial.h"
+#include "unix_error.h"
+#include "../raspbootin/include/protocol.h"
+
+namespace {
+  struct Speed {
+    unsigned baud;
+    speed_t speed;
+  };
+
+  const Speed speeds[] = {
+    {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+    {115200, B115200}, {230400, B230400},
+#ifdef B460800
+    {460800, B460800},
+#endif
+#ifdef B500000
+    {500000, B500000},
+#endif
+#ifdef B576000
+    {576000, B576000},
+#endif
+#ifdef B921600
+    {921600, B921600},
+#endif
+#ifdef B1000000
+    {1000000, B1000000},
+#endif
+#ifdef B1152000
+    {1152000, B1152000},
+#endif
+#ifdef B1500000
+    {1500000, B1500000},
+#endif
+#ifdef B2000000
+    {2000000, B2000000},
+#endif
+#ifdef B2500000
+    {2500000, B2500000},
+#endif
+#ifdef B3000000
+    {3000000, B3000000},
+#endif
+#ifdef B3500000
+    {3500000, B3500000},
+#endif
+#ifdef B4000000
+    {4000000, B4000000},
+#endif
+  };
+
+  bool find_speed(unsigned baud, speed_t *speed) {
+    for (const Speed& s : speeds) {
+      if (s.baud == baud) {
+        *speed = s.speed;
+        return true;
+      }
+    }
+    return false;
+  }
+}
+
+void serial_configure(int fd, bool flow_control) {
+  // The termios structure, to be configured for serial interface.
+  struct termios termios;
+
+  // Get the attributes.
+  UnixError::check("get attributes",
+                   tcgetattr(fd, &termios));
+
+  // So, we poll.
+  termios.c_cc[VTIME] = 0;
+  termios.c_cc[VMIN] = 0;
+
+  // 8N1 mode, no input/output/line processing masks. BREAKs from the
+  // loader are marked in the input instead of showing up as a 0 byte.
+  termios.c_iflag = PARMRK;
+  termios.c_oflag = 0;
+  termios.c_cflag = CS8 | CREAD | CLOCAL;
+  if (flow_control) {
+    termios.c_cflag |= CRTSCTS;
+  }
+  termios.c_lflag = 0;
+
+  // Set the baud rate.
+  speed_t speed = B115200;
+  find_speed(Protocol::DEFAULT_BAUD, &speed);
+  UnixError::check("set BAUD rate (in)",
+                   cfsetispeed(&termios, speed));
+  UnixError::check("set BAUD rate (out)",
+                   cfsetospeed(&termios, speed));
+
+  // Write the attributes.
+  UnixError::check("set attributes",
+                   tcsetattr(fd, TCSAFLUSH, &termios));
+}
+
+bool serial_baud_supported(unsigned baud) {
+  speed_t speed;
+  return find_speed(baud, &speed);
+}
+
+void serial_set_baud(int fd, unsigned baud) {
+  speed_t speed;
+  if (!find_speed(baud, &speed)) {
+    throw UnixError("unsupported baud rate", EINVAL);
+  }
+  struct termios termios;
+  UnixError::check("get attributes",
+                   tcgetattr(fd, &termios));
+  UnixError::check("set BAUD rate (in)",
+                   cfsetispeed(&termios, speed));
+  UnixError::check("set BAUD rate (out)",
+                   cfsetospeed(&termios, speed));
+  // wait for pending output to go out at the old rate
+  UnixError::check("set attributes",
+                   tcsetattr(fd, TCSADRAIN, &termios));
+}
@@ -0,0 +1,32 @@
+/* serial.h - configure the serial port */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+/* Put a tty into raw 8N1 mode at the default baud rate. BREAKs are
+ * marked in the input (PARMRK): \377 \0 \0, a byte with a framing or
+ * parity error is \377 \0 byte and \377 itself is doubled. This takes
+ * every byte off the kernel's raw fast path, but a BREAK counter
+ * (TIOCGICOUNT) can't tell which 0 byte was the BREAK. */
+void serial_configure(int fd, bool flow_control);
+
+/* Can termios set this baud rate? */
+bool serial_baud_supported(unsigned baud);
+
+/* Change the baud rate of a configured tty. */
+void serial_set_baud(int fd, unsigned baud);
@@ -0,0 +1,40 @@
+/* session.h - conversations with the loader */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/* A conversation with the loader that owns the serial line while it
+ * lasts (KernelSender, Monitor). The caller feeds it bytes read from
+ * the transport with receive() and calls writable() when the transport
+ * signals POLLOUT.
+ */
+class Session {
+public:
+  virtual ~Session() { }
+
+  // Bytes from the RPi. Returns how many of them belonged to the
+  // session, the rest is console output.
+  virtual size_t receive(const char *buf, size_t len) = 0;
+  // The serial port has room for more data.
+  virtual void writable() = 0;
+  // Should the event loop wait for POLLOUT?
+  virtual bool want_write() const = 0;
+  virtual bool done() const = 0;
+};
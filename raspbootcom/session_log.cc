@@ -0,0 +1,344 @@
+/* session_log.cc - compressed console log with an index of boots */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "session_log.h"
+#include "unix_error.h"
+#include "../raspbootin/include/lz.h"
+
+namespace SessionLog {
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// the records of an index, a partly written last one is left out
+static std::vector<Record> read_index(int fd, const std::string& name) {
+  struct stat st;
+  UnixError::check("stat " + name, fstat(fd, &st));
+  std::vector<Record> records(st.st_size / sizeof(Record));
+  size_t len = records.size() * sizeof(Record);
+  size_t done = 0;
+  while (done < len) {
+    ssize_t res = UnixError::check("read " + name,
+                                   pread(fd, (char*)records.data() + done,
+                                         len - done, done));
+    if (res == 0) break;
+    done += res;
+  }
+  records.resize(done / sizeof(Record));
+  return records;
+}
+
+Writer::Writer(const std::string& path)
+  : path_(path), table_(LZ::HASH_SIZE), out_(LZ::bound(LZ::MAX_BLOCK)) {
+  std::string index = path_ + ".idx";
+  data_fd_ = UnixError::check("open " + path_,
+                              open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                                   0644));
+  index_fd_ = UnixError::check("open " + index,
+                               open(index.c_str(), O_RDWR | O_CREAT |
+                                    O_CLOEXEC, 0644),
+                               [this]() { close(data_fd_); });
+  auto on_error = [this]() {
+    close(data_fd_);
+    close(index_fd_);
+  };
+  std::vector<Record> records;
+  try {
+    records = read_index(index_fd_, index);
+  } catch (UnixError&) {
+    on_error();
+    throw;
+  }
+  // Continue after the last complete record and its block, whatever
+  // a crash left behind them is lost.
+  for (const Record& rec : records) {
+    if (rec.kind == BLOCK) {
+      offset_ = rec.offset + rec.size;
+      pos_ = rec.pos + rec.length;
+    }
+  }
+  UnixError::check("truncate " + index,
+                   ftruncate(index_fd_, records.size() * sizeof(Record)),
+                   on_error);
+  UnixError::check("truncate " + path_, ftruncate(data_fd_, pos_), on_error);
+  UnixError::check("seek " + index, lseek(index_fd_, 0, SEEK_END), on_error);
+  UnixError::check("seek " + path_, lseek(data_fd_, 0, SEEK_END), on_error);
+  end_ = offset_;
+  thread_ = std::thread([this]() { work(); });
+}
+
+Writer::~Writer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+  if (lost_ != 0) {
+    fprintf(stderr, "### log %s lost %llu bytes\n\r", path_.c_str(),
+            (unsigned long long)lost_);
+  }
+  close(data_fd_);
+  close(index_fd_);
+}
+
+void Writer::write(const char *buf, size_t len) {
+  if (len == 0) return;
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.size() + len > MAX_PENDING) {
+      lost_ += len;
+      return;
+    }
+    if (pending_.empty()) pending_time_ = now();
+    pending_.append(buf, len);
+    end_ += len;
+    full = pending_.size() >= LZ::MAX_BLOCK;
+  }
+  if (full) wake_.notify_one();
+}
+
+void Writer::mark_boot() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    boots_.push_back(Record{BOOT, 0, 0, 0, now(), end_, 0});
+  }
+  wake_.notify_one();
+}
+
+bool Writer::append(int fd, const void *buf, size_t len) {
+  const char *p = (const char*)buf;
+  while (len > 0 && !failed_) {
+    ssize_t res = ::write(fd, p, len);
+    if (res == -1 && errno == EINTR) continue;
+    if (res <= 0) {
+      perror(("### log " + path_).c_str());
+      failed_ = true;
+      break;
+    }
+    p += res;
+    len -= res;
+  }
+  return !failed_;
+}
+
+void Writer::write_block(const uint8_t *buf, size_t len, uint64_t time) {
+  size_t out_len = LZ::compress(buf, len, out_.data(), table_.data());
+  // the index only points to blocks that are all there
+  if (!append(data_fd_, out_.data(), out_len)) return;
+  Record rec{BLOCK, uint32_t(len), uint32_t(out_len), 0, time, offset_,
+             pos_};
+  if (!append(index_fd_, &rec, sizeof(rec))) return;
+  offset_ += len;
+  pos_ += out_len;
+}
+
+void Writer::work() {
+  std::string data;
+  std::vector<Record> boots;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // a second after the first byte, or a full block
+    if (!stop_ && boots_.empty() && pending_.size() < LZ::MAX_BLOCK) {
+      if (pending_.empty()) {
+        wake_.wait(lock);
+      } else {
+        wake_.wait_for(lock, std::chrono::milliseconds(FLUSH_MS));
+      }
+      if (!stop_ && boots_.empty() && pending_.size() < LZ::MAX_BLOCK &&
+          (pending_.empty() ||
+           now() - pending_time_ < uint64_t(FLUSH_MS) * 1000)) {
+        continue;
+      }
+    }
+    data.swap(pending_);
+    boots.swap(boots_);
+    uint64_t time = pending_time_;
+    bool stop = stop_;
+    lock.unlock();
+
+    for (size_t i = 0; i < data.size(); i += LZ::MAX_BLOCK) {
+      write_block((const uint8_t*)data.data() + i,
+                  std::min<size_t>(data.size() - i, LZ::MAX_BLOCK), time);
+    }
+    for (const Record& rec : boots) append(index_fd_, &rec, sizeof(rec));
+    data.clear();
+    boots.clear();
+
+    if (stop) return;
+    lock.lock();
+  }
+}
+
+Reader::Reader(const std::string& path) : path_(path) {
+  std::string index = path_ + ".idx";
+  data_fd_ = UnixError::check("open " + path_,
+                              open(path_.c_str(), O_RDONLY | O_CLOEXEC));
+  int index_fd = UnixError::check("open " + index,
+                                  open(index.c_str(), O_RDONLY | O_CLOEXEC),
+                                  [this]() { close(data_fd_); });
+  std::vector<Record> records;
+  try {
+    records = read_index(index_fd, index);
+  } catch (UnixError&) {
+    close(index_fd);
+    close(data_fd_);
+    throw;
+  }
+  close(index_fd);
+  for (const Record& rec : records) {
+    (rec.kind == BLOCK ? blocks_ : boots_).push_back(rec);
+  }
+}
+
+Reader::~Reader() {
+  close(data_fd_);
+}
+
+uint64_t Reader::size() const {
+  if (blocks_.empty()) return 0;
+  return blocks_.back().offset + blocks_.back().size;
+}
+
+uint64_t Reader::offset_at(uint64_t time) const {
+  // block times are those of their first byte, boot times are exact
+  uint64_t offset = UINT64_MAX;
+  for (const std::vector<Record> *records : {&blocks_, &boots_}) {
+    auto it = std::lower_bound(records->begin(), records->end(), time,
+                               [](const Record& rec, uint64_t t) {
+                                 return rec.time < t;
+                               });
+    if (it != records->end()) offset = std::min(offset, it->offset);
+  }
+  return offset == UINT64_MAX ? size() : offset;
+}
+
+void Reader::copy(uint64_t from, uint64_t to, FILE *out) const {
+  // the last block starting at or before from
+  auto it = std::upper_bound(blocks_.begin(), blocks_.end(), from,
+                             [](uint64_t offset, const Record& rec) {
+                               return offset < rec.offset;
+                             });
+  if (it != blocks_.begin()) --it;
+  uint8_t in[LZ::bound(LZ::MAX_BLOCK)];
+  uint8_t data[LZ::MAX_BLOCK];
+  for (; it != blocks_.end() && it->offset < to; ++it) {
+    if (it->length > sizeof(in)) {
+      throw UnixError(path_ + ": corrupt index", EINVAL);
+    }
+    ssize_t res = UnixError::check("read " + path_,
+                                   pread(data_fd_, in, it->length, it->pos));
+    long len = res == ssize_t(it->length)
+             ? LZ::decompress(in, it->length, data, sizeof(data)) : -1;
+    if (len != long(it->size)) {
+      throw UnixError(path_ + ": corrupt block", EINVAL);
+    }
+    uint64_t start = std::max(from, it->offset);
+    uint64_t end = std::min(to, it->offset + len);
+    if (start < end) {
+      fwrite(data + (start - it->offset), 1, end - start, out);
+    }
+  }
+}
+
+// a time of the query in microseconds since the epoch
+static uint64_t parse_time(const std::string& arg) {
+  if (!arg.empty() && arg[0] == '@') {
+    char *end;
+    double secs = strtod(arg.c_str() + 1, &end);
+    if (end != arg.c_str() + 1 && *end == 0 && secs >= 0) return secs * 1e6;
+  }
+  for (const char *format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M",
+                             "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M"}) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(arg.c_str(), format, &tm);
+    if (end && *end == 0) {
+      tm.tm_isdst = -1;
+      time_t t = mktime(&tm);
+      if (t != -1) return uint64_t(t) * 1000000;
+    }
+  }
+  throw std::invalid_argument("bad time '" + arg + "'");
+}
+
+static std::string format_time(uint64_t time) {
+  time_t secs = time / 1000000;
+  struct tm tm;
+  localtime_r(&secs, &tm);
+  char buf[64];
+  size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(buf + len, sizeof(buf) - len, ".%03u",
+           unsigned(time / 1000 % 1000));
+  return buf;
+}
+
+void query(const std::string& path, const std::vector<std::string>& args) {
+  Reader reader(path);
+  const std::vector<Record>& boots = reader.boots();
+  std::string cmd = args.empty() ? "boots" : args[0];
+  if (cmd == "boots" && args.size() <= 1) {
+    uint64_t size = reader.size();
+    printf("boot  time                     bytes\n");
+    for (size_t i = 0; i < boots.size(); ++i) {
+      uint64_t end = i + 1 < boots.size() ? boots[i + 1].offset : size;
+      printf("%4zu  %s  %llu\n", i + 1, format_time(boots[i].time).c_str(),
+             (unsigned long long)(end - boots[i].offset));
+    }
+  } else if (cmd == "boot" && args.size() == 2) {
+    char *end;
+    long n = strtol(args[1].c_str(), &end, 0);
+    if (args[1] == "last") {
+      n = boots.size();
+    } else if (*end != 0 || end == args[1].c_str()) {
+      n = -1;
+    }
+    if (n < 0 || size_t(n) > boots.size()) {
+      throw std::invalid_argument("no boot '" + args[1] + "' in " + path);
+    }
+    uint64_t from = n == 0 ? 0 : boots[n - 1].offset;
+    uint64_t to = size_t(n) < boots.size() ? boots[n].offset : reader.size();
+    reader.copy(from, to, stdout);
+  } else if (cmd == "time" && (args.size() == 2 || args.size() == 3)) {
+    uint64_t from = reader.offset_at(parse_time(args[1]));
+    uint64_t to = args.size() == 3 ? reader.offset_at(parse_time(args[2]))
+                                   : reader.size();
+    reader.copy(from, to, stdout);
+  } else {
+    throw std::invalid_argument("bad log query, try boots, boot N or "
+                                "time FROM [TO]");
+  }
+}
+
+}
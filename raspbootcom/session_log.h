@@ -0,0 +1,151 @@
+/* session_log.h - compressed console log with an index of boots */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* The console log of --log=FILE. FILE holds the console output in LZ
+ * blocks (raspbootin/include/lz.h) of at most 64KiB, FILE.idx a record
+ * for every block and every boot request:
+ *
+ *   kind u32, size u32, length u32, unused u32, time u64, offset u64,
+ *   pos u64
+ *
+ * in host byte order. time is the wall clock in microseconds, offset
+ * the position in the uncompressed output. For a block, size is its
+ * uncompressed size, length and pos its compressed size and position
+ * in FILE, and time that of its first byte; a block is written at the
+ * latest a second after that. Both files are only ever
+ * appended to, a new raspbootcom continues an old log.
+ *
+ * SessionLog only copies the output into a buffer, a thread compresses
+ * and writes it. If the disk can't keep up the buffer is capped and
+ * output lost, the console never waits for the log.
+ */
+namespace SessionLog {
+  enum Kind : uint32_t {
+    BLOCK = 'B',
+    BOOT = 'R',
+  };
+
+  struct Record {
+    uint32_t kind;
+    uint32_t size;
+    uint32_t length;
+    uint32_t unused;
+    uint64_t time;
+    uint64_t offset;
+    uint64_t pos;
+  };
+
+  // microseconds since the epoch
+  uint64_t now();
+
+  class Writer {
+  public:
+    explicit Writer(const std::string& path);
+    ~Writer();
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // console output
+    void write(const char *buf, size_t len);
+    // the board asked for a kernel, a new boot starts here
+    void mark_boot();
+
+  private:
+    enum {
+      FLUSH_MS = 1000,
+      // output held back while the disk is busy
+      MAX_PENDING = 64 << 20,
+    };
+
+    void work();
+    // compress and append a block of at most LZ::MAX_BLOCK bytes
+    void write_block(const uint8_t *buf, size_t len, uint64_t time);
+    // false once writing failed, the log stops then
+    bool append(int fd, const void *buf, size_t len);
+
+    std::string path_;
+    int data_fd_ = -1;
+    int index_fd_ = -1;
+    // next offset and position, only used by the thread
+    uint64_t offset_ = 0;
+    uint64_t pos_ = 0;
+    bool failed_ = false;
+    std::vector<uint32_t> table_;
+    std::vector<uint8_t> out_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    // output and boots not written yet
+    std::string pending_;
+    uint64_t pending_time_ = 0;
+    std::vector<Record> boots_;
+    // offset after pending_
+    uint64_t end_ = 0;
+    uint64_t lost_ = 0;
+    bool stop_ = false;
+    std::thread thread_;
+  };
+
+  /* Finds boots and time ranges through the index and decompresses
+   * only the blocks that hold them.
+   */
+  class Reader {
+  public:
+    explicit Reader(const std::string& path);
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // the boot requests, oldest first
+    const std::vector<Record>& boots() const { return boots_; }
+    // uncompressed size of the log
+    uint64_t size() const;
+    // offset of the first output at or after time
+    uint64_t offset_at(uint64_t time) const;
+    // copy the output between two offsets to out
+    void copy(uint64_t from, uint64_t to, FILE *out) const;
+
+  private:
+    std::string path_;
+    int data_fd_;
+    std::vector<Record> blocks_;
+    std::vector<Record> boots_;
+  };
+
+  /* The --read-log command: "boots" lists the boots, "boot N" prints
+   * the output of boot N ("last" for the last one, the output before the
+   * first boot is boot 0), "time FROM [TO]" the output
+   * between two times (YYYY-MM-DD HH:MM[:SS] or @SECONDS, to about a
+   * second). Throws std::invalid_argument for a bad command.
+   */
+  void query(const std::string& path, const std::vector<std::string>& args);
+}
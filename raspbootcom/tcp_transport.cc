@@ -0,0 +1,365 @@
+/* tcp_transport.cc - serial ports behind terminal servers */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "tcp_transport.h"
+#include "unix_error.h"
+#include "scope.h"
+#include "../raspbootin/include/protocol.h"
+
+#include <stdexcept>
+
+namespace {
+  enum {
+    CONNECT_TIMEOUT_MS = 3000,
+  };
+
+  // telnet (RFC 854, 856, 858)
+  enum {
+    SE = 240,
+    SB = 250,
+    WILL = 251,
+    WONT = 252,
+    DO = 253,
+    DONT = 254,
+    IAC = 255,
+
+    OPT_BINARY = 0,
+    OPT_SGA = 3,
+    OPT_COM_PORT = 44,
+  };
+
+  // com port option commands (RFC 2217), the server replies with +100
+  enum {
+    SET_BAUDRATE = 1,
+    SET_DATASIZE = 2,
+    SET_PARITY = 3,
+    SET_STOPSIZE = 4,
+    SET_CONTROL = 5,
+    NOTIFY_LINESTATE = 6,
+    SET_LINESTATE_MASK = 10,
+    PURGE_DATA = 12,
+    SERVER_OFFSET = 100,
+
+    PARITY_NONE = 1,
+    STOPSIZE_1 = 1,
+    CONTROL_NO_FLOW = 1,
+    CONTROL_HW_FLOW = 3,
+    CONTROL_BREAK_ON = 5,
+    CONTROL_BREAK_OFF = 6,
+    PURGE_RX = 1,
+    PURGE_TX = 2,
+    LINESTATE_BREAK = 0x10,
+  };
+}
+
+TcpTransport::TcpTransport(const std::string& name, const std::string& host,
+                           const std::string& port, bool flow_control)
+  : Transport(name, flow_control), host_(host), port_(port) {
+}
+
+bool TcpTransport::open() {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *res;
+  int err = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res);
+  if (err == EAI_AGAIN) return false;
+  if (err != 0) {
+    throw std::runtime_error(name_ + ": " + gai_strerror(err));
+  }
+  SCOPE_EXIT {
+    freeaddrinfo(res);
+  };
+
+  for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+    fd_ = socket(ai->ai_family,
+                 ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 ai->ai_protocol);
+    if (fd_ == -1) continue;
+
+    // connect in the background so a signal can interrupt the wait
+    if (connect(fd_, ai->ai_addr, ai->ai_addrlen) == -1) {
+      if (errno != EINPROGRESS) {
+        close();
+        continue;
+      }
+      struct pollfd pfd = {fd_, POLLOUT, 0};
+      int error = ETIMEDOUT;
+      socklen_t error_len = sizeof(error);
+      if (poll(&pfd, 1, CONNECT_TIMEOUT_MS) == 1) {
+        getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &error_len);
+      }
+      if (error != 0) {
+        close();
+        continue;
+      }
+    }
+
+    // Small packets go out right away, the protocol waits for replies.
+    int one = 1;
+    UnixError::check("set TCP_NODELAY",
+                     setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY,
+                                &one, sizeof(one)));
+    UnixError::check("set SO_KEEPALIVE",
+                     setsockopt(fd_, SOL_SOCKET, SO_KEEPALIVE,
+                                &one, sizeof(one)));
+    return true;
+  }
+  // refused, unreachable or timed out: the server may come back
+  return false;
+}
+
+ssize_t TcpTransport::read(char *buf, size_t len) {
+  break_at_ = -1;
+  ssize_t res = recv(fd_, buf, len, 0);
+  if (res == -1 && (errno == ECONNRESET || errno == ETIMEDOUT)) {
+    return 0;
+  }
+  return UnixError::check_again("read from " + name_, res);
+}
+
+ssize_t TcpTransport::send_some(const char *buf, size_t len) {
+  ssize_t res = send(fd_, buf, len, MSG_NOSIGNAL);
+  if (res == -1 && (errno == EPIPE || errno == ECONNRESET)) {
+    return -1;
+  }
+  return UnixError::check_again("write to " + name_, res);
+}
+
+ssize_t TcpTransport::write(const char *buf, size_t len) {
+  return send_some(buf, len);
+}
+
+bool TcpTransport::baud_supported(unsigned baud) const {
+  return baud == Protocol::DEFAULT_BAUD;
+}
+
+void TcpTransport::set_baud(unsigned baud) {
+  if (baud != Protocol::DEFAULT_BAUD) {
+    throw UnixError(name_ + ": can't change the baud rate", EINVAL);
+  }
+}
+
+void TcpTransport::set_break(bool) {
+  throw UnixError(name_ + ": can't send a BREAK", EOPNOTSUPP);
+}
+
+void TcpTransport::discard_input() {
+  char buf[4096];
+  while (read(buf, sizeof(buf)) > 0) { }
+}
+
+bool Rfc2217Transport::open() {
+  if (!TcpTransport::open()) return false;
+
+  tx_.clear();
+  state_ = DATA;
+  subneg_.clear();
+  send_option(WILL, OPT_BINARY);
+  send_option(DO, OPT_BINARY);
+  send_option(WILL, OPT_SGA);
+  send_option(DO, OPT_SGA);
+  send_option(WILL, OPT_COM_PORT);
+
+  set_baud(Protocol::DEFAULT_BAUD);
+  com_port(SET_DATASIZE, 8);
+  com_port(SET_PARITY, PARITY_NONE);
+  com_port(SET_STOPSIZE, STOPSIZE_1);
+  com_port(SET_CONTROL, flow_control_ ? CONTROL_HW_FLOW : CONTROL_NO_FLOW);
+  // BREAKs from the loader
+  com_port(SET_LINESTATE_MASK, LINESTATE_BREAK);
+  flush();
+  return true;
+}
+
+void Rfc2217Transport::send_option(uint8_t verb, uint8_t option) {
+  tx_ += char(IAC);
+  tx_ += char(verb);
+  tx_ += char(option);
+}
+
+void Rfc2217Transport::com_port(uint8_t command, const uint8_t *value,
+                                size_t len) {
+  tx_ += char(IAC);
+  tx_ += char(SB);
+  tx_ += char(OPT_COM_PORT);
+  tx_ += char(command);
+  for (size_t i = 0; i < len; ++i) {
+    tx_ += char(value[i]);
+    if (value[i] == IAC) tx_ += char(IAC);
+  }
+  tx_ += char(IAC);
+  tx_ += char(SE);
+}
+
+void Rfc2217Transport::flush() {
+  if (tx_.empty()) return;
+  ssize_t res = send_some(tx_.data(), tx_.size());
+  if (res > 0) tx_.erase(0, res);
+}
+
+ssize_t Rfc2217Transport::write(const char *buf, size_t len) {
+  // Escaped data stays in tx_ until the socket takes it.
+  flush();
+  if (!tx_.empty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    tx_ += buf[i];
+    if (uint8_t(buf[i]) == IAC) tx_ += char(IAC);
+  }
+  flush();
+  return len;
+}
+
+ssize_t Rfc2217Transport::read(char *buf, size_t len) {
+  ssize_t res = TcpTransport::read(buf, len);
+  if (res <= 0) return res;
+
+  // strip the telnet commands, data is copied down in place
+  size_t out = 0;
+  for (ssize_t i = 0; i < res; ++i) {
+    uint8_t c = buf[i];
+    switch (state_) {
+    case DATA:
+      if (c == IAC) {
+        state_ = COMMAND;
+      } else {
+        buf[out++] = c;
+      }
+      break;
+    case COMMAND:
+      if (c == IAC) {
+        buf[out++] = c;
+        state_ = DATA;
+      } else if (c >= WILL) {
+        verb_ = c;
+        state_ = OPTION;
+      } else if (c == SB) {
+        subneg_.clear();
+        state_ = SUBNEG;
+      } else {
+        state_ = DATA; // NOP, GA and friends
+      }
+      break;
+    case OPTION:
+      handle_option(verb_, c);
+      state_ = DATA;
+      break;
+    case SUBNEG:
+      if (c == IAC) {
+        state_ = SUBNEG_IAC;
+      } else {
+        subneg_ += c;
+      }
+      break;
+    case SUBNEG_IAC:
+      if (c == SE) {
+        handle_subneg(out);
+        state_ = DATA;
+      } else {
+        subneg_ += c;
+        state_ = SUBNEG;
+      }
+      break;
+    }
+  }
+  flush();
+  if (out == 0) {
+    // only telnet commands
+    errno = EAGAIN;
+    return -1;
+  }
+  return out;
+}
+
+void Rfc2217Transport::handle_option(uint8_t verb, uint8_t option) {
+  // We offered and asked for everything we want in open(), so only
+  // refuse the rest.
+  bool wanted = option == OPT_BINARY || option == OPT_SGA ||
+                (option == OPT_COM_PORT && (verb == DO || verb == DONT));
+  if (verb == DO && !wanted) send_option(WONT, option);
+  if (verb == WILL && !wanted) send_option(DONT, option);
+  if (verb == DONT && option == OPT_COM_PORT) {
+    fprintf(stderr, "### %s does not support RFC 2217\n\r",
+            name_.c_str());
+  }
+}
+
+void Rfc2217Transport::handle_subneg(size_t pos) {
+  if (subneg_.size() < 2 || uint8_t(subneg_[0]) != OPT_COM_PORT) return;
+  uint8_t command = subneg_[1];
+  if (command == SERVER_OFFSET + NOTIFY_LINESTATE && subneg_.size() == 3 &&
+      (uint8_t(subneg_[2]) & LINESTATE_BREAK)) {
+    break_at_ = pos;
+  }
+  if (command == SERVER_OFFSET + SET_BAUDRATE && subneg_.size() == 6) {
+    unsigned baud = (uint8_t(subneg_[2]) << 24) | (uint8_t(subneg_[3]) << 16) |
+                    (uint8_t(subneg_[4]) << 8) | uint8_t(subneg_[5]);
+    if (baud != baud_) {
+      fprintf(stderr, "### %s runs at %u baud instead of %u\n\r",
+              name_.c_str(), baud, baud_);
+    }
+  }
+}
+
+bool Rfc2217Transport::baud_supported(unsigned) const {
+  // the server reports the rate it actually set
+  return true;
+}
+
+void Rfc2217Transport::set_baud(unsigned baud) {
+  // The server handles commands in order, after the data before them.
+  baud_ = baud;
+  uint8_t value[4] = {
+    uint8_t(baud >> 24), uint8_t(baud >> 16), uint8_t(baud >> 8),
+    uint8_t(baud),
+  };
+  com_port(SET_BAUDRATE, value, sizeof(value));
+  flush();
+}
+
+void Rfc2217Transport::set_break(bool on) {
+  com_port(SET_CONTROL, on ? CONTROL_BREAK_ON : CONTROL_BREAK_OFF);
+  flush();
+}
+
+void Rfc2217Transport::discard_output() {
+  // tx_ may end in the middle of a command, so it still has to go
+  // out. The purge behind it drops it again on the server.
+  com_port(PURGE_DATA, PURGE_TX);
+  flush();
+}
+
+void Rfc2217Transport::discard_input() {
+  com_port(PURGE_DATA, PURGE_RX);
+  flush();
+  TcpTransport::discard_input();
+}
@@ -0,0 +1,106 @@
+/* tcp_transport.h - serial ports behind terminal servers */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "transport.h"
+
+/* A raw TCP connection to a terminal server (e.g. ser2net "raw"). The
+ * serial port settings are fixed on the server, so only the default
+ * baud rate is supported and BREAKs can't be sent.
+ *
+ * Nagle is disabled and output_queued() reports nothing queued so the
+ * sender writes whole windows at once: the bottleneck is the remote
+ * serial port, not the socket.
+ */
+class TcpTransport : public Transport {
+public:
+  TcpTransport(const std::string& name, const std::string& host,
+               const std::string& port, bool flow_control);
+
+  bool open() override;
+  ssize_t read(char *buf, size_t len) override;
+  ssize_t write(const char *buf, size_t len) override;
+  ssize_t output_queued() override { return -1; }
+
+  bool baud_supported(unsigned baud) const override;
+  void set_baud(unsigned baud) override;
+  bool sends_break() const override { return false; }
+  void set_break(bool on) override;
+  void discard_output() override { }
+  void discard_input() override;
+
+protected:
+  // send() that treats a closed connection like a full one, the next
+  // read() reports it
+  ssize_t send_some(const char *buf, size_t len);
+
+  std::string host_;
+  std::string port_;
+};
+
+/* A telnet connection with the RFC 2217 com port option (e.g. ser2net
+ * "telnet"). Baud rate, flow control, BREAKs and purging of the server
+ * buffers are passed on to the remote serial port, BREAKs from the RPi
+ * come back as line state notifications. Data bytes 0xFF are
+ * escaped as IAC IAC, so writes are buffered in the transport.
+ */
+class Rfc2217Transport : public TcpTransport {
+public:
+  Rfc2217Transport(const std::string& name, const std::string& host,
+                   const std::string& port, bool flow_control)
+    : TcpTransport(name, host, port, flow_control) { }
+
+  bool open() override;
+  ssize_t read(char *buf, size_t len) override;
+  ssize_t write(const char *buf, size_t len) override;
+  bool write_pending() const override { return !tx_.empty(); }
+  void flush() override;
+  // if the server passes on line state notifications
+  bool reports_break() const override { return true; }
+
+  bool baud_supported(unsigned baud) const override;
+  void set_baud(unsigned baud) override;
+  bool sends_break() const override { return true; }
+  void set_break(bool on) override;
+  void discard_output() override;
+  void discard_input() override;
+
+private:
+  enum State { DATA, COMMAND, OPTION, SUBNEG, SUBNEG_IAC };
+
+  void send_option(uint8_t verb, uint8_t option);
+  // queue a com port subnegotiation
+  void com_port(uint8_t command, const uint8_t *value, size_t len);
+  void com_port(uint8_t command, uint8_t value) {
+    com_port(command, &value, 1);
+  }
+  void handle_option(uint8_t verb, uint8_t option);
+  // pos: data bytes before the command in this read()
+  void handle_subneg(size_t pos);
+
+  std::string tx_;
+  unsigned baud_ = 0;
+  State state_ = DATA;
+  uint8_t verb_ = 0;
+  std::string subneg_;
+};
@@ -0,0 +1,149 @@
+/* batch_test.cc - tests of Matcher and the batch scripts */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../batch.h"
+#include "../matcher.h"
+
+namespace {
+  int failures = 0;
+
+#define CHECK(cond)                                             \
+  do {                                                          \
+    if (!(cond)) {                                              \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, \
+              #cond);                                           \
+      ++failures;                                               \
+    }                                                           \
+  } while (0)
+
+  typedef std::vector<std::pair<size_t, uint64_t>> Matches;
+
+  Matches scan(Matcher& matcher, const std::string& text) {
+    Matches res;
+    matcher.scan(text.data(), text.size(), [&](size_t id, uint64_t end) {
+        res.push_back(std::make_pair(id, end));
+      });
+    return res;
+  }
+
+  void test_matcher() {
+    Matcher matcher;
+    size_t he = matcher.add("he");
+    size_t she = matcher.add("she");
+    size_t hers = matcher.add("hers");
+    matcher.build();
+
+    // overlapping matches, each with its end
+    Matches m = scan(matcher, "ushers");
+    CHECK(m.size() == 3);
+    CHECK(m[0] == std::make_pair(she, uint64_t(4)));
+    CHECK(m[1] == std::make_pair(he, uint64_t(4)));
+    CHECK(m[2] == std::make_pair(hers, uint64_t(6)));
+
+    // a match across two scans, the end counts all bytes
+    CHECK(scan(matcher, "s").empty());
+    m = scan(matcher, "he");
+    CHECK(m.size() == 2);
+    CHECK(m[0] == std::make_pair(she, uint64_t(9)));
+
+    // reset() forgets the partial match
+    CHECK(scan(matcher, "xs").empty());
+    matcher.reset();
+    m = scan(matcher, "h");
+    CHECK(m.empty());
+  }
+
+  // a batch run of script against the console output in chunks
+  struct Run {
+    Batch batch;
+    std::string sent;
+
+    Run(const std::string& script)
+      : batch(Batch::parse(script), 1,
+              [this](const std::string& text) { sent += text; }) {
+      batch.requested();
+      batch.started(true);
+    }
+
+    void output(const std::string& text) {
+      batch.scan(text.data(), text.size());
+    }
+  };
+
+  void test_batch() {
+    {
+      Run run("expect login: ; send root\\n; expect # ");
+      CHECK(run.sent.empty());
+      run.output("board login");
+      CHECK(run.sent.empty());
+      run.output(": ");
+      CHECK(run.sent == "root\n");
+      CHECK(!run.batch.finished());
+      run.output("# ");
+      CHECK(run.batch.finished());
+      CHECK(run.batch.exit_code() == 0);
+    }
+    {
+      // one "ab" is not also the "b" of the next step
+      Run run("expect ab; expect b");
+      run.output("ab");
+      CHECK(!run.batch.finished());
+      run.output("b");
+      CHECK(run.batch.finished());
+      CHECK(run.batch.exit_code() == 0);
+    }
+    {
+      // nor the same text twice
+      Run run("expect ok; expect ok");
+      run.output("ok");
+      CHECK(!run.batch.finished());
+      run.output(" ok");
+      CHECK(run.batch.finished());
+    }
+    {
+      // but both steps may be in one read
+      Run run("expect one; expect two");
+      run.output("one two");
+      CHECK(run.batch.finished());
+      CHECK(run.batch.exit_code() == 0);
+    }
+    {
+      Run run("fail panic; expect done");
+      run.output("kernel panic");
+      CHECK(run.batch.finished());
+      CHECK(run.batch.exit_code() == 1);
+    }
+  }
+}
+
+int main() {
+  test_matcher();
+  test_batch();
+  if (failures != 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
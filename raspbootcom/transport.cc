@@ -0,0 +1,294 @@
+/* transport.cc - byte streams to the RPi */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _DEFAULT_SOURCE             /* See feature_test_macros(7) */
+#define _XOPEN_SOURCE 600           /* posix_openpt() and friends */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+
+#include "transport.h"
+#include "tcp_transport.h"
+#include "serial.h"
+#include "unix_error.h"
+
+#include <stdexcept>
+
+namespace {
+  // A local serial port.
+  class TtyTransport : public Transport {
+  public:
+    TtyTransport(const std::string& name, bool flow_control)
+      : Transport(name, flow_control) { }
+
+    bool open() override {
+      fd_ = ::open(name_.c_str(),
+                   O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      if (fd_ == -1) {
+        // udev takes a while to change ownership
+        // so sometimes one gets EACCESS
+        if (errno == ENOENT || errno == ENODEV || errno == EACCES) {
+          return false;
+        }
+        throw UnixError("open " + name_);
+      }
+      // must be a tty
+      if (!isatty(fd_)) {
+        close();
+        throw UnixError(name_ + " is not a tty", ENOTTY);
+      }
+      serial_configure(fd_, flow_control_);
+      mark_ = 0;
+      return true;
+    }
+
+    bool hotplug() const override { return true; }
+
+    // Undo the PARMRK marking (see serial_configure()).
+    ssize_t read(char *buf, size_t len) override {
+      ssize_t res = Transport::read(buf, len);
+      if (res <= 0) return res;
+      size_t end = res;
+      size_t out = 0;
+      size_t i = 0;
+      while (i < end) {
+        if (mark_ == 0) {
+          // copy down up to the next mark
+          const char *ff = (const char*)memchr(&buf[i], '\377', end - i);
+          size_t n = ff ? ff - &buf[i] : end - i;
+          memmove(&buf[out], &buf[i], n);
+          out += n;
+          i += n;
+          if (ff) {
+            ++i;
+            mark_ = 1;
+          }
+          continue;
+        }
+        char c = buf[i++];
+        if (mark_ == 1 && c == 0) {
+          mark_ = 2;
+          continue;
+        }
+        if (mark_ == 2 && c == 0) {
+          break_at_ = out;
+        } else {
+          // \377 \377 or a damaged byte, the protocol has its CRCs
+          buf[out++] = c;
+        }
+        mark_ = 0;
+      }
+      if (out == 0) {
+        errno = EAGAIN;
+        return -1;
+      }
+      return out;
+    }
+
+    bool reports_break() const override { return true; }
+
+    bool baud_supported(unsigned baud) const override {
+      return serial_baud_supported(baud);
+    }
+
+    void set_baud(unsigned baud) override {
+      serial_set_baud(fd_, baud);
+    }
+
+    void set_break(bool on) override {
+      UnixError::check(on ? "start break" : "stop break",
+                       ioctl(fd_, on ? TIOCSBRK : TIOCCBRK));
+    }
+
+    void discard_output() override {
+      tcflush(fd_, TCOFLUSH);
+    }
+
+    void discard_input() override {
+      tcflush(fd_, TCIFLUSH);
+      mark_ = 0;
+    }
+
+  private:
+    // 1 after \377, 2 after \377 \0
+    int mark_ = 0;
+  };
+
+  // A new pty for an emulator to connect to. Baud rates mean nothing on
+  // a pty, so they are accepted and ignored. A BREAK can't be sent.
+  class PtyTransport : public Transport {
+  public:
+    PtyTransport(const std::string& link, bool flow_control)
+      : Transport("pty", flow_control), link_(link) { }
+
+    ~PtyTransport() {
+      close();
+    }
+
+    bool open() override {
+      fd_ = UnixError::check("open pty",
+                             posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK |
+                                          O_CLOEXEC));
+      UnixError::check("grantpt", grantpt(fd_), [this]() { close(); });
+      UnixError::check("unlockpt", unlockpt(fd_), [this]() { close(); });
+      name_ = ptsname(fd_);
+
+      struct termios termios;
+      UnixError::check("get attributes", tcgetattr(fd_, &termios));
+      cfmakeraw(&termios);
+      UnixError::check("set attributes",
+                       tcsetattr(fd_, TCSANOW, &termios));
+
+      // Keep the slave open ourselves, otherwise the master reports
+      // EIO (and POLLHUP) whenever the emulator isn't connected.
+      slave_fd_ = UnixError::check("open " + name_,
+                                   ::open(name_.c_str(),
+                                          O_RDWR | O_NOCTTY | O_CLOEXEC));
+
+      if (!link_.empty()) {
+        // only replace a symlink, e.g. one left by a crash
+        struct stat st;
+        if (lstat(link_.c_str(), &st) == 0) {
+          if (!S_ISLNK(st.st_mode)) {
+            close();
+            throw UnixError(link_ + " is not a symlink", EEXIST);
+          }
+          unlink(link_.c_str());
+        }
+        UnixError::check("symlink " + link_,
+                         symlink(name_.c_str(), link_.c_str()));
+        fprintf(stderr, "### %s -> %s\n\r", link_.c_str(), name_.c_str());
+      }
+      return true;
+    }
+
+    void close() override {
+      if (slave_fd_ != -1) {
+        ::close(slave_fd_);
+        slave_fd_ = -1;
+      }
+      if (fd_ != -1 && !link_.empty()) {
+        // only our own link, something else may have replaced it
+        char target[256];
+        ssize_t len = readlink(link_.c_str(), target, sizeof(target));
+        if (len == ssize_t(name_.size()) &&
+            name_.compare(0, len, target, len) == 0) {
+          unlink(link_.c_str());
+        }
+      }
+      Transport::close();
+    }
+
+    bool baud_supported(unsigned) const override { return true; }
+    void set_baud(unsigned) override { }
+    bool sends_break() const override { return false; }
+
+    void set_break(bool) override {
+      throw UnixError(name_ + ": can't send a BREAK", EOPNOTSUPP);
+    }
+
+    void discard_output() override {
+      tcflush(fd_, TCOFLUSH);
+    }
+
+    void discard_input() override {
+      tcflush(fd_, TCIFLUSH);
+    }
+
+  private:
+    std::string link_;
+    int slave_fd_ = -1;
+  };
+
+  // split "HOST:PORT" (or "[V6ADDR]:PORT")
+  void split_host_port(const std::string& spec, const std::string& addr,
+                       std::string *host, std::string *port) {
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos || colon == 0 ||
+        colon + 1 == addr.size()) {
+      throw std::invalid_argument(spec + ": expected HOST:PORT");
+    }
+    *host = addr.substr(0, colon);
+    *port = addr.substr(colon + 1);
+    if (host->size() > 2 && (*host)[0] == '[' &&
+        (*host)[host->size() - 1] == ']') {
+      *host = host->substr(1, host->size() - 2);
+    }
+  }
+}
+
+std::unique_ptr<Transport> Transport::create(const std::string& spec,
+                                             bool flow_control) {
+  std::string host, port;
+  if (spec.compare(0, 6, "tcp://") == 0) {
+    split_host_port(spec, spec.substr(6), &host, &port);
+    return std::unique_ptr<Transport>(
+             new TcpTransport(spec, host, port, flow_control));
+  }
+  if (spec.compare(0, 10, "rfc2217://") == 0) {
+    split_host_port(spec, spec.substr(10), &host, &port);
+    return std::unique_ptr<Transport>(
+             new Rfc2217Transport(spec, host, port, flow_control));
+  }
+  if (spec == "pty") {
+    return std::unique_ptr<Transport>(new PtyTransport("", flow_control));
+  }
+  if (spec.compare(0, 4, "pty:") == 0) {
+    return std::unique_ptr<Transport>(
+             new PtyTransport(spec.substr(4), flow_control));
+  }
+  return std::unique_ptr<Transport>(new TtyTransport(spec, flow_control));
+}
+
+Transport::~Transport() {
+  if (fd_ != -1) ::close(fd_);
+}
+
+void Transport::close() {
+  if (fd_ != -1) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+ssize_t Transport::read(char *buf, size_t len) {
+  break_at_ = -1;
+  ssize_t res = ::read(fd_, buf, len);
+  if (res == -1 && errno == EIO) {
+    // USB serial converter unplugged
+    return 0;
+  }
+  return UnixError::check_again("read from " + name_, res);
+}
+
+ssize_t Transport::write(const char *buf, size_t len) {
+  return UnixError::check_again("write to " + name_,
+                                ::write(fd_, buf, len));
+}
+
+ssize_t Transport::output_queued() {
+  int queued = 0;
+  if (ioctl(fd_, TIOCOUTQ, &queued) == -1) return -1;
+  return queued;
+}
@@ -0,0 +1,90 @@
+/* transport.h - byte streams to the RPi */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+/* The connection to the serial port of the RPi. Raspbootcom talks to
+ *
+ *   /dev/ttyUSB0          a local tty (anything not matching below)
+ *   pty[:LINK]            a new pty, for emulators; the slave name is
+ *                         printed and optionally symlinked to LINK
+ *   tcp://HOST:PORT       a raw TCP port of a terminal server
+ *   rfc2217://HOST:PORT   a telnet port with RFC 2217 com port control
+ *
+ * A transport can be opened and closed repeatedly, e.g. when a USB
+ * serial converter is unplugged or a connection drops. fd() is only
+ * meant for poll(), all I/O goes through read() and write().
+ */
+class Transport {
+public:
+  static std::unique_ptr<Transport> create(const std::string& spec,
+                                           bool flow_control);
+  virtual ~Transport();
+
+  const std::string& name() const { return name_; }
+  int fd() const { return fd_; }
+
+  // Open the connection. Returns false if it is not available (yet),
+  // throws on real errors.
+  virtual bool open() = 0;
+  virtual void close();
+  // Can the device come back with a uevent?
+  virtual bool hotplug() const { return false; }
+
+  // Returns the number of bytes read, 0 when the connection is gone
+  // and -1 when there is nothing to read right now.
+  virtual ssize_t read(char *buf, size_t len);
+  // Can read() see BREAKs from the loader?
+  virtual bool reports_break() const { return false; }
+  // The number of bytes the last read() returned before a BREAK, -1 if
+  // it saw none. Also valid when read() returned -1.
+  ssize_t break_at() const { return break_at_; }
+  // Returns the number of bytes written or -1 when the connection
+  // can't take more right now.
+  virtual ssize_t write(const char *buf, size_t len);
+  // Data buffered in the transport, wait for POLLOUT and call flush().
+  virtual bool write_pending() const { return false; }
+  virtual void flush() { }
+  // Bytes written but not yet sent, -1 if unknown.
+  virtual ssize_t output_queued();
+
+  virtual bool baud_supported(unsigned baud) const = 0;
+  // Change the baud rate once pending output has been sent.
+  virtual void set_baud(unsigned baud) = 0;
+  // Can set_break() send BREAKs to the loader?
+  virtual bool sends_break() const { return true; }
+  virtual void set_break(bool on) = 0;
+  // Throw away data not yet sent or not yet read.
+  virtual void discard_output() = 0;
+  virtual void discard_input() = 0;
+
+protected:
+  Transport(const std::string& name, bool flow_control)
+    : name_(name), flow_control_(flow_control) { }
+
+  std::string name_;
+  bool flow_control_;
+  int fd_ = -1;
+  ssize_t break_at_ = -1;
+};
@@ -0,0 +1,73 @@
+/* unix_error.h - exceptions for failed system calls */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include <exception>
+#include <string>
+#include <system_error>
+
+struct UnixError : public std::system_error::system_error {
+  UnixError(const std::string& what_arg)
+    : std::system_error::system_error(errno, std::generic_category(), what_arg) { }
+  UnixError(const std::string& what_arg, int err_)
+    : std::system_error::system_error(err_, std::generic_category(), what_arg) { }
+
+  template<typename CB>
+  static void maybe_raise(const std::string& what_arg, CB on_error) {
+    if (std::uncaught_exceptions() > 0) {
+      // throwing an exception while unwinding would terminate
+      perror(what_arg.c_str());
+      on_error();
+    } else {
+      int err = errno;
+      on_error();
+      throw UnixError(what_arg, err);
+    }
+  }
+
+  static void maybe_raise(const std::string& what_arg) {
+    maybe_raise(what_arg, [](){});
+  }
+
+  template<typename CB>
+  static ssize_t check(const std::string& what_arg, ssize_t res, CB on_error) {
+    // fprintf(stderr, "+++ %s\n\r", what_arg.c_str());
+    if (res == -1) {
+      maybe_raise(what_arg, on_error);
+    }
+    return res;
+  }
+
+  static ssize_t check(const std::string& what_arg, ssize_t res) {
+    return check(what_arg, res, [](){});
+  }
+
+  // like check() but EAGAIN and EINTR are not errors, they return -1
+  static ssize_t check_again(const std::string& what_arg, ssize_t res) {
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                      errno == EINTR)) {
+      return -1;
+    }
+    return check(what_arg, res);
+  }
+};
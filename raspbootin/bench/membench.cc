@@ -0,0 +1,123 @@
+/* membench.cc - throughput benchmark for memcpy/memset */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Build with "make bench" and run with "make qemu-bench". This replaces
+ * main.cc and runs on the qemu raspi2b machine (or a real RPi 2).
+ */
+
+#include <stdint.h>
+#include <archinfo.h>
+#include <timer.h>
+#include <uart.h>
+#include <kprintf.h>
+#include <string.h>
+
+extern "C" {
+    void kernel_main(uint32_t r0, uint32_t r1, const Header *atags);
+}
+
+#ifndef RASPBOOTIN_BOARD
+static constexpr ArchInfo bench_arch_info("qemu raspi2b", 0x3F000000, 47, 0,
+					  true, 0xC0000000);
+const ArchInfo *arch_info = &bench_arch_info;
+#endif
+
+enum {
+    // total bytes moved per measurement
+    BENCH_BYTES = 64 << 20,
+    BUF_SIZE = 1 << 20,
+};
+
+typedef void *(*copy_fn)(void *dst, const void *src, size_t n);
+typedef void *(*fill_fn)(void *dst, int c, size_t n);
+
+// work buffers, away from the loader and the low memory
+static uint8_t * const src_buf = (uint8_t*)0x01000000;
+static uint8_t * const dst_buf = (uint8_t*)0x01200000;
+
+static const size_t sizes[] = { 16, 256, 4096, 65536, BUF_SIZE };
+
+static void report(const char *name, size_t size, int misalign,
+		   uint32_t usecs) {
+    // bytes per usec == MB/s
+    uint32_t rate = usecs ? BENCH_BYTES / usecs : 0;
+    kprintf("%-14s %8u bytes  +%d  %6lu us  %5lu MB/s\n", name,
+	    (unsigned)size, misalign, usecs, rate);
+}
+
+static void bench_copy(const char *name, copy_fn fn, size_t size,
+		       int misalign) {
+    uint32_t rounds = BENCH_BYTES / size;
+    uint32_t start = Timer::now();
+    for(uint32_t i = 0; i < rounds; ++i) {
+	fn(dst_buf, src_buf + misalign, size);
+    }
+    report(name, size, misalign, Timer::now() - start);
+}
+
+static void bench_fill(const char *name, fill_fn fn, size_t size,
+		       int misalign) {
+    uint32_t rounds = BENCH_BYTES / size;
+    uint32_t start = Timer::now();
+    for(uint32_t i = 0; i < rounds; ++i) {
+	fn(dst_buf + misalign, 0x55, size);
+    }
+    report(name, size, misalign, Timer::now() - start);
+}
+
+// check a variant against a byte loop before timing it
+static bool verify(copy_fn fn) {
+    for(int misalign = 0; misalign < 4; ++misalign) {
+	for(size_t size = 0; size < 300; size += 7) {
+	    for(size_t i = 0; i < size + 8; ++i) {
+		src_buf[i] = i * 7 + 1;
+		dst_buf[i] = 0;
+	    }
+	    fn(dst_buf + 1, src_buf + misalign, size);
+	    for(size_t i = 0; i < size; ++i) {
+		if (dst_buf[i + 1] != src_buf[i + misalign]) return false;
+	    }
+	    if (dst_buf[0] != 0 || dst_buf[size + 1] != 0) return false;
+	}
+    }
+    return true;
+}
+
+void kernel_main(uint32_t, uint32_t, const Header *) {
+    UART::init(false);
+    mem_init();
+
+    kprintf("\r\nmemory benchmark, %u MB per measurement\n",
+	    BENCH_BYTES >> 20);
+
+    kprintf("verify memcpy_armv6: %s\n",
+	    verify(memcpy_armv6) ? "ok" : "FAILED");
+    kprintf("verify memcpy_neon: %s\n",
+	    verify(memcpy_neon) ? "ok" : "FAILED");
+
+    for(size_t size : sizes) {
+	for(int misalign = 0; misalign < 4; misalign += 3) {
+	    bench_copy("memcpy_armv6", memcpy_armv6, size, misalign);
+	    bench_copy("memcpy_neon", memcpy_neon, size, misalign);
+	}
+	bench_fill("memset_armv6", memset_armv6, size, 0);
+	bench_fill("memset_neon", memset_neon, size, 0);
+    }
+
+    kprintf("done\n");
+}
@@ -0,0 +1,117 @@
+/* channel.cc - byte streams to the host besides the console */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <channel.h>
+#include <protocol.h>
+#include <uart.h>
+
+namespace Channel {
+    using namespace Protocol;
+
+    enum {
+	// the host answers CH_READ right away, give up on it after this
+	REPLY_USECS = 1000000,
+    };
+
+    /*
+     * Mask IRQs and FIQs so the kernel's interrupt handlers and the
+     * profiler can't write into the middle of a frame.
+     *
+     * Returns:
+     * uint32_t: the CPSR to restore with unmask()
+     */
+    static uint32_t mask(void) {
+	uint32_t cpsr;
+	asm volatile("mrs %[cpsr], cpsr; cpsid if"
+		     : [cpsr]"=r"(cpsr) : : "memory");
+	return cpsr;
+    }
+
+    static void unmask(uint32_t cpsr) {
+	asm volatile("msr cpsr_c, %[cpsr]" : : [cpsr]"r"(cpsr) : "memory");
+    }
+
+    /*
+     * Send a frame header, the caller sends the rest of the payload.
+     * uint8_t op: ChannelOp
+     * unsigned channel: channel number
+     * uint16_t len: length of the payload after op and channel
+     */
+    static void start_frame(uint8_t op, unsigned channel, uint16_t len) {
+	uint8_t buf[2];
+	put_u16(buf, 2 + len);
+	UART::putc(ESCAPE);
+	UART::putc(ESCAPE);
+	UART::putc(FRAME_CHANNEL);
+	UART::putc(buf[0]);
+	UART::putc(buf[1]);
+	UART::putc(op);
+	UART::putc(channel);
+    }
+
+    int write(unsigned channel, const void *buf, size_t len) {
+	if (channel >= CHANNEL_MAX) return -1;
+	const uint8_t *p = (const uint8_t*)buf;
+	size_t left = len;
+	while(left > 0) {
+	    // short frames so a long write doesn't hold up the console
+	    uint16_t count = CHANNEL_FRAME_MAX;
+	    if (left < count) count = left;
+	    // the FIFO takes the first bytes without waiting
+	    UART::flush();
+	    uint32_t cpsr = mask();
+	    start_frame(CH_WRITE, channel, count);
+	    for(uint16_t i = 0; i < count; ++i) {
+		UART::putc(p[i]);
+	    }
+	    unmask(cpsr);
+	    p += count;
+	    left -= count;
+	}
+	return len;
+    }
+
+    int read(unsigned channel, void *buf, size_t len) {
+	if (channel >= CHANNEL_MAX) return -1;
+	uint16_t max = len < 0xFFFF ? len : 0xFFFF;
+	uint8_t arg[2];
+	put_u16(arg, max);
+	uint32_t cpsr = mask();
+	start_frame(CH_READ, channel, sizeof(arg));
+	UART::putc(arg[0]);
+	UART::putc(arg[1]);
+	unmask(cpsr);
+	// console input in front of the reply is kept for the kernel
+	if (!UART::wait_reply(CHANNEL_REPLY, REPLY_USECS)) return -1;
+	uint8_t header[2];
+	for(uint32_t i = 0; i < sizeof(header); ++i) {
+	    uint32_t data;
+	    if (!UART::getc_timeout(data, REPLY_USECS)) return -1;
+	    header[i] = data;
+	}
+	uint16_t count = get_u16(header);
+	uint8_t *p = (uint8_t*)buf;
+	for(uint16_t i = 0; i < count; ++i) {
+	    uint32_t data;
+	    if (!UART::getc_timeout(data, REPLY_USECS)) return -1;
+	    if (i < max) p[i] = data;
+	}
+	return count < max ? count : max;
+    }
+}
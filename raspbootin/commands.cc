@@ -0,0 +1,696 @@
+/* commands.cc - host commands received over the UART */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <crc32.h>
+#include <digest.h>
+#include <gdbstub.h>
+#include <lz.h>
+#include <profiler.h>
+#include <protocol.h>
+#include <rs.h>
+#include <timer.h>
+#include <uart.h>
+#include <watchdog.h>
+#include <commands.h>
+
+extern "C" {
+    // from the linker script
+    extern uint8_t _start[];
+    extern uint8_t _end[];
+}
+
+namespace Commands {
+    using namespace Protocol;
+
+    enum {
+	// time the host gets to switch its baud rate after our reply
+	BAUD_SWITCH_DELAY = 10000,
+	// A packet must start this soon after the previous one or the
+	// boot request, else the host is gone.
+	HOST_TIMEOUT = 5000000,
+	// longest pause within a packet
+	BYTE_TIMEOUT = 500000,
+	// the watchdog resets the board if a command hangs
+	WATCHDOG_MSECS = 10000,
+	// CMD_RESUME tracks the kernel in at most this many blocks of
+	// at least 1 << RESUME_MIN_SHIFT bytes
+	RESUME_MAX_BLOCKS = 4096,
+	RESUME_MIN_SHIFT = 12,
+    };
+
+    // payload of the current packet
+    static uint8_t payload[MAX_PAYLOAD] __attribute__((aligned(4)));
+
+    // reply to CMD_DUMP (and CMD_VERIFY) and the compressor's hash table
+    static uint8_t dump_buf[1 + LZ::bound(DUMP_MAX)];
+    static uint32_t lz_table[LZ::HASH_SIZE];
+
+    enum Received {
+	PACKET,
+	// a BREAK or a pause aborted the packet
+	ABORTED,
+	// no packet in HOST_TIMEOUT
+	HOST_GONE,
+    };
+
+    // watchdog timeout for the kernel, 0 is off
+    static uint32_t handoff_msecs;
+
+    // Progress of the kernel being loaded, kept across boot requests so
+    // a host that comes back can resume it (CMD_RESUME).
+    static struct {
+	bool valid;
+	uint32_t id;
+	uint32_t size;
+	// log2 of the block size
+	uint32_t shift;
+	// bytes received without errors in a row from the start of each
+	// block, the block is complete when they cover it
+	uint32_t filled[RESUME_MAX_BLOCKS];
+    } progress;
+
+    // the last CMD_BLOCK_FEC, see receive_fec()
+    static RS::Decoder decoder;
+    static bool fec_valid;
+    static uint32_t fec_len;
+    static uint32_t fec_corrected;
+    static uint32_t fec_failed;
+
+    /*
+     * Check that a range may be written to.
+     * uint32_t addr: start of the range
+     * uint32_t len: length of the range
+     *
+     * Returns:
+     * bool: false if the range wraps around or overlaps the loader.
+     */
+    static bool writable(uint32_t addr, uint32_t len) {
+	if (len > 0xFFFFFFFF - addr) return false;
+	return addr + len <= (uint32_t)_start || addr >= (uint32_t)_end;
+    }
+
+    /*
+     * Receive one byte of a packet.
+     * uint8_t &byte: byte received
+     *
+     * Returns:
+     * bool: false if a BREAK aborted the packet or the byte didn't
+     *       arrive within BYTE_TIMEOUT.
+     */
+    static bool receive(uint8_t &byte) {
+	uint32_t data;
+	if (!UART::getc_timeout(data, BYTE_TIMEOUT)) return false;
+	byte = data;
+	return !(data & UART::DR_BE);
+    }
+
+    /*
+     * Receive the payload of a CMD_BLOCK_FEC. The data bytes of the
+     * codewords go to payload behind the header and are corrected as
+     * soon as their codeword is complete, the parity is only fed to the
+     * decoder. A header with a wrong CRC-32 or rx errors makes the
+     * packet invalid, nothing in it can be trusted then.
+     * uint16_t len: payload length
+     *
+     * Returns:
+     * bool: false if the packet was aborted.
+     */
+    static bool receive_fec(uint16_t len) {
+	fec_valid = len > FEC_HEADER_SIZE && len <= MAX_PAYLOAD;
+	fec_len = 0;
+	fec_corrected = 0;
+	fec_failed = 0;
+	uint32_t i = 0;
+	while(fec_valid && i < FEC_HEADER_SIZE) {
+	    if (!receive(payload[i++])) return false;
+	}
+	uint32_t parity = payload[4];
+	if (parity == 0 || parity > RS::PARITY_MAX) fec_valid = false;
+	// the codewords don't cover the header, a damaged offset would put
+	// the block in the wrong place
+	if (UART::peek_rx_errors() != 0 ||
+	    CRC32::update(0, payload, 5) != get_u32(payload + 5)) {
+	    fec_valid = false;
+	}
+
+	while(i < len) {
+	    uint32_t n = len - i;
+	    if (n > RS::CODEWORD_MAX) n = RS::CODEWORD_MAX;
+	    // every codeword needs at least one data byte
+	    if (n <= parity) fec_valid = false;
+	    if (!fec_valid) {
+		// keep receiving, the packet gets a NAK
+		uint8_t byte;
+		if (!receive(byte)) return false;
+		++i;
+		continue;
+	    }
+	    uint32_t count = n - parity;
+	    uint8_t *data = payload + FEC_HEADER_SIZE + fec_len;
+	    decoder.start(parity);
+	    for(uint32_t j = 0; j < n; ++j) {
+		uint8_t byte;
+		if (!receive(byte)) return false;
+		decoder.feed(byte);
+		if (j < count) data[j] = byte;
+	    }
+	    int res = decoder.correct(data, count);
+	    if (res < 0) {
+		++fec_failed;
+	    } else {
+		fec_corrected += res;
+	    }
+	    fec_len += count;
+	    i += n;
+	}
+	return true;
+    }
+
+    /*
+     * Receive one packet into payload.
+     * uint8_t &cmd: the command
+     * uint16_t &len: payload length
+     *
+     * Returns:
+     * Received: PACKET, ABORTED or HOST_GONE
+     */
+    static Received receive_packet(uint8_t &cmd, uint16_t &len) {
+	uint8_t header[HEADER_SIZE];
+	// errors before the packet started don't count
+	UART::rx_errors();
+	uint32_t data;
+	if (!UART::getc_timeout(data, HOST_TIMEOUT)) return HOST_GONE;
+	if (data & UART::DR_BE) return ABORTED;
+	header[0] = data;
+	for(int i = 1; i < HEADER_SIZE; ++i) {
+	    if (!receive(header[i])) return ABORTED;
+	}
+	cmd = header[0];
+	len = get_u16(&header[1]);
+	if (cmd == CMD_BLOCK_FEC) return receive_fec(len) ? PACKET : ABORTED;
+	// keep receiving an oversized payload, but drop what doesn't fit
+	for(uint32_t i = 0; i < len; ++i) {
+	    uint8_t byte;
+	    if (!receive(byte)) return ABORTED;
+	    if (i < MAX_PAYLOAD) payload[i] = byte;
+	}
+	return PACKET;
+    }
+
+    /*
+     * Send a reply with the receive errors of the packet.
+     * Status status: ACK or NAK
+     * const uint8_t *data: payload
+     * uint16_t len: payload length
+     */
+    static void reply(Status status, const uint8_t *data = 0,
+		      uint16_t len = 0) {
+	uint8_t header[REPLY_HEADER_SIZE];
+	header[0] = status;
+	header[1] = UART::rx_errors();
+	put_u16(&header[2], len);
+	for(int i = 0; i < REPLY_HEADER_SIZE; ++i) {
+	    UART::putc(header[i]);
+	}
+	for(uint16_t i = 0; i < len; ++i) {
+	    UART::putc(data[i]);
+	}
+    }
+
+    /*
+     * Copy a block into the kernel being loaded.
+     * uint32_t size: size of the kernel
+     * uint32_t offset: offset of the block in the kernel
+     * const uint8_t *data: the block
+     * uint32_t count: length of the block
+     *
+     * Returns:
+     * bool: false if the block doesn't fit into the kernel.
+     */
+    static bool store_block(uint32_t size, uint32_t offset,
+			    const uint8_t *data, uint32_t count) {
+	if (offset > size || count > size - offset) return false;
+	memcpy((uint8_t*)KERNEL_ADDR + offset, data, count);
+	return true;
+    }
+
+    /*
+     * Start tracking a new kernel.
+     * uint32_t id: the host's ID for the kernel
+     * uint32_t size: size of the kernel
+     */
+    static void progress_start(uint32_t id, uint32_t size) {
+	progress.valid = true;
+	progress.id = id;
+	progress.size = size;
+	progress.shift = RESUME_MIN_SHIFT;
+	while(progress.shift < 31 &&
+	      ((size - 1) >> progress.shift) >= RESUME_MAX_BLOCKS) {
+	    ++progress.shift;
+	}
+	memset(progress.filled, 0, sizeof(progress.filled));
+    }
+
+    /*
+     * Record a block of the kernel that was received without errors.
+     * Only what continues the bytes a block already has counts, data
+     * behind a gap has to be sent again on resume.
+     * uint32_t offset: offset of the data in the kernel
+     * uint32_t count: length of the data
+     */
+    static void progress_add(uint32_t offset, uint32_t count) {
+	if (!progress.valid) return;
+	uint32_t end = offset + count;
+	for(uint32_t i = offset >> progress.shift;
+	    i < RESUME_MAX_BLOCKS && (i << progress.shift) < end; ++i) {
+	    uint32_t start = i << progress.shift;
+	    if (offset > start + progress.filled[i]) continue;
+	    uint32_t block_end = start + (1 << progress.shift);
+	    uint32_t n = (end < block_end ? end : block_end) - start;
+	    if (n > progress.filled[i]) progress.filled[i] = n;
+	}
+    }
+
+    /*
+     * Forget the blocks of the kernel that overlap a changed range.
+     * uint32_t offset: offset of the range in the kernel
+     * uint32_t count: length of the range
+     */
+    static void progress_forget(uint32_t offset, uint32_t count) {
+	if (!progress.valid || count == 0 || offset >= progress.size) return;
+	uint32_t last = (offset + count - 1) >> progress.shift;
+	for(uint32_t i = offset >> progress.shift;
+	    i <= last && i < RESUME_MAX_BLOCKS; ++i) {
+	    progress.filled[i] = 0;
+	}
+    }
+
+    /*
+     * Forget the blocks of the kernel that a memory write changes.
+     * uint32_t addr: start of the write
+     * uint32_t len: length of the write
+     */
+    static void progress_written(uint32_t addr, uint32_t len) {
+	uint32_t end = addr + len;
+	if (end <= KERNEL_ADDR) return;
+	if (addr < KERNEL_ADDR) addr = KERNEL_ADDR;
+	progress_forget(addr - KERNEL_ADDR, end - addr);
+    }
+
+    /*
+     * Fill in the bitmap of complete blocks for the reply to CMD_RESUME.
+     * uint8_t *buf: u32 block size, bitmap (bit i of byte i / 8)
+     *
+     * Returns:
+     * uint32_t: length of the reply
+     */
+    static uint32_t progress_report(uint8_t *buf) {
+	uint32_t block = 1 << progress.shift;
+	uint32_t blocks = (progress.size + block - 1) >> progress.shift;
+	put_u32(buf, block);
+	uint8_t *bitmap = buf + 4;
+	memset(bitmap, 0, (blocks + 7) / 8);
+	for(uint32_t i = 0; i < blocks; ++i) {
+	    uint32_t start = i << progress.shift;
+	    uint32_t want = progress.size - start < block ?
+		progress.size - start : block;
+	    if (progress.filled[i] >= want) bitmap[i / 8] |= 1 << (i % 8);
+	}
+	return 4 + (blocks + 7) / 8;
+    }
+
+    /*
+     * Hand over to the kernel after the reply to CMD_BOOT or CMD_GO.
+     * uint32_t addr: where the kernel starts
+     * uint32_t &entry: set to addr
+     *
+     * Returns:
+     * bool: true
+     */
+    static bool start(uint32_t addr, uint32_t &entry) {
+	// The kernel expects the default baud rate, give the host time to
+	// switch back too.
+	UART::set_baud(DEFAULT_BAUD);
+	Timer::delay(BAUD_SWITCH_DELAY);
+	// the kernel changes its own memory
+	progress.valid = false;
+	if (handoff_msecs != 0) {
+	    Watchdog::start(handoff_msecs);
+	} else {
+	    Watchdog::stop();
+	}
+	entry = addr;
+	return true;
+    }
+
+    bool run(uint32_t max_size, uint32_t &entry) {
+	uint32_t size = 0;
+	bool loaded = false;
+	// the size follows with CMD_SIZE, blocks may go up to max_size
+	bool streaming = false;
+	handoff_msecs = 0;
+
+	while(true) {
+	    uint8_t cmd;
+	    uint16_t len;
+	    Received res = receive_packet(cmd, len);
+	    if (res == HOST_GONE) {
+		// nobody is talking to us, ask for a kernel again
+		Watchdog::stop();
+		UART::set_baud(DEFAULT_BAUD);
+		return false;
+	    }
+	    if (res == ABORTED) {
+		// BREAK or pause: the host lost track, fall back to the
+		// default baud rate and wait for it to resynchronize.
+		UART::set_baud(DEFAULT_BAUD);
+		continue;
+	    }
+	    // A command that hangs (e.g. on CTS) resets the board, so do
+	    // kernels with the loader's memory trashed by a CMD_GO.
+	    Watchdog::start(WATCHDOG_MSECS);
+	    if (len > MAX_PAYLOAD) {
+		reply(NAK);
+		continue;
+	    }
+
+	    switch(cmd) {
+	    case CMD_LOAD:
+		if (len != 4 && len != 0) {
+		    reply(NAK);
+		    break;
+		}
+		streaming = len == 0;
+		size = streaming ? max_size : get_u32(payload);
+		loaded = size <= max_size;
+		// without an ID it can't be resumed
+		progress.valid = false;
+		reply(loaded ? ACK : NAK);
+		break;
+	    case CMD_SIZE:
+		// again after a lost reply is fine
+		if (len != 4 || !loaded || get_u32(payload) > max_size ||
+		    (!streaming && get_u32(payload) != size)) {
+		    reply(NAK);
+		    break;
+		}
+		size = get_u32(payload);
+		streaming = false;
+		reply(ACK);
+		break;
+	    case CMD_RESUME: {
+		if (len != 8 || get_u32(payload) > max_size) {
+		    reply(NAK);
+		    break;
+		}
+		size = get_u32(payload);
+		streaming = false;
+		uint32_t id = get_u32(payload + 4);
+		if (!progress.valid || progress.id != id ||
+		    progress.size != size) {
+		    progress_start(id, size);
+		}
+		loaded = true;
+		reply(ACK, dump_buf, progress_report(dump_buf));
+		break;
+	    }
+	    case CMD_BLOCK: {
+		if (len < 4 || !loaded) {
+		    reply(NAK);
+		    break;
+		}
+		if (!store_block(size, get_u32(payload), payload + 4, len - 4)) {
+		    reply(NAK);
+		    break;
+		}
+		if (UART::peek_rx_errors() == 0) {
+		    progress_add(get_u32(payload), len - 4);
+		}
+		reply(ACK);
+		break;
+	    }
+	    case CMD_BLOCK_FEC: {
+		if (!fec_valid || !loaded) {
+		    reply(NAK);
+		    break;
+		}
+		if (fec_failed > 0) {
+		    // too damaged, the host sends it again
+		    uint8_t failed = fec_failed < 255 ? fec_failed : 255;
+		    reply(NAK, &failed, 1);
+		    break;
+		}
+		if (!store_block(size, get_u32(payload),
+				 payload + FEC_HEADER_SIZE, fec_len)) {
+		    reply(NAK);
+		    break;
+		}
+		// the codewords are fine unless bytes got lost
+		if (!(UART::peek_rx_errors() & (RX_OE | RX_BE))) {
+		    progress_add(get_u32(payload), fec_len);
+		}
+		uint8_t corrected[2];
+		put_u16(corrected, fec_corrected);
+		reply(ACK, corrected, sizeof(corrected));
+		break;
+	    }
+	    case CMD_BAUD: {
+		if (len != 4) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t baud = get_u32(payload);
+		if (baud == 0 || baud > UART::max_baud()) {
+		    reply(NAK);
+		    break;
+		}
+		reply(ACK);
+		UART::set_baud(baud);
+		break;
+	    }
+	    case CMD_PING:
+		reply(ACK, payload, len);
+		break;
+	    case CMD_FEATURES: {
+		if (len != 0) {
+		    reply(NAK);
+		    break;
+		}
+		uint8_t features[4];
+		put_u32(features, FEATURE_VERIFY | FEATURE_FEC);
+		reply(ACK, features, sizeof(features));
+		break;
+	    }
+	    case CMD_BOOT:
+		if (!loaded || streaming) {
+		    reply(NAK);
+		    break;
+		}
+		reply(ACK);
+		return start(KERNEL_ADDR, entry);
+	    case CMD_PEEK: {
+		if (len != 8) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		uint32_t count = get_u32(payload + 4);
+		if ((addr & 3) || count > PEEK_MAX) {
+		    reply(NAK);
+		    break;
+		}
+		// word accesses, so peripheral registers can be read too
+		for(uint32_t i = 0; i < count; ++i) {
+		    volatile uint32_t *p = (volatile uint32_t*)addr;
+		    put_u32(payload + 4 * i, p[i]);
+		}
+		reply(ACK, payload, 4 * count);
+		break;
+	    }
+	    case CMD_POKE: {
+		if (len < 4 || (len & 3)) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		uint32_t count = len / 4 - 1;
+		if ((addr & 3) || !writable(addr, 4 * count)) {
+		    reply(NAK);
+		    break;
+		}
+		for(uint32_t i = 0; i < count; ++i) {
+		    volatile uint32_t *p = (volatile uint32_t*)addr;
+		    p[i] = get_u32(payload + 4 + 4 * i);
+		}
+		progress_written(addr, 4 * count);
+		reply(ACK);
+		break;
+	    }
+	    case CMD_WRITE: {
+		if (len < 4) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		uint32_t count = len - 4;
+		if (!writable(addr, count)) {
+		    reply(NAK);
+		    break;
+		}
+		memcpy((void*)addr, payload + 4, count);
+		progress_written(addr, count);
+		reply(ACK);
+		break;
+	    }
+	    case CMD_DUMP: {
+		if (len != 8) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		uint32_t count = get_u32(payload + 4);
+		if (count > DUMP_MAX || count > 0xFFFFFFFF - addr) {
+		    reply(NAK);
+		    break;
+		}
+		const uint8_t *src = (const uint8_t*)addr;
+		size_t packed = LZ::compress(src, count, dump_buf + 1, lz_table);
+		if (packed < count) {
+		    dump_buf[0] = DUMP_LZ;
+		} else {
+		    // incompressible, send it as is
+		    dump_buf[0] = DUMP_RAW;
+		    memcpy(dump_buf + 1, src, count);
+		    packed = count;
+		}
+		reply(ACK, dump_buf, 1 + packed);
+		break;
+	    }
+	    case CMD_FILL: {
+		if (len != 9) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		uint32_t count = get_u32(payload + 4);
+		if (!writable(addr, count)) {
+		    reply(NAK);
+		    break;
+		}
+		memset((void*)addr, payload[8], count);
+		progress_written(addr, count);
+		reply(ACK);
+		break;
+	    }
+	    case CMD_CRC: {
+		if (len != 8) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		uint32_t count = get_u32(payload + 4);
+		if (count > 0xFFFFFFFF - addr) {
+		    reply(NAK);
+		    break;
+		}
+		uint8_t crc[4];
+		put_u32(crc, CRC32::update(0, (const void*)addr, count));
+		reply(ACK, crc, sizeof(crc));
+		break;
+	    }
+	    case CMD_VERIFY: {
+		if (len < 8 || (len & 3) || !loaded || streaming) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t block = get_u32(payload);
+		uint32_t blocks = (len - 8) / 4;
+		if (block == 0 ||
+		    blocks != size / block + (size % block != 0)) {
+		    reply(NAK);
+		    break;
+		}
+		// One pass: the CRC follows the digests through the cache.
+		const uint8_t *kernel = (const uint8_t*)KERNEL_ADDR;
+		uint32_t crc = 0;
+		uint32_t bad = 0;
+		for(uint32_t i = 0; i < blocks; ++i) {
+		    uint32_t offset = i * block;
+		    uint32_t count = size - offset < block ? size - offset : block;
+		    crc = CRC32::update(crc, kernel + offset, count);
+		    if (Digest::xxh32(kernel + offset, count) !=
+			get_u32(payload + 8 + 4 * i)) {
+			if (bad < VERIFY_MAX_BAD) {
+			    put_u32(dump_buf + 4 + 4 * bad, i);
+			}
+			++bad;
+			progress_forget(offset, count);
+		    }
+		}
+		if (bad == 0 && crc == get_u32(payload + 4)) {
+		    // all of it is known good now
+		    progress_add(0, size);
+		    reply(ACK);
+		    break;
+		}
+		if (bad == 0) progress_forget(0, size);
+		put_u32(dump_buf, bad);
+		if (bad > VERIFY_MAX_BAD) bad = VERIFY_MAX_BAD;
+		reply(NAK, dump_buf, 4 + 4 * bad);
+		break;
+	    }
+	    case CMD_PROFILE:
+		if (len != 4 || !Profiler::configure(get_u32(payload))) {
+		    reply(NAK);
+		    break;
+		}
+		reply(ACK);
+		break;
+	    case CMD_GDB:
+		if (len != 0) {
+		    reply(NAK);
+		    break;
+		}
+		GdbStub::arm(true);
+		reply(ACK);
+		break;
+	    case CMD_WATCHDOG:
+		if (len != 4 || get_u32(payload) > Watchdog::MAX_MSECS) {
+		    reply(NAK);
+		    break;
+		}
+		handoff_msecs = get_u32(payload);
+		reply(ACK);
+		break;
+	    case CMD_GO: {
+		if (len != 4) {
+		    reply(NAK);
+		    break;
+		}
+		uint32_t addr = get_u32(payload);
+		reply(ACK);
+		return start(addr, entry);
+	    }
+	    default:
+		reply(NAK);
+	    }
+	}
+    }
+}
@@ -0,0 +1,40 @@
+/* digest.cc - digests to verify the kernel */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* BCM2835 has no NEON, its ARMv6 SIMD instructions work on bytes and
+ * halfwords and don't help the 32 bit multiplies of XXH32, so the
+ * scalar lanes from xxh32.h run there. CRC-32 uses the slicing-by-8
+ * tables of crc32.h on every model.
+ */
+
+#include <stdint.h>
+#include <archinfo.h>
+#include <digest.h>
+#include <xxh32.h>
+
+namespace Digest {
+    static XXH32::StripeFn stripes = XXH32::stripes;
+
+    void init(void) {
+	if (arch_info->has_neon) stripes = xxh32_stripes_neon;
+    }
+
+    uint32_t xxh32(const void *data, size_t len) {
+	return XXH32::hash(data, len, 0, stripes);
+    }
+}
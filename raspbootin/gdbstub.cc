@@ -0,0 +1,816 @@
+/* gdbstub.cc - GDB remote serial protocol stub */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Reference material:
+ * https://sourceware.org/gdb/current/onlinedocs/gdb/Remote-Protocol.html
+ *
+ * The stub understands enough of the protocol for gdb's load, register
+ * and memory access, software breakpoints (Z0), continue and step.
+ * X packets and a 16KiB packet size let load run at line rate. GDB
+ * steps ARM code with breakpoints of its own, s is still supported by
+ * predicting the next instruction of branches, branch and exchange,
+ * loads of the pc and POP, with breakpoints on every possible target.
+ *
+ * The kernel can't be interrupted with ^C, it stops at breakpoints and
+ * exceptions only.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <cache.h>
+#include <exceptions.h>
+#include <protocol.h>
+#include <resident.h>
+#include <uart.h>
+#include <gdbstub.h>
+
+uint32_t gdb_frame[GDB_FRAME_SIZE];
+volatile uint32_t gdb_active;
+volatile uint32_t gdb_probe;
+volatile uint32_t gdb_fault;
+
+namespace GdbStub {
+    using namespace Protocol;
+
+    enum {
+	PACKET_SIZE = 0x4000,
+	MAX_BREAKPOINTS = 64,
+	// r0-r15, cpsr
+	NUM_REGS = 17,
+
+	// signals
+	SIGILL = 4,
+	SIGTRAP = 5,
+	SIGSEGV = 11,
+
+	// ARM and Thumb BKPT #0
+	BKPT_ARM = 0xE1200070,
+	BKPT_THUMB = 0xBE00,
+
+	CPSR_T = 1 << 5,
+	// IFSR status of a debug event (BKPT)
+	IFSR_DEBUG_EVENT = 0x2,
+    };
+
+    static const char target_xml[] =
+	"<?xml version=\"1.0\"?>"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+	"<target><architecture>arm</architecture>"
+	"<feature name=\"org.gnu.gdb.arm.core\">"
+	"<reg name=\"r0\" bitsize=\"32\"/><reg name=\"r1\" bitsize=\"32\"/>"
+	"<reg name=\"r2\" bitsize=\"32\"/><reg name=\"r3\" bitsize=\"32\"/>"
+	"<reg name=\"r4\" bitsize=\"32\"/><reg name=\"r5\" bitsize=\"32\"/>"
+	"<reg name=\"r6\" bitsize=\"32\"/><reg name=\"r7\" bitsize=\"32\"/>"
+	"<reg name=\"r8\" bitsize=\"32\"/><reg name=\"r9\" bitsize=\"32\"/>"
+	"<reg name=\"r10\" bitsize=\"32\"/><reg name=\"r11\" bitsize=\"32\"/>"
+	"<reg name=\"r12\" bitsize=\"32\"/>"
+	"<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+	"<reg name=\"lr\" bitsize=\"32\"/>"
+	"<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+	"<reg name=\"cpsr\" bitsize=\"32\"/>"
+	"</feature></target>";
+
+    struct Breakpoint {
+	uint32_t addr;
+	uint32_t orig;
+	// 2 (Thumb) or 4 (ARM), 0 for a free slot
+	uint32_t kind;
+    };
+
+    static bool next_armed;
+    static bool no_ack;
+    static uint32_t last_signal = SIGTRAP;
+    static Breakpoint breakpoints[MAX_BREAKPOINTS];
+    // temporary breakpoints of a step
+    static Breakpoint steps[2];
+
+    // packet being received or sent, + 1 for the terminating 0
+    static char in[PACKET_SIZE + 1];
+    static char out[PACKET_SIZE];
+
+    static const char hex_digits[] = "0123456789abcdef";
+
+    static int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+    }
+
+    /*
+     * Parse a hex number.
+     * const char *&p: input, advanced past the number
+     *
+     * Returns:
+     * uint32_t: the number
+     */
+    static uint32_t parse_hex(const char *&p) {
+	uint32_t x = 0;
+	int d;
+	while((d = hex_value(*p)) >= 0) {
+	    x = (x << 4) | d;
+	    ++p;
+	}
+	return x;
+    }
+
+    static char *put_hex_byte(char *p, uint8_t byte) {
+	*p++ = hex_digits[byte >> 4];
+	*p++ = hex_digits[byte & 0xF];
+	return p;
+    }
+
+    // registers go little endian, byte by byte
+    static char *put_hex_word(char *p, uint32_t x) {
+	for(int i = 0; i < 4; ++i) {
+	    p = put_hex_byte(p, x >> (8 * i));
+	}
+	return p;
+    }
+
+    static bool get_hex_word(const char *&p, uint32_t &x) {
+	x = 0;
+	for(int i = 0; i < 4; ++i) {
+	    int hi = hex_value(p[0]);
+	    int lo = hex_value(p[1]);
+	    if (hi < 0 || lo < 0) return false;
+	    x |= (uint32_t)((hi << 4) | lo) << (8 * i);
+	    p += 2;
+	}
+	return true;
+    }
+
+    /*
+     * Read memory without crashing on an abort.
+     * uint32_t addr: address
+     * uint8_t &byte: the byte read
+     *
+     * Returns:
+     * bool: false if the access aborted.
+     */
+    static bool read_byte(uint32_t addr, uint8_t &byte) {
+	gdb_fault = 0;
+	gdb_probe = 1;
+	byte = *(volatile uint8_t*)addr;
+	gdb_probe = 0;
+	return !gdb_fault;
+    }
+
+    static bool write_byte(uint32_t addr, uint8_t byte) {
+	gdb_fault = 0;
+	gdb_probe = 1;
+	*(volatile uint8_t*)addr = byte;
+	gdb_probe = 0;
+	return !gdb_fault;
+    }
+
+    static bool read_word(uint32_t addr, uint32_t &x) {
+	x = 0;
+	for(int i = 0; i < 4; ++i) {
+	    uint8_t byte;
+	    if (!read_byte(addr + i, byte)) return false;
+	    x |= (uint32_t)byte << (8 * i);
+	}
+	return true;
+    }
+
+    /*
+     * Write code or data, making sure instruction fetches see it.
+     * uint32_t addr: address
+     * const uint8_t *data: bytes to write
+     * uint32_t len: number of bytes
+     *
+     * Returns:
+     * bool: false if a write aborted.
+     */
+    static bool write_memory(uint32_t addr, const uint8_t *data,
+			     uint32_t len) {
+	bool ok = true;
+	for(uint32_t i = 0; i < len && ok; ++i) {
+	    ok = write_byte(addr + i, data[i]);
+	}
+	dcache_clean_range((const void*)addr, len);
+	icache_invalidate();
+	return ok;
+    }
+
+    static bool insert(Breakpoint &bp) {
+	uint8_t code[4];
+	uint32_t orig;
+	if (!read_word(bp.addr & ~3, orig)) return false;
+	if (bp.kind == 4) {
+	    bp.orig = orig;
+	    put_u32(code, BKPT_ARM);
+	} else {
+	    bp.orig = (bp.addr & 2) ? orig >> 16 : orig & 0xFFFF;
+	    put_u16(code, BKPT_THUMB);
+	}
+	return write_memory(bp.addr, code, bp.kind);
+    }
+
+    static void remove(Breakpoint &bp) {
+	uint8_t code[4];
+	put_u32(code, bp.orig);
+	write_memory(bp.addr, code, bp.kind);
+	bp.kind = 0;
+    }
+
+    static void remove_all(void) {
+	for(uint32_t i = 0; i < MAX_BREAKPOINTS; ++i) {
+	    if (breakpoints[i].kind) remove(breakpoints[i]);
+	}
+    }
+
+    /*
+     * Start a FRAME_GDB frame, the payload follows with send_raw().
+     * uint32_t len: payload length
+     */
+    static void send_frame(uint32_t len) {
+	UART::putc(ESCAPE);
+	UART::putc(ESCAPE);
+	UART::putc(FRAME_GDB);
+	UART::putc(len);
+	UART::putc(len >> 8);
+    }
+
+    static void send_raw(const char *data, uint32_t len) {
+	for(uint32_t i = 0; i < len; ++i) UART::putc(data[i]);
+    }
+
+    /*
+     * Send $data#checksum to GDB.
+     * const char *data: packet data
+     * uint32_t len: length of the data
+     */
+    static void send_packet(const char *data, uint32_t len) {
+	char head = '$';
+	char tail[3] = {'#'};
+	uint8_t sum = 0;
+	for(uint32_t i = 0; i < len; ++i) sum += (uint8_t)data[i];
+	put_hex_byte(&tail[1], sum);
+	send_frame(len + 4);
+	send_raw(&head, 1);
+	send_raw(data, len);
+	send_raw(tail, 3);
+    }
+
+    static void send_string(const char *str) {
+	uint32_t len = 0;
+	while(str[len]) ++len;
+	send_packet(str, len);
+    }
+
+    /*
+     * Check the start of a packet.
+     * const char *str: packet
+     * const char *prefix: expected start
+     *
+     * Returns:
+     * const char*: the rest of the packet or NULL if it doesn't match.
+     */
+    static const char * starts_with(const char *str, const char *prefix) {
+	while(*prefix) {
+	    if (*str++ != *prefix++) return NULL;
+	}
+	return str;
+    }
+
+    /*
+     * Receive a packet into in, acking it unless in no-ack mode.
+     *
+     * Returns:
+     * uint32_t: length of the packet
+     */
+    static uint32_t receive_packet(void) {
+	while(true) {
+	    // skip acks, ^C and noise up to the start of a packet
+	    while(UART::getc() != '$') { }
+	    uint32_t len = 0;
+	    uint8_t sum = 0;
+	    bool overflow = false;
+	    char c;
+	    while((c = UART::getc()) != '#') {
+		if (c == '$') {
+		    // restart
+		    len = 0;
+		    sum = 0;
+		    overflow = false;
+		    continue;
+		}
+		sum += (uint8_t)c;
+		if (len < PACKET_SIZE) {
+		    in[len++] = c;
+		} else {
+		    overflow = true;
+		}
+	    }
+	    int hi = hex_value(UART::getc());
+	    int lo = hex_value(UART::getc());
+	    bool ok = !overflow && ((hi << 4) | lo) == sum;
+	    if (!no_ack) {
+		char ack = ok ? '+' : '-';
+		send_frame(1);
+		send_raw(&ack, 1);
+	    }
+	    if (ok) {
+		in[len] = 0;
+		return len;
+	    }
+	}
+    }
+
+    static void stop_reply(void) {
+	char reply[4] = {'S'};
+	put_hex_byte(&reply[1], last_signal);
+	send_packet(reply, 3);
+    }
+
+    // m addr,len
+    static void read_memory(const char *p) {
+	uint32_t addr = parse_hex(p);
+	if (*p++ != ',') {
+	    send_string("E01");
+	    return;
+	}
+	uint32_t len = parse_hex(p);
+	if (len > PACKET_SIZE / 2) len = PACKET_SIZE / 2;
+	char *o = out;
+	for(uint32_t i = 0; i < len; ++i) {
+	    uint8_t byte;
+	    if (!read_byte(addr + i, byte)) break;
+	    o = put_hex_byte(o, byte);
+	}
+	if (o == out && len > 0) {
+	    send_string("E14");
+	    return;
+	}
+	send_packet(out, o - out);
+    }
+
+    /*
+     * M addr,len:hex and X addr,len:binary
+     * const char *p: packet after the command
+     * const char *end: end of the packet
+     * bool binary: X packet
+     */
+    static void write_packet(const char *p, const char *end, bool binary) {
+	uint32_t addr = parse_hex(p);
+	if (*p++ != ',') {
+	    send_string("E01");
+	    return;
+	}
+	uint32_t len = parse_hex(p);
+	if (*p++ != ':') {
+	    send_string("E01");
+	    return;
+	}
+	// decode in place, the data never grows
+	uint8_t *data = (uint8_t*)in;
+	uint32_t n = 0;
+	while(p < end && n < len) {
+	    if (binary) {
+		uint8_t c = *p++;
+		if (c == '}' && p < end) c = *p++ ^ 0x20;
+		data[n++] = c;
+	    } else {
+		int hi = hex_value(p[0]);
+		int lo = p + 1 < end ? hex_value(p[1]) : -1;
+		if (hi < 0 || lo < 0) break;
+		data[n++] = (hi << 4) | lo;
+		p += 2;
+	    }
+	}
+	if (n != len) {
+	    send_string("E01");
+	    return;
+	}
+	send_string(write_memory(addr, data, len) ? "OK" : "E14");
+    }
+
+    // Z0,addr,kind and z0,addr,kind
+    static void breakpoint(const char *p, bool set) {
+	if (*p++ != '0' || *p++ != ',') {
+	    // only software breakpoints
+	    send_string("");
+	    return;
+	}
+	uint32_t addr = parse_hex(p);
+	uint32_t kind = *p == ',' ? parse_hex(++p) : 4;
+	// a 32 bit Thumb-2 instruction gets a 16 bit BKPT
+	if (kind == 3) kind = 2;
+	if (kind != 2 && kind != 4) {
+	    send_string("E01");
+	    return;
+	}
+	int free = -1;
+	for(uint32_t i = 0; i < MAX_BREAKPOINTS; ++i) {
+	    Breakpoint &bp = breakpoints[i];
+	    if (bp.kind && bp.addr == addr) {
+		if (!set) remove(bp);
+		send_string("OK");
+		return;
+	    }
+	    if (!bp.kind && free < 0) free = (int)i;
+	}
+	if (!set) {
+	    send_string("OK");
+	    return;
+	}
+	if (free < 0) {
+	    send_string("E0C");
+	    return;
+	}
+	Breakpoint &bp = breakpoints[free];
+	bp.addr = addr;
+	bp.kind = kind;
+	if (!insert(bp)) {
+	    bp.kind = 0;
+	    send_string("E14");
+	    return;
+	}
+	send_string("OK");
+    }
+
+    // qXfer:features:read:target.xml:offset,length
+    static void read_features(const char *p) {
+	p = starts_with(p, "target.xml:");
+	if (!p) {
+	    send_string("E00");
+	    return;
+	}
+	uint32_t offset = parse_hex(p);
+	if (*p++ != ',') {
+	    send_string("E01");
+	    return;
+	}
+	uint32_t len = parse_hex(p);
+	uint32_t size = sizeof(target_xml) - 1;
+	if (offset > size) offset = size;
+	if (len > size - offset) len = size - offset;
+	if (len > PACKET_SIZE - 1) len = PACKET_SIZE - 1;
+	out[0] = offset + len < size ? 'm' : 'l';
+	memcpy(out + 1, target_xml + offset, len);
+	send_packet(out, len + 1);
+    }
+
+    static uint32_t reg(uint32_t n, uint32_t pc, bool thumb) {
+	// reading the pc gives the address of the instruction + 8 (+ 4)
+	if (n == 15) return pc + (thumb ? 4 : 8);
+	return gdb_frame[n];
+    }
+
+    static int32_t sign_extend(uint32_t x, int bits) {
+	return (int32_t)(x << (32 - bits)) >> (32 - bits);
+    }
+
+    static int popcount(uint32_t x) {
+	int n = 0;
+	for(; x; x &= x - 1) ++n;
+	return n;
+    }
+
+    /*
+     * Predict where an ARM instruction can continue.
+     * uint32_t pc: address of the instruction
+     * uint32_t *next: up to 2 addresses, bit 0 set for Thumb
+     *
+     * Returns:
+     * int: number of addresses
+     */
+    static int next_arm(uint32_t pc, uint32_t *next) {
+	uint32_t insn;
+	if (!read_word(pc, insn)) return 0;
+	uint32_t cond = insn >> 28;
+	uint32_t target;
+	bool branch = true;
+	if ((insn & 0x0E000000) == 0x0A000000) {
+	    // B, BL, BLX (immediate)
+	    target = pc + 8 + (sign_extend(insn & 0xFFFFFF, 24) << 2);
+	    if (cond == 0xF) {
+		target |= ((insn >> 23) & 2) | 1;
+		cond = 0xE;
+	    }
+	} else if ((insn & 0x0FFFFFD0) == 0x012FFF10 ||
+		   (insn & 0x0FFFFFF0) == 0x01A0F000) {
+	    // BX, BLX (register), MOV pc, Rm
+	    target = reg(insn & 0xF, pc, false);
+	    if ((insn & 0x0FFFFFF0) == 0x01A0F000) target &= ~1;
+	} else if ((insn & 0x0E50F000) == 0x0410F000) {
+	    // LDR pc, [Rn, #imm]
+	    uint32_t addr = reg((insn >> 16) & 0xF, pc, false);
+	    if (insn & (1 << 24)) {
+		addr += (insn & (1 << 23)) ? (insn & 0xFFF)
+					   : -(insn & 0xFFF);
+	    }
+	    if (!read_word(addr, target)) return 0;
+	} else if ((insn & 0x0E108000) == 0x08108000) {
+	    // LDM with the pc, e.g. POP {..., pc}
+	    uint32_t addr = reg((insn >> 16) & 0xF, pc, false);
+	    uint32_t count = popcount(insn & 0xFFFF);
+	    bool up = insn & (1 << 23);
+	    bool before = insn & (1 << 24);
+	    if (up) {
+		addr += 4 * (count - 1) + (before ? 4 : 0);
+	    } else if (before) {
+		addr -= 4;
+	    }
+	    if (!read_word(addr, target)) return 0;
+	} else {
+	    branch = false;
+	}
+	int n = 0;
+	if (branch) next[n++] = target;
+	if (!branch || (cond != 0xE && cond != 0xF)) next[n++] = pc + 4;
+	return n;
+    }
+
+    /*
+     * Predict where a Thumb instruction can continue.
+     * uint32_t pc: address of the instruction
+     * uint32_t *next: up to 2 addresses, bit 0 set for Thumb
+     *
+     * Returns:
+     * int: number of addresses
+     */
+    static int next_thumb(uint32_t pc, uint32_t *next) {
+	uint32_t word;
+	if (!read_word(pc & ~3, word)) return 0;
+	uint32_t insn = (pc & 2) ? word >> 16 : word & 0xFFFF;
+	uint32_t insn2 = 0;
+	bool wide = (insn >> 11) >= 0x1D;
+	if (wide) {
+	    uint32_t word2 = word;
+	    if ((pc & 2) && !read_word(pc + 2, word2)) return 0;
+	    insn2 = (pc & 2) ? word2 & 0xFFFF : word >> 16;
+	}
+	uint32_t size = wide ? 4 : 2;
+	uint32_t target = 0;
+	bool branch = true;
+	bool cond = false;
+	if (!wide && (insn & 0xF000) == 0xD000 && (insn & 0x0E00) != 0x0E00) {
+	    // B<cond>
+	    target = (pc + 4 + (sign_extend(insn & 0xFF, 8) << 1)) | 1;
+	    cond = true;
+	} else if (!wide && (insn & 0xF800) == 0xE000) {
+	    // B
+	    target = (pc + 4 + (sign_extend(insn & 0x7FF, 11) << 1)) | 1;
+	} else if (!wide && (insn & 0xFF07) == 0x4700) {
+	    // BX, BLX (register)
+	    target = reg((insn >> 3) & 0xF, pc, true);
+	} else if (!wide && (insn & 0xFF87) == 0x4687) {
+	    // MOV pc, Rm
+	    target = reg((insn >> 3) & 0xF, pc, true) | 1;
+	} else if (!wide && (insn & 0xFF00) == 0xBD00) {
+	    // POP {..., pc}
+	    uint32_t addr = gdb_frame[GDB_FRAME_SP] + 4 * popcount(insn & 0xFF);
+	    if (!read_word(addr, target)) return 0;
+	} else if (!wide && (insn & 0xF500) == 0xB100) {
+	    // CBZ, CBNZ
+	    target = pc + 4 + (((insn >> 9) & 1) << 6) + ((insn >> 2) & 0x3E);
+	    target |= 1;
+	    cond = true;
+	} else if (wide && (insn & 0xF800) == 0xF000 &&
+		   (insn2 & 0x8000)) {
+	    // B.W, BL, BLX (immediate)
+	    uint32_t s = (insn >> 10) & 1;
+	    uint32_t j1 = (insn2 >> 13) & 1;
+	    uint32_t j2 = (insn2 >> 11) & 1;
+	    if ((insn2 & 0x5000) == 0 && ((insn >> 6) & 0xE) != 0xE) {
+		// B<cond>.W
+		uint32_t imm = (s << 20) | (j2 << 19) | (j1 << 18) |
+			       ((insn & 0x3F) << 12) | ((insn2 & 0x7FF) << 1);
+		target = (pc + 4 + sign_extend(imm, 21)) | 1;
+		cond = true;
+	    } else if (insn2 & 0x5000) {
+		uint32_t i1 = !(j1 ^ s);
+		uint32_t i2 = !(j2 ^ s);
+		uint32_t imm = (s << 24) | (i1 << 23) | (i2 << 22) |
+			       ((insn & 0x3FF) << 12) | ((insn2 & 0x7FF) << 1);
+		target = pc + 4 + sign_extend(imm, 25);
+		if (!(insn2 & 0x1000)) {
+		    // BLX to ARM
+		    target &= ~3;
+		} else {
+		    target |= 1;
+		}
+	    } else {
+		branch = false;
+	    }
+	} else {
+	    branch = false;
+	}
+	int n = 0;
+	if (branch) next[n++] = target;
+	if (!branch || cond) next[n++] = (pc + size) | 1;
+	return n;
+    }
+
+    static void step_insert(void) {
+	uint32_t pc = gdb_frame[GDB_FRAME_PC];
+	uint32_t next[2];
+	int n = (gdb_frame[GDB_FRAME_CPSR] & CPSR_T) ? next_thumb(pc, next)
+						    : next_arm(pc, next);
+	for(int i = 0; i < n; ++i) {
+	    steps[i].addr = next[i] & ~1;
+	    steps[i].kind = (next[i] & 1) ? 2 : 4;
+	    if (!insert(steps[i])) steps[i].kind = 0;
+	}
+    }
+
+    static void step_remove(void) {
+	// in reverse, both may cover the same word
+	for(int i = 1; i >= 0; --i) {
+	    if (steps[i].kind) remove(steps[i]);
+	}
+    }
+
+    /*
+     * Talk to GDB until it continues, steps or detaches the program.
+     */
+    static void serve(void) {
+	while(true) {
+	    uint32_t len = receive_packet();
+	    const char *p = in + 1;
+	    switch(in[0]) {
+	    case '?':
+		stop_reply();
+		break;
+	    case 'g': {
+		char *o = out;
+		for(uint32_t i = 0; i < NUM_REGS; ++i) {
+		    o = put_hex_word(o, gdb_frame[i]);
+		}
+		send_packet(out, o - out);
+		break;
+	    }
+	    case 'G': {
+		uint32_t regs[NUM_REGS];
+		bool ok = true;
+		for(uint32_t i = 0; i < NUM_REGS && ok; ++i) {
+		    ok = get_hex_word(p, regs[i]);
+		}
+		if (ok) memcpy(gdb_frame, regs, sizeof(regs));
+		send_string(ok ? "OK" : "E01");
+		break;
+	    }
+	    case 'p': {
+		uint32_t n = parse_hex(p);
+		if (n >= NUM_REGS) {
+		    send_string("E01");
+		    break;
+		}
+		char *o = put_hex_word(out, gdb_frame[n]);
+		send_packet(out, o - out);
+		break;
+	    }
+	    case 'P': {
+		uint32_t n = parse_hex(p);
+		uint32_t x;
+		if (n >= NUM_REGS || *p++ != '=' || !get_hex_word(p, x)) {
+		    send_string("E01");
+		    break;
+		}
+		gdb_frame[n] = x;
+		send_string("OK");
+		break;
+	    }
+	    case 'm':
+		read_memory(p);
+		break;
+	    case 'M':
+		write_packet(p, in + len, false);
+		break;
+	    case 'X':
+		write_packet(p, in + len, true);
+		break;
+	    case 'Z':
+		breakpoint(p, true);
+		break;
+	    case 'z':
+		breakpoint(p, false);
+		break;
+	    case 'c':
+	    case 's':
+		if (*p) {
+		    uint32_t addr = parse_hex(p);
+		    gdb_frame[GDB_FRAME_PC] = addr;
+		}
+		if (in[0] == 's') step_insert();
+		return;
+	    case 'D':
+		send_string("OK");
+		remove_all();
+		gdb_active = 0;
+		return;
+	    case 'k':
+		remove_all();
+		gdb_active = 0;
+		Reenter(RASPBOOTIN_EXIT_BREAK);
+	    case 'H':
+		send_string("OK");
+		break;
+	    case 'q':
+		if (starts_with(in, "qSupported")) {
+		    send_string("PacketSize=4000;qXfer:features:read+;"
+				"QStartNoAckMode+");
+		} else if ((p = starts_with(in, "qXfer:features:read:"))) {
+		    read_features(p);
+		} else if (starts_with(in, "qAttached")) {
+		    send_string("1");
+		} else {
+		    send_string("");
+		}
+		break;
+	    case 'Q':
+		if (starts_with(in, "QStartNoAckMode")) {
+		    send_string("OK");
+		    no_ack = true;
+		} else {
+		    send_string("");
+		}
+		break;
+	    default:
+		// not supported
+		send_string("");
+	    }
+	}
+    }
+
+    void arm(bool enable) {
+	next_armed = enable;
+    }
+
+    bool armed(void) {
+	return next_armed;
+    }
+
+    void boot(uint32_t entry, uint32_t r0, uint32_t r1,
+	      const Header *atags, const raspbootin_services *services) {
+	next_armed = false;
+	no_ack = false;
+	last_signal = SIGTRAP;
+	memset(gdb_frame, 0, sizeof(gdb_frame));
+	gdb_frame[0] = r0;
+	gdb_frame[1] = r1;
+	gdb_frame[2] = (uint32_t)atags;
+	gdb_frame[3] = (uint32_t)services;
+	// the kernel runs on the loader's stack and returns to Reenter
+	uint32_t sp, cpsr;
+	asm volatile("mov %[sp], sp" : [sp]"=r"(sp));
+	asm volatile("mrs %[cpsr], cpsr" : [cpsr]"=r"(cpsr));
+	gdb_frame[GDB_FRAME_SP] = sp;
+	gdb_frame[GDB_FRAME_LR] = RASPBOOTIN_REENTER_ADDR;
+	gdb_frame[GDB_FRAME_PC] = entry;
+	gdb_frame[GDB_FRAME_CPSR] = cpsr & ~CPSR_T;
+	gdb_active = 1;
+
+	// GDB asks why the target stopped when it connects
+	serve();
+	gdb_resume();
+    }
+
+    void exited(int code) {
+	if (!gdb_active) return;
+	gdb_active = 0;
+	remove_all();
+	char reply[4] = {'W'};
+	put_hex_byte(&reply[1], code);
+	send_packet(reply, 3);
+    }
+}
+
+void gdb_exception(uint32_t type) {
+    using namespace GdbStub;
+    step_remove();
+    switch(type) {
+    case EXC_PREFETCH_ABORT: {
+	uint32_t ifsr;
+	asm volatile("mrc p15, 0, %[ifsr], c5, c0, 1" : [ifsr]"=r"(ifsr));
+	uint32_t status = (ifsr & 0xF) | ((ifsr >> 6) & 0x10);
+	last_signal = status == IFSR_DEBUG_EVENT ? SIGTRAP : SIGSEGV;
+	break;
+    }
+    case EXC_UNDEFINED:
+	last_signal = SIGILL;
+	break;
+    default:
+	last_signal = SIGSEGV;
+    }
+    stop_reply();
+    serve();
+}
@@ -26,16 +26,34 @@ class ArchInfo {
 public:
     enum Archs { RPI, RPIplus, RPI2, NUM_ARCH_INFOS };
     constexpr ArchInfo(const char *model_, uint32_t peripherals_base_, int disk_led_gpio_,
-	     bool disk_led_active_low_)
+	     bool disk_led_active_low_, bool has_neon_, uint32_t bus_alias_)
 	: model(model_), peripherals_base(peripherals_base_),
 	  disk_led_gpio(disk_led_gpio_),
-	  disk_led_active_low(disk_led_active_low_) { }
+	  disk_led_active_low(disk_led_active_low_),
+	  has_neon(has_neon_), bus_alias(bus_alias_) { }
     const char *model;
     const uint32_t peripherals_base;
     const int disk_led_gpio;
     const bool disk_led_active_low;
+    const bool has_neon;
+    // alias to OR into RAM addresses handed to the VideoCore
+    const uint32_t bus_alias;
 };
 
+// indexed by ArchInfo::Archs
+inline constexpr ArchInfo arch_infos[ArchInfo::NUM_ARCH_INFOS] = {
+    ArchInfo("Raspberry Pi b", 0x20000000, 16, 1, false, 0x40000000),
+    ArchInfo("Raspberry Pi b+", 0x20000000, 47, 0, false, 0x40000000),
+    ArchInfo("Raspberry Pi b 2", 0x3F000000, 47, 0, true, 0xC0000000),
+};
+
+#ifdef RASPBOOTIN_BOARD
+// Built for one board (make BOARD=...), everything that depends on the
+// board folds at compile time.
+static constexpr const ArchInfo *arch_info = &arch_infos[RASPBOOTIN_BOARD];
+#else
+// detected at runtime by kernel_main()
 extern const ArchInfo *arch_info;
+#endif
 
 #endif // #ifndef RASPBOOTIN_ARCHINFO_H
@@ -0,0 +1,54 @@
+/* cache.h - cache maintenance */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_CACHE_H
+#define RASPBOOTIN_CACHE_H
+
+#include <stddef.h>
+
+// defined in cache.S
+extern "C" {
+    /*
+     * Write dirty data cache lines covering a range back to memory.
+     * const void *addr: start of the range
+     * size_t len: length of the range
+     */
+    void dcache_clean_range(const void *addr, size_t len);
+
+    /*
+     * Discard data cache lines covering a range (e.g. before reading
+     * what a DMA engine wrote).
+     * void *addr: start of the range
+     * size_t len: length of the range
+     */
+    void dcache_invalidate_range(void *addr, size_t len);
+
+    /*
+     * Invalidate the instruction cache and branch predictor, e.g.
+     * after writing code.
+     */
+    void icache_invalidate(void);
+
+    /*
+     * Write back all dirty data, then turn off MMU, data and
+     * instruction cache.
+     */
+    void caches_off(void);
+}
+
+#endif // #ifndef RASPBOOTIN_CACHE_H
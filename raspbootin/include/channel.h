@@ -0,0 +1,51 @@
+/* channel.h - byte streams to the host besides the console */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_CHANNEL_H
+#define RASPBOOTIN_CHANNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Channel {
+    /*
+     * Send data to a channel of the host, in frames between the
+     * console output.
+     * unsigned channel: channel number
+     * const void *buf: data
+     * size_t len: number of bytes
+     *
+     * Returns:
+     * int: len or -1 if the channel doesn't exist.
+     */
+    int write(unsigned channel, const void *buf, size_t len);
+
+    /*
+     * Fetch the input the host has for a channel. Doesn't wait for more.
+     * unsigned channel: channel number
+     * void *buf: buffer for the data
+     * size_t len: size of the buffer
+     *
+     * Returns:
+     * int: bytes received or -1 if the channel doesn't exist or the
+     *      host didn't answer.
+     */
+    int read(unsigned channel, void *buf, size_t len);
+}
+
+#endif // #ifndef RASPBOOTIN_CHANNEL_H
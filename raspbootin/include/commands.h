@@ -0,0 +1,38 @@
+/* commands.h - host commands received over the UART */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_COMMANDS_H
+#define RASPBOOTIN_COMMANDS_H
+
+#include <stdint.h>
+
+namespace Commands {
+    /*
+     * Process command packets from the host (see protocol.h) until it
+     * asks to boot the loaded kernel or to jump somewhere else. Gives
+     * up when the host stays silent for a few seconds.
+     * uint32_t max_size: largest kernel that fits below the loader
+     * uint32_t &entry: address to call like a kernel
+     *
+     * Returns:
+     * bool: false if the host is gone, ask for a kernel again.
+     */
+    bool run(uint32_t max_size, uint32_t &entry);
+}
+
+#endif // #ifndef RASPBOOTIN_COMMANDS_H
@@ -0,0 +1,93 @@
+/* crc32.h - CRC-32 (IEEE 802.3) */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* This header is shared with raspbootcom and must only depend on
+ * <stddef.h> and <stdint.h>.
+ */
+
+#ifndef RASPBOOTIN_CRC32_H
+#define RASPBOOTIN_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace CRC32 {
+    // slicing-by-8: entry[0] is the classic byte at a time table for
+    // the reflected polynomial 0xEDB88320, entry[k] advances a byte by
+    // k more zero bytes
+    struct Table {
+	uint32_t entry[8][256];
+    };
+
+    static constexpr Table make_table() {
+	Table t = {};
+	for(uint32_t i = 0; i < 256; ++i) {
+	    uint32_t c = i;
+	    for(int k = 0; k < 8; ++k) {
+		c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+	    }
+	    t.entry[0][i] = c;
+	}
+	for(uint32_t i = 0; i < 256; ++i) {
+	    for(int k = 1; k < 8; ++k) {
+		uint32_t c = t.entry[k - 1][i];
+		t.entry[k][i] = t.entry[0][c & 0xFF] ^ (c >> 8);
+	    }
+	}
+	return t;
+    }
+
+    static constexpr Table table = make_table();
+
+    /*
+     * Continue a CRC over more data.
+     * uint32_t crc: CRC so far, 0 to start
+     * const void *data: the data
+     * size_t len: length of the data
+     *
+     * Returns:
+     * uint32_t: CRC including data
+     */
+    static inline uint32_t update(uint32_t crc, const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t*)data;
+	crc = ~crc;
+	// bytes up to a word boundary, then 8 bytes per step
+	while(len > 0 && ((uintptr_t)p & 3)) {
+	    crc = table.entry[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	    --len;
+	}
+	while(len >= 8) {
+	    uint32_t a = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) |
+				((uint32_t)p[3] << 24));
+	    uint32_t b = p[4] | (p[5] << 8) | (p[6] << 16) |
+		((uint32_t)p[7] << 24);
+	    crc = table.entry[7][a & 0xFF] ^ table.entry[6][(a >> 8) & 0xFF] ^
+		table.entry[5][(a >> 16) & 0xFF] ^ table.entry[4][a >> 24] ^
+		table.entry[3][b & 0xFF] ^ table.entry[2][(b >> 8) & 0xFF] ^
+		table.entry[1][(b >> 16) & 0xFF] ^ table.entry[0][b >> 24];
+	    p += 8;
+	    len -= 8;
+	}
+	while(len-- > 0) {
+	    crc = table.entry[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+    }
+}
+
+#endif // #ifndef RASPBOOTIN_CRC32_H
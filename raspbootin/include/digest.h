@@ -0,0 +1,47 @@
+/* digest.h - digests to verify the kernel */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_DIGEST_H
+#define RASPBOOTIN_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C" {
+    // XXH32 lanes, digest.S (ARMv7 with NEON only)
+    void xxh32_stripes_neon(uint32_t v[4], const uint8_t *p, size_t count);
+}
+
+namespace Digest {
+    /*
+     * Pick the fastest variants for the model. Call after mem_init().
+     */
+    void init(void);
+
+    /*
+     * XXH32 digest (seed 0) of a block.
+     * const void *data: the block
+     * size_t len: length of the block
+     *
+     * Returns:
+     * uint32_t: the digest
+     */
+    uint32_t xxh32(const void *data, size_t len);
+}
+
+#endif // #ifndef RASPBOOTIN_DIGEST_H
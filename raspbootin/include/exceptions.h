@@ -0,0 +1,63 @@
+/* exceptions.h - exceptions taken while a kernel runs */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_EXCEPTIONS_H
+#define RASPBOOTIN_EXCEPTIONS_H
+
+// exception numbers passed to exception_handler(), also used by vectors.S
+#define EXC_RESET		0
+#define EXC_UNDEFINED		1
+#define EXC_PREFETCH_ABORT	2
+#define EXC_DATA_ABORT		3
+#define EXC_IRQ			4
+#define EXC_FIQ			5
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+
+extern "C" {
+    /*
+     * Install the loader's exception vectors (vectors.S).
+     */
+    void vectors_install(void);
+
+    /*
+     * Report an exception the kernel didn't handle and return to the
+     * loader.
+     * uint32_t type: EXC_*
+     * uint32_t pc: address of the faulting instruction
+     */
+    void exception_handler(uint32_t type, uint32_t pc)
+	__attribute__((noreturn));
+
+    /*
+     * Run an ARM semihosting call (semihost.cc).
+     * uint32_t op: operation number (r0)
+     * uint32_t param: parameter (r1), usually a pointer to a block of
+     *                 arguments
+     *
+     * Returns:
+     * uint32_t: result for r0
+     */
+    uint32_t semihost_call(uint32_t op, uint32_t param);
+}
+
+#endif // #ifndef __ASSEMBLY__
+
+#endif // #ifndef RASPBOOTIN_EXCEPTIONS_H
@@ -0,0 +1,92 @@
+/* gdbstub.h - GDB remote serial protocol stub */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_GDBSTUB_H
+#define RASPBOOTIN_GDBSTUB_H
+
+// layout of gdb_frame, also used by vectors.S
+#define GDB_FRAME_SP		13
+#define GDB_FRAME_LR		14
+#define GDB_FRAME_PC		15
+#define GDB_FRAME_CPSR		16
+// the kernel's sp in Undefined mode, the stub runs there
+#define GDB_FRAME_UND_SP	17
+#define GDB_FRAME_SIZE		18
+
+#ifndef __ASSEMBLY__
+
+#include <stdint.h>
+#include <atag.h>
+#include <services.h>
+
+extern "C" {
+    // registers of the stopped program
+    extern uint32_t gdb_frame[GDB_FRAME_SIZE];
+    // exceptions go to the stub, not to exception_handler()
+    extern volatile uint32_t gdb_active;
+    // the stub is accessing memory, data aborts only set gdb_fault
+    extern volatile uint32_t gdb_probe;
+    extern volatile uint32_t gdb_fault;
+
+    /*
+     * The program stopped, talk to GDB until it continues (vectors.S
+     * calls this with gdb_frame filled in).
+     * uint32_t type: EXC_* that stopped it
+     */
+    void gdb_exception(uint32_t type);
+
+    /*
+     * Continue the program in gdb_frame (vectors.S).
+     */
+    void gdb_resume(void) __attribute__((noreturn));
+}
+
+namespace GdbStub {
+    /*
+     * Run the next kernel under the stub instead of calling it.
+     * bool enable: stop at the next kernel's entry
+     */
+    void arm(bool enable);
+
+    /*
+     * Should the next kernel run under the stub?
+     */
+    bool armed(void);
+
+    /*
+     * Stop at the kernel's entry point and wait for GDB. The kernel
+     * gets the same arguments as a kernel started directly.
+     * uint32_t entry: where the kernel starts
+     * uint32_t r0, r1: registers passed by the firmware
+     * const Header *atags: ATAGs
+     * const raspbootin_services *services: the loader's services
+     */
+    void boot(uint32_t entry, uint32_t r0, uint32_t r1,
+	      const Header *atags, const raspbootin_services *services)
+	__attribute__((noreturn));
+
+    /*
+     * The kernel returned to the loader, tell GDB it exited.
+     * int code: exit code
+     */
+    void exited(int code);
+}
+
+#endif // #ifndef __ASSEMBLY__
+
+#endif // #ifndef RASPBOOTIN_GDBSTUB_H
@@ -0,0 +1,197 @@
+/* lz.h - LZ77 block compression for memory dumps and logs */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* This header is shared with raspbootcom and must only depend on
+ * <stddef.h>, <stdint.h> and <string.h>.
+ *
+ * The block format is the one of LZ4: a sequence of
+ *
+ *   token u8, [literal length bytes], literals, offset u16,
+ *   [match length bytes]
+ *
+ * where the high nibble of the token is the number of literals and the
+ * low nibble the match length - 4. A nibble of 15 is continued by bytes
+ * that are added until one is not 255. The last sequence has only
+ * literals. The compressor is the simple greedy single hash version:
+ * it is small and fast, which is what matters on the RPi. Blocks are
+ * at most 64KiB.
+ */
+
+#ifndef RASPBOOTIN_LZ_H
+#define RASPBOOTIN_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace LZ {
+    enum {
+	HASH_BITS = 12,
+	HASH_SIZE = 1 << HASH_BITS,
+	MIN_MATCH = 4,
+	// the last literals, no match may reach into them
+	LAST_LITERALS = 5,
+	// no match starts this close to the end
+	MATCH_LIMIT = 12,
+	MAX_OFFSET = 65535,
+	MAX_BLOCK = 65536,
+    };
+
+    // worst case size of compressed data
+    static constexpr size_t bound(size_t len) {
+	return len + len / 255 + 16;
+    }
+
+    static inline uint32_t read32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static inline uint32_t hash(uint32_t x) {
+	return (x * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    // length bytes after a nibble of 15
+    static inline uint8_t *put_length(uint8_t *op, size_t len) {
+	while(len >= 255) {
+	    *op++ = 255;
+	    len -= 255;
+	}
+	*op++ = len;
+	return op;
+    }
+
+    static inline uint8_t *put_sequence(uint8_t *op, const uint8_t *lit,
+					size_t lit_len, size_t offset,
+					size_t match_len) {
+	uint8_t *token = op++;
+	*token = (lit_len < 15 ? lit_len : 15) << 4;
+	if (lit_len >= 15) op = put_length(op, lit_len - 15);
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if (match_len == 0) return op; // last sequence
+	*op++ = offset;
+	*op++ = offset >> 8;
+	match_len -= MIN_MATCH;
+	*token |= match_len < 15 ? match_len : 15;
+	if (match_len >= 15) op = put_length(op, match_len - 15);
+	return op;
+    }
+
+    /*
+     * Compress a block.
+     * const uint8_t *src: data, at most MAX_BLOCK bytes
+     * size_t len: length of the data
+     * uint8_t *dst: output buffer of bound(len) bytes
+     * uint32_t *table: scratch space of HASH_SIZE entries
+     *
+     * Returns:
+     * size_t: compressed size
+     */
+    static inline size_t compress(const uint8_t *src, size_t len,
+				  uint8_t *dst, uint32_t *table) {
+	uint8_t *op = dst;
+	size_t anchor = 0;
+	if (len > MATCH_LIMIT) {
+	    // positions + 1, 0 is empty
+	    memset(table, 0, HASH_SIZE * sizeof(uint32_t));
+	    size_t ip = 0;
+	    size_t limit = len - MATCH_LIMIT;
+	    while(ip < limit) {
+		uint32_t seq = read32(src + ip);
+		uint32_t h = hash(seq);
+		size_t ref = table[h];
+		table[h] = ip + 1;
+		if (ref == 0 || ip - (ref - 1) > MAX_OFFSET ||
+		    read32(src + ref - 1) != seq) {
+		    ++ip;
+		    continue;
+		}
+		--ref;
+		size_t match = MIN_MATCH;
+		while(ip + match < len - LAST_LITERALS &&
+		      src[ref + match] == src[ip + match]) {
+		    ++match;
+		}
+		op = put_sequence(op, src + anchor, ip - anchor, ip - ref,
+				  match);
+		ip += match;
+		anchor = ip;
+	    }
+	}
+	op = put_sequence(op, src + anchor, len - anchor, 0, 0);
+	return op - dst;
+    }
+
+    /*
+     * Decompress a block.
+     * const uint8_t *src: compressed data
+     * size_t len: length of the compressed data
+     * uint8_t *dst: output buffer
+     * size_t cap: size of the output buffer
+     *
+     * Returns:
+     * long: decompressed size or -1 if the data is corrupt
+     */
+    static inline long decompress(const uint8_t *src, size_t len,
+				  uint8_t *dst, size_t cap) {
+	const uint8_t *ip = src;
+	const uint8_t *end = src + len;
+	size_t out = 0;
+	while(ip < end) {
+	    uint8_t token = *ip++;
+	    size_t lit_len = token >> 4;
+	    if (lit_len == 15) {
+		uint8_t b;
+		do {
+		    if (ip >= end) return -1;
+		    b = *ip++;
+		    lit_len += b;
+		} while(b == 255);
+	    }
+	    if (lit_len > (size_t)(end - ip) || lit_len > cap - out) {
+		return -1;
+	    }
+	    memcpy(dst + out, ip, lit_len);
+	    ip += lit_len;
+	    out += lit_len;
+	    if (ip == end) break; // last sequence
+
+	    if (end - ip < 2) return -1;
+	    size_t offset = ip[0] | (ip[1] << 8);
+	    ip += 2;
+	    size_t match = (token & 15);
+	    if (match == 15) {
+		uint8_t b;
+		do {
+		    if (ip >= end) return -1;
+		    b = *ip++;
+		    match += b;
+		} while(b == 255);
+	    }
+	    match += MIN_MATCH;
+	    if (offset == 0 || offset > out || match > cap - out) return -1;
+	    // byte by byte, the match may overlap the output
+	    for(size_t i = 0; i < match; ++i, ++out) {
+		dst[out] = dst[out - offset];
+	    }
+	}
+	return out;
+    }
+}
+
+#endif // #ifndef RASPBOOTIN_LZ_H
@@ -0,0 +1,42 @@
+/* mailbox.h - property interface to the VideoCore firmware */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_MAILBOX_H
+#define RASPBOOTIN_MAILBOX_H
+
+#include <stdint.h>
+
+namespace Mailbox {
+    enum Clock {
+	CLOCK_EMMC = 1,
+	CLOCK_UART = 2,
+	CLOCK_ARM  = 3,
+	CLOCK_CORE = 4,
+    };
+
+    /*
+     * Ask the firmware for the rate of a clock.
+     * Clock clock: which clock
+     *
+     * Returns:
+     * uint32_t: rate in Hz, 0 on failure.
+     */
+    uint32_t get_clock_rate(Clock clock);
+}
+
+#endif // #ifndef RASPBOOTIN_MAILBOX_H
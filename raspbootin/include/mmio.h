@@ -16,6 +16,27 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+/* Reference material:
+ * http://www.raspberrypi.org/wp-content/uploads/2012/02/BCM2835-ARM-Peripherals.pdf
+ * 1.3 Peripheral access precautions for correct memory ordering
+ *
+ * Reads from different peripherals can come back out of order, so there
+ * has to be a memory barrier before the first access to a peripheral
+ * and after the last one. Functions that touch a peripheral put a Guard
+ * around their accesses and a barrier() where they switch to another.
+ *
+ * Registers and their bit fields are types with the offset and mask as
+ * compile time constants:
+ *
+ *   typedef MMIO::Register<UART0_OFFSET + 0x18> UART0_FR;
+ *   typedef MMIO::Field<UART0_FR, 4> FR_RXFE;
+ *   while(FR_RXFE::read()) { }
+ *
+ * Several fields go to a register in one write by ORing their bits().
+ * When built for one board (make BOARD=...) the peripheral base is a
+ * constant too, see archinfo.h.
+ */
+
 #ifndef MMIO_H
 #define MMIO_H
 
@@ -23,6 +44,19 @@
 #include <archinfo.h>
 
 namespace MMIO {
+    // data memory barrier, the CP15 form works on ARMv6 and ARMv7
+    static inline void barrier(void) {
+	asm volatile("mcr p15, 0, %[zero], c7, c10, 5"
+		     : : [zero]"r"(0) : "memory");
+    }
+
+    // barriers around the accesses to a peripheral in its scope
+    class Guard {
+    public:
+	Guard() { barrier(); }
+	~Guard() { barrier(); }
+    };
+
     // write to MMIO register
     static inline void write(uint32_t reg, uint32_t data) {
 	uint32_t *ptr = (uint32_t*)(arch_info->peripherals_base + reg);
@@ -38,6 +72,52 @@ namespace MMIO {
 		     : [data]"=r"(data) : [reg]"r"(ptr));
 	return data;
     }
+
+    // register at OFFSET from the peripheral base
+    template<uint32_t OFFSET>
+    struct Register {
+	static constexpr uint32_t offset = OFFSET;
+
+	static uint32_t read(void) {
+	    return MMIO::read(OFFSET);
+	}
+
+	static void write(uint32_t data) {
+	    MMIO::write(OFFSET, data);
+	}
+
+	// replace the bits in mask
+	static void modify(uint32_t mask, uint32_t bits) {
+	    write((read() & ~mask) | (bits & mask));
+	}
+    };
+
+    // WIDTH bits of REG starting at bit SHIFT
+    template<typename REG, unsigned SHIFT, unsigned WIDTH = 1>
+    struct Field {
+	static_assert(WIDTH > 0 && SHIFT + WIDTH <= 32, "field out of range");
+	static constexpr uint32_t mask =
+	    (WIDTH == 32 ? 0xFFFFFFFF : (1U << WIDTH) - 1) << SHIFT;
+
+	// the field set to value, all ones by default
+	static constexpr uint32_t bits(uint32_t value = 0xFFFFFFFF) {
+	    return (value << SHIFT) & mask;
+	}
+
+	// the field in a value read from REG
+	static constexpr uint32_t get(uint32_t reg) {
+	    return (reg & mask) >> SHIFT;
+	}
+
+	static uint32_t read(void) {
+	    return get(REG::read());
+	}
+
+	// read-modify-write, the other fields keep their value
+	static void write(uint32_t value) {
+	    REG::modify(mask, bits(value));
+	}
+    };
 }
 
 #endif // #ifndef MMIO_H
@@ -0,0 +1,61 @@
+/* profiler.h - sample the PC of a running kernel */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_PROFILER_H
+#define RASPBOOTIN_PROFILER_H
+
+#include <stdint.h>
+
+extern "C" {
+    /*
+     * Record one sample, called by the FIQ handler (vectors.S).
+     * uint32_t pc: address of the interrupted instruction
+     * uint32_t lr: LR of the interrupted mode
+     */
+    void profile_sample(uint32_t pc, uint32_t lr);
+}
+
+namespace Profiler {
+    /*
+     * Set the sample rate for the next kernel.
+     * uint32_t hz: samples per second, 0 turns the profiler off
+     *
+     * Returns:
+     * bool: false if the rate is out of range.
+     */
+    bool configure(uint32_t hz);
+
+    /*
+     * Start the ARM timer and unmask FIQs if a rate is configured. Call
+     * right before the kernel starts, after vectors_install().
+     */
+    void start(void);
+
+    /*
+     * Stop sampling. Turns the profiler off until the next configure().
+     */
+    void stop(void);
+
+    /*
+     * Send the samples still buffered after stop(), the UART must be
+     * set up.
+     */
+    void flush(void);
+}
+
+#endif // #ifndef RASPBOOTIN_PROFILER_H
@@ -0,0 +1,305 @@
+/* protocol.h - wire protocol between raspbootin and raspbootcom */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* This header is shared with raspbootcom and must only depend on
+ * <stdint.h>.
+ *
+ * The loader asks for a kernel with a BREAK condition followed by 3
+ * ESCAPEs (^C^C^C). A host that can see BREAKs takes the ESCAPEs only
+ * right after one, so a kernel printing ^C^C^C can't be mistaken for
+ * the loader. Links that lose the BREAK (ptys, raw TCP) rely on the
+ * ESCAPEs alone. From then on the host drives the loader with command
+ * packets:
+ *
+ *   command u8, length u16, payload[length]
+ *
+ * and the loader answers every packet, in order, with a reply:
+ *
+ *   status u8, rx errors u8, length u16, payload[length]
+ *
+ * All numbers are little endian. rx errors are the UART0_RSRECR flags
+ * (overrun, break, parity, framing) the loader saw while receiving the
+ * packet. A packet with errors has been received but its payload may
+ * be damaged. After an overrun the packet boundaries are lost.
+ *
+ * Besides loading a kernel the packets make a small monitor: the host
+ * can read and write memory, dump it (LZ compressed, see lz.h), fill
+ * it, checksum it and jump anywhere. Writes that would overwrite the
+ * loader itself are refused.
+ *
+ * CMD_BLOCK_FEC carries a block in Reed-Solomon codewords (see rs.h).
+ * The loader corrects up to parity / 2 damaged bytes per codeword, so
+ * a noisy line costs no round trip as long as the damage stays within
+ * that. Offset and parity aren't in a codeword, the CRC-32 behind them
+ * covers them instead: with a wrong CRC-32 or any rx error up to it the
+ * loader drops the block and answers NAK without payload. Otherwise its
+ * reply is ACK with the u16 number of corrected bytes, or NAK with the
+ * u8 number of codewords it couldn't correct. The rx errors of an ACK
+ * were in the codewords and have been corrected.
+ *
+ * Before booting the host sends CMD_VERIFY with the CRC-32 of the whole
+ * kernel and the XXH32 (seed 0, see xxh32.h) of each block of block
+ * size bytes. The loader checks the kernel in memory against them and
+ * answers ACK, or NAK with u32 count, u32 index[] of the damaged
+ * blocks (at most VERIFY_MAX_BAD indices, count 0 if only the CRC-32
+ * is wrong). CMD_BOOT doesn't require it. A NAK without payload means
+ * the request didn't match the kernel, e.g. because it was damaged.
+ *
+ * CMD_FEATURES returns the Feature flags of the loader. Loaders from
+ * before it NAK it like any unknown command and have none of them.
+ *
+ * CMD_RESUME announces a kernel like CMD_LOAD, with an ID the host
+ * picks for its contents (the CRC-32). When the loader still has parts
+ * of a kernel with the same ID and size, e.g. after the host was
+ * restarted, it keeps them. Its reply is u32 block size and a bitmap
+ * (bit i of byte i / 8) of the blocks it has received without errors,
+ * the host only sends the others. Booting a kernel or CMD_LOAD drop
+ * them, failed CMD_VERIFY checks and writes drop the blocks involved.
+ *
+ * A kernel that is still being produced (e.g. read from a pipe) is
+ * announced with an empty CMD_LOAD. Its blocks may then go anywhere
+ * below the loader, and CMD_SIZE sets the size once the host knows it.
+ * CMD_VERIFY and CMD_BOOT need the size.
+ *
+ * A BREAK condition on the line aborts the packet being received and
+ * puts the loader back to DEFAULT_BAUD without a reply. The host uses
+ * it to resynchronize after errors or a failed baud rate switch. A
+ * pause of more than half a second within a packet does the same, and
+ * after 5 seconds without a packet the loader asks for a kernel again.
+ * While it handles packets the PM watchdog resets the board if it
+ * hangs for 10 seconds. CMD_WATCHDOG keeps it running when the kernel
+ * starts, the kernel then has to use the watchdog service.
+ *
+ * While a kernel runs the loader can send frames to the host in between
+ * the console output:
+ *
+ *   ESCAPE, ESCAPE, type u8, length u16, payload[length]
+ *
+ * A semihosting frame (FRAME_SEMIHOST) starts with a SemihostOp. Every
+ * op but SH_WRITE is answered with
+ *
+ *   ESCAPE, ESCAPE, SEMIHOST_REPLY, result i32, errno i32,
+ *   length u16, data[length]
+ *
+ * The loader keeps console input that comes in front of the reply for
+ * the kernel's semihosting reads of the console.
+ *
+ * SH_WRITE and SH_UNREAD get no reply so writes can stream, a failed
+ * write is reported by SH_CLOSE instead. SH_READ asks for at least want bytes
+ * but takes up to max, the loader keeps the rest for the next reads.
+ *
+ * A profile frame (FRAME_PROFILE) carries PC/LR samples of the running
+ * kernel. Each sample is two varints (7 bits per byte, low bits first,
+ * bit 7 set on all but the last byte) of zigzag encoded differences:
+ * the PC relative to the previous PC in the frame (KERNEL_ADDR for the
+ * first) and the LR relative to the PC. The loader sends them from the
+ * FIQ handler in one burst into the empty transmit FIFO, so the whole
+ * frame is at most PROFILE_FRAME_MAX bytes.
+ *
+ * After CMD_GDB the kernel runs under the loader's GDB stub. The stub
+ * wraps everything it sends in FRAME_GDB frames, the host sends GDB's
+ * packets as they are.
+ *
+ * Channels are byte streams of the kernel besides the console, e.g.
+ * for logs or bulk data, the host makes each one a pty. A channel
+ * frame (FRAME_CHANNEL) starts with a ChannelOp and the channel number
+ * (below CHANNEL_MAX). Writes are cut into frames of CHANNEL_FRAME_MAX
+ * bytes, so console output and profile samples get the line in between.
+ * CH_READ polls the host for input and is answered with
+ *
+ *   ESCAPE, ESCAPE, CHANNEL_REPLY, length u16, data[length]
+ *
+ * Console input in front of the reply is kept like for semihosting. The
+ * loader gives up on a reply that doesn't come within a second.
+ *
+ * The host sends its replies (and GDB's packets) ahead of console input
+ * it still has queued, console input never goes in the middle of one.
+ */
+
+#ifndef RASPBOOTIN_PROTOCOL_H
+#define RASPBOOTIN_PROTOCOL_H
+
+#include <stdint.h>
+
+namespace Protocol {
+    enum Command : uint8_t {
+	// u32 size: announce a kernel of size bytes, empty: size unknown
+	CMD_LOAD  = 'L',
+	// u32 size: the size of a kernel announced without one
+	CMD_SIZE  = 'Z',
+	// u32 size, u32 id: CMD_LOAD, returns what the loader already has
+	CMD_RESUME = 'U',
+	// u32 offset, data: store data at offset into the kernel
+	CMD_BLOCK = 'B',
+	// u32 offset, u8 parity, u32 CRC-32 of both, codewords: CMD_BLOCK
+	// with FEC
+	CMD_BLOCK_FEC = 'E',
+	// u32 baud: switch baud rate after the reply has been sent
+	CMD_BAUD  = 'R',
+	// any payload, echoed back in the reply
+	CMD_PING  = 'P',
+	// start the kernel after the reply has been sent
+	CMD_BOOT  = 'G',
+	// u32 addr, u32 count: returns count words read from addr
+	CMD_PEEK  = 'r',
+	// u32 addr, u32 words[]: write the words to addr
+	CMD_POKE  = 'w',
+	// u32 addr, data: copy data to addr
+	CMD_WRITE = 'W',
+	// u32 addr, u32 len: returns u8 DumpEncoding, len bytes from addr
+	CMD_DUMP  = 'D',
+	// u32 addr, u32 len, u8 value: fill len bytes at addr with value
+	CMD_FILL  = 'F',
+	// u32 addr, u32 len: returns the u32 CRC-32 of len bytes at addr
+	CMD_CRC   = 'C',
+	// u32 addr: call addr like a kernel after the reply has been sent
+	CMD_GO    = 'J',
+	// u32 hz: sample the kernel's PC hz times per second, 0 is off
+	CMD_PROFILE = 'S',
+	// stop at the entry of the next kernel in the GDB stub
+	CMD_GDB   = 'd',
+	// u32 block size, u32 CRC-32, u32 XXH32[]: check the loaded kernel
+	CMD_VERIFY = 'V',
+	// u32 msecs: leave the watchdog running for the kernel, 0 is off
+	CMD_WATCHDOG = 'T',
+	// returns u32 Feature flags
+	CMD_FEATURES = 'Q',
+    };
+
+    // what CMD_FEATURES reports
+    enum Feature : uint32_t {
+	// CMD_VERIFY
+	FEATURE_VERIFY = 1 << 0,
+	// CMD_BLOCK_FEC
+	FEATURE_FEC = 1 << 1,
+    };
+
+    enum DumpEncoding : uint8_t {
+	DUMP_RAW = 0,
+	DUMP_LZ  = 1,
+    };
+
+    enum Frame : uint8_t {
+	// three in a row ask for a kernel, two start a frame
+	ESCAPE = 0x03,
+	// u8 SemihostOp, arguments
+	FRAME_SEMIHOST = 'H',
+	// the host's reply to a semihosting frame, after 2 ESCAPEs
+	SEMIHOST_REPLY = 'h',
+	// PC/LR samples, no reply
+	FRAME_PROFILE = 'S',
+	// GDB remote serial protocol data from the stub
+	FRAME_GDB = 'g',
+	// u8 ChannelOp, u8 channel, arguments
+	FRAME_CHANNEL = 'c',
+	// the host's reply to CH_READ, after 2 ESCAPEs
+	CHANNEL_REPLY = 0x1E,
+    };
+
+    enum ChannelOp : uint8_t {
+	// data: no reply
+	CH_WRITE = 'w',
+	// u16 max: returns up to max bytes the host has for the channel
+	CH_READ  = 'r',
+    };
+
+    enum SemihostOp : uint8_t {
+	// u32 mode (fopen() modes 0-11) in place of the handle, name:
+	// returns a handle
+	SH_OPEN  = 1,
+	// u32 handle
+	SH_CLOSE = 2,
+	// u32 handle, data: no reply
+	SH_WRITE = 3,
+	// u32 handle, u32 want, u32 max: returns the bytes read
+	SH_READ  = 4,
+	// u32 handle, u32 position
+	SH_SEEK  = 5,
+	// u32 handle: returns the file length
+	SH_FLEN  = 6,
+	// u32 handle, u32 count: the last count bytes read were not used,
+	// move the file position back (no reply)
+	SH_UNREAD = 7,
+    };
+
+    enum Status : uint8_t {
+	ACK = 'A',
+	NAK = 'N',
+    };
+
+    // rx errors, same bits as UART0_RSRECR
+    enum RxError : uint8_t {
+	RX_FE = 1 << 0, // framing error
+	RX_PE = 1 << 1, // parity error
+	RX_BE = 1 << 2, // break
+	RX_OE = 1 << 3, // overrun, bytes were lost
+    };
+
+    enum {
+	DEFAULT_BAUD = 115200,
+	HEADER_SIZE = 3,
+	REPLY_HEADER_SIZE = 4,
+	FRAME_HEADER_SIZE = 5,
+	// offset, parity and their CRC-32 in front of the codewords of
+	// CMD_BLOCK_FEC
+	FEC_HEADER_SIZE = 9,
+	SEMIHOST_REPLY_SIZE = 13,
+	CHANNEL_REPLY_SIZE = 5,
+	// largest payload the loader accepts
+	MAX_PAYLOAD = 16384 + 4,
+	// most bytes a CMD_DUMP may ask for
+	DUMP_MAX = 16384,
+	// most words a CMD_PEEK may ask for
+	PEEK_MAX = (MAX_PAYLOAD - 4) / 4,
+	// size of a profile frame including the header, one less than the
+	// UART FIFO so a byte the interrupted code is about to write fits
+	PROFILE_FRAME_MAX = 15,
+	PROFILE_MAX_HZ = 10000,
+	// number of channels
+	CHANNEL_MAX = 8,
+	// most data bytes in a channel frame, interrupts are masked while
+	// one goes out
+	CHANNEL_FRAME_MAX = 64,
+	// most damaged blocks a CMD_VERIFY reply lists
+	VERIFY_MAX_BAD = 64,
+	// kernel is loaded here
+	KERNEL_ADDR = 0x8000,
+    };
+
+    static inline uint16_t get_u16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+    }
+
+    static inline uint32_t get_u32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static inline void put_u16(uint8_t *p, uint16_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+    }
+
+    static inline void put_u32(uint8_t *p, uint32_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+    }
+}
+
+#endif // #ifndef RASPBOOTIN_PROTOCOL_H
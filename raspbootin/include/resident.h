@@ -0,0 +1,54 @@
+/* resident.h - the loader stays in memory while the kernel runs */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_RESIDENT_H
+#define RASPBOOTIN_RESIDENT_H
+
+#include <stdint.h>
+#include <atag.h>
+
+extern "C" {
+    /*
+     * Return to the loader from a kernel (boot.S). Switches to SVC mode
+     * and the loader's stack, turns off MMU and caches and continues in
+     * loader_reenter().
+     * int code: exit code of the kernel
+     */
+    void Reenter(int code) __attribute__((noreturn));
+
+    // second half of Reenter
+    void loader_reenter(int code) __attribute__((noreturn));
+}
+
+namespace Resident {
+    /*
+     * Remember how the loader was started, every kernel gets the same.
+     * uint32_t r0, r1: registers passed by the firmware
+     * const Header *atags: ATAGs passed by the firmware
+     * bool flow_control: RTS/CTS flow control is enabled
+     */
+    void init(uint32_t r0, uint32_t r1, const Header *atags,
+	      bool flow_control);
+
+    /*
+     * Load kernels from the host and boot them, forever.
+     */
+    void run(void) __attribute__((noreturn));
+}
+
+#endif // #ifndef RASPBOOTIN_RESIDENT_H
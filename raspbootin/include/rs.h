@@ -0,0 +1,270 @@
+/* rs.h - Reed-Solomon forward error correction for kernel blocks */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* This header is shared with raspbootcom and must only depend on
+ * <stddef.h> and <stdint.h>.
+ *
+ * A systematic Reed-Solomon code over GF(2^8) (polynomial 0x11D,
+ * generator roots alpha^0 to alpha^(parity-1)). Data is cut into
+ * codewords of up to 255 bytes: 255 - parity data bytes followed by
+ * parity bytes, the last codeword is shortened. Each codeword can
+ * correct parity / 2 damaged bytes.
+ *
+ * The loader computes the syndromes byte by byte while a codeword is
+ * received (Decoder::feed()) so the receive loop keeps up with the
+ * line, the expensive part (Decoder::correct()) only runs for damaged
+ * codewords.
+ */
+
+#ifndef RASPBOOTIN_RS_H
+#define RASPBOOTIN_RS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace RS {
+    enum {
+	// bytes in a full codeword
+	CODEWORD_MAX = 255,
+	// most parity bytes per codeword
+	PARITY_MAX = 32,
+    };
+
+    struct Tables {
+	// alpha^i, twice so sums of two logarithms need no reduction
+	uint8_t exp[512];
+	uint8_t log[256];
+    };
+
+    static constexpr Tables make_tables() {
+	Tables t = {};
+	uint32_t x = 1;
+	for(uint32_t i = 0; i < 255; ++i) {
+	    t.exp[i] = x;
+	    t.exp[i + 255] = x;
+	    t.log[x] = i;
+	    x <<= 1;
+	    if (x & 0x100) x ^= 0x11D;
+	}
+	t.exp[510] = t.exp[0];
+	t.exp[511] = t.exp[1];
+	return t;
+    }
+
+    static constexpr Tables gf = make_tables();
+
+    static inline uint8_t mul(uint8_t a, uint8_t b) {
+	if (a == 0 || b == 0) return 0;
+	return gf.exp[gf.log[a] + gf.log[b]];
+    }
+
+    // b must not be 0
+    static inline uint8_t div(uint8_t a, uint8_t b) {
+	if (a == 0) return 0;
+	return gf.exp[gf.log[a] + 255 - gf.log[b]];
+    }
+
+    /*
+     * Size of encoded data.
+     * size_t len: bytes of data
+     * uint32_t parity: parity bytes per codeword (1 - PARITY_MAX)
+     *
+     * Returns:
+     * size_t: bytes of all codewords
+     */
+    static constexpr size_t encoded_size(size_t len, uint32_t parity) {
+	return len + (len + CODEWORD_MAX - parity - 1) /
+	    (CODEWORD_MAX - parity) * parity;
+    }
+
+    /*
+     * Encode data into codewords.
+     * const uint8_t *data: the data
+     * size_t len: bytes of data
+     * uint32_t parity: parity bytes per codeword (1 - PARITY_MAX)
+     * uint8_t *out: encoded_size(len, parity) bytes
+     */
+    static inline void encode(const uint8_t *data, size_t len,
+			      uint32_t parity, uint8_t *out) {
+	// generator polynomial, highest coefficient (always 1) first
+	uint8_t g[PARITY_MAX + 1] = {1};
+	for(uint32_t j = 0; j < parity; ++j) {
+	    // g *= x + alpha^j
+	    for(uint32_t i = j + 1; i > 0; --i) {
+		g[i] ^= mul(g[i - 1], gf.exp[j]);
+	    }
+	}
+
+	while(len > 0) {
+	    size_t k = CODEWORD_MAX - parity;
+	    if (k > len) k = len;
+	    // remainder of data * x^parity divided by g
+	    uint8_t rem[PARITY_MAX] = {};
+	    for(size_t n = 0; n < k; ++n) {
+		uint8_t byte = data[n];
+		uint8_t feedback = byte ^ rem[0];
+		for(uint32_t i = 0; i + 1 < parity; ++i) {
+		    rem[i] = rem[i + 1] ^ mul(feedback, g[i + 1]);
+		}
+		rem[parity - 1] = mul(feedback, g[parity]);
+		*out++ = byte;
+	    }
+	    for(uint32_t i = 0; i < parity; ++i) {
+		*out++ = rem[i];
+	    }
+	    data += k;
+	    len -= k;
+	}
+    }
+
+    class Decoder {
+    public:
+	/*
+	 * Start a codeword.
+	 * uint32_t parity: parity bytes per codeword (1 - PARITY_MAX)
+	 */
+	void start(uint32_t parity) {
+	    parity_ = parity;
+	    for(uint32_t j = 0; j < parity; ++j) {
+		syndrome_[j] = 0;
+	    }
+	}
+
+	/*
+	 * Add the next byte of the codeword to the syndromes.
+	 * uint8_t byte: the byte as received
+	 */
+	void feed(uint8_t byte) {
+	    // S_j = S_j * alpha^j + byte, i.e. the codeword at alpha^j
+	    for(uint32_t j = 0; j < parity_; ++j) {
+		uint8_t s = syndrome_[j];
+		syndrome_[j] = (s ? gf.exp[gf.log[s] + j] : 0) ^ byte;
+	    }
+	}
+
+	/*
+	 * Correct the data of the codeword fed since start().
+	 * uint8_t *data: the data bytes of the codeword
+	 * uint32_t len: number of data bytes
+	 *
+	 * Returns:
+	 * int: bytes corrected (including parity bytes), -1 if the
+	 *      codeword has too many errors.
+	 */
+	int correct(uint8_t *data, uint32_t len) {
+	    uint32_t errors = 0;
+	    for(uint32_t j = 0; j < parity_; ++j) {
+		errors |= syndrome_[j];
+	    }
+	    if (errors == 0) return 0;
+
+	    // Berlekamp-Massey: error locator lambda, lowest power first
+	    uint8_t lambda[PARITY_MAX + 1] = {1};
+	    uint8_t prev[PARITY_MAX + 1] = {1};
+	    uint32_t order = 0;
+	    uint32_t shift = 1;
+	    uint8_t prev_discrepancy = 1;
+	    for(uint32_t r = 0; r < parity_; ++r) {
+		uint8_t d = syndrome_[r];
+		for(uint32_t i = 1; i <= order; ++i) {
+		    d ^= mul(lambda[i], syndrome_[r - i]);
+		}
+		if (d == 0) {
+		    ++shift;
+		    continue;
+		}
+		uint8_t coef = div(d, prev_discrepancy);
+		uint8_t old[PARITY_MAX + 1];
+		for(uint32_t i = 0; i <= parity_; ++i) {
+		    old[i] = lambda[i];
+		}
+		for(uint32_t i = 0; i + shift <= parity_; ++i) {
+		    lambda[i + shift] ^= mul(coef, prev[i]);
+		}
+		if (2 * order <= r) {
+		    order = r + 1 - order;
+		    for(uint32_t i = 0; i <= parity_; ++i) {
+			prev[i] = old[i];
+		    }
+		    prev_discrepancy = d;
+		    shift = 1;
+		} else {
+		    ++shift;
+		}
+	    }
+	    if (2 * order > parity_) return -1;
+
+	    // error evaluator omega = syndromes * lambda mod x^parity
+	    uint8_t omega[PARITY_MAX];
+	    for(uint32_t k = 0; k < order; ++k) {
+		uint8_t x = 0;
+		for(uint32_t i = 0; i <= k; ++i) {
+		    x ^= mul(lambda[i], syndrome_[k - i]);
+		}
+		omega[k] = x;
+	    }
+
+	    // Chien search: an error in the byte with power e (the last
+	    // byte has e = 0) makes lambda(alpha^-e) zero. term[i] is the
+	    // logarithm of lambda_i * alpha^(-e * i), stepped along with e.
+	    uint32_t n = len + parity_;
+	    int term[PARITY_MAX + 1];
+	    for(uint32_t i = 1; i <= order; ++i) {
+		term[i] = lambda[i] ? gf.log[lambda[i]] : -1;
+	    }
+	    uint32_t found = 0;
+	    for(uint32_t e = 0; e < n; ++e) {
+		uint8_t value = 1;
+		uint8_t odd = 0;
+		for(uint32_t i = 1; i <= order; ++i) {
+		    if (term[i] < 0) continue;
+		    uint8_t t = gf.exp[term[i]];
+		    value ^= t;
+		    if (i & 1) odd ^= t;
+		    term[i] -= i;
+		    if (term[i] < 0) term[i] += 255;
+		}
+		if (value != 0) continue;
+
+		// Forney: magnitude = X * omega(X^-1) / lambda'(X^-1)
+		// with X = alpha^e. odd is X^-1 * lambda'(X^-1).
+		uint32_t inv = (255 - e % 255) % 255;
+		uint8_t num = 0;
+		for(uint32_t k = 0; k < order; ++k) {
+		    if (omega[k]) {
+			num ^= gf.exp[(gf.log[omega[k]] + k * inv) % 255];
+		    }
+		}
+		if (odd == 0) return -1;
+		uint8_t magnitude = div(num, odd);
+		if (magnitude == 0) return -1;
+		uint32_t pos = n - 1 - e;
+		if (pos < len) data[pos] ^= magnitude;
+		++found;
+	    }
+	    if (found != order) return -1;
+	    return found;
+	}
+
+    private:
+	uint32_t parity_;
+	uint8_t syndrome_[PARITY_MAX];
+    };
+}
+
+#endif // #ifndef RASPBOOTIN_RS_H
@@ -0,0 +1,100 @@
+/* services.h - services of the resident loader for kernels */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_SERVICES_H
+#define RASPBOOTIN_SERVICES_H
+
+/* Raspbootin stays resident at RASPBOOTIN_LOADER_ADDR while the kernel
+ * it loaded runs (the kernel may use everything below that) and offers
+ * a few services through a jump table. This header is meant to be
+ * copied into kernels, it is plain C.
+ *
+ * The kernel finds the table in r3 (the 4th argument of its entry
+ * point) or at RASPBOOTIN_SERVICES_PTR. Check magic and version before
+ * use. New entries are only ever appended, size says how many the
+ * loader has.
+ *
+ * Services must be called from a privileged mode with the loader
+ * identity mapped. exit() (or returning from the kernel's entry point)
+ * puts the loader back in control: it turns off MMU and caches, resets
+ * the UART and asks the host for the next kernel. A BREAK from the host
+ * while the kernel waits in getc() does the same, as does a jump to
+ * RASPBOOTIN_REENTER_ADDR with the exit code in r0.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RASPBOOTIN_LOADER_ADDR		0x02000000
+#define RASPBOOTIN_REENTER_ADDR		(RASPBOOTIN_LOADER_ADDR + 4)
+#define RASPBOOTIN_SERVICES_PTR		(RASPBOOTIN_LOADER_ADDR + 8)
+
+#define RASPBOOTIN_SERVICES_MAGIC	0x53425052 // "RPBS"
+#define RASPBOOTIN_SERVICES_VERSION	1
+
+// exit code reported when a BREAK from the host ended the kernel
+#define RASPBOOTIN_EXIT_BREAK		(-0x7FFFFFFF - 1)
+// exit code reported when the kernel crashed
+#define RASPBOOTIN_EXIT_CRASH		(-0x7FFFFFFF)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct raspbootin_services {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;	// sizeof(struct raspbootin_services) of the loader
+
+    // UART0
+    void (*putc)(int c);
+    // blocks until a byte arrives, a BREAK returns to the loader
+    int (*getc)(void);
+    // -1 if nothing was received
+    int (*try_getc)(void);
+    void (*write)(const void *buf, size_t len);
+
+    // 1MHz system timer
+    uint32_t (*timer_now)(void);
+    void (*delay)(uint32_t usecs);
+
+    // cache maintenance
+    void (*dcache_clean)(const void *addr, size_t len);
+    void (*dcache_invalidate)(void *addr, size_t len);
+    void (*icache_invalidate)(void);
+
+    // return to the loader
+    void (*exit)(int code) __attribute__((noreturn));
+
+    // Byte streams to the host besides the console, channel 0-7. Both
+    // return the bytes transferred or -1 for a bad channel. read()
+    // doesn't wait, it returns 0 if the host has nothing.
+    int (*channel_write)(unsigned channel, const void *buf, size_t len);
+    int (*channel_read)(unsigned channel, void *buf, size_t len);
+
+    // (Re)start the board's watchdog, 0 stops it. Kernels booted with
+    // raspbootcom --watchdog must call it before the time runs out.
+    // msecs are limited to 15999.
+    void (*watchdog)(unsigned msecs);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // #ifndef RASPBOOTIN_SERVICES_H
@@ -0,0 +1,48 @@
+/* string.h - memory primitives */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_STRING_H
+#define RASPBOOTIN_STRING_H
+
+#include <stddef.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+// Dispatch to the fastest variant for the model, see mem_init().
+void *memcpy(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+// LDM/STM burst variants, usable on every model and before relocation.
+void *memcpy_armv6(void *dst, const void *src, size_t n);
+void *memset_armv6(void *dst, int c, size_t n);
+
+// NEON variants, ARMv7 only and only after neon_enable().
+void *memcpy_neon(void *dst, const void *src, size_t n);
+void *memset_neon(void *dst, int c, size_t n);
+void neon_enable(void);
+
+/*
+ * Select the memcpy/memset variants for arch_info. Must be called
+ * after arch_info is set up and before the first memcpy/memset that
+ * should benefit from NEON.
+ */
+void mem_init(void);
+__END_DECLS
+
+#endif // #ifndef RASPBOOTIN_STRING_H
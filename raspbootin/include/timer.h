@@ -0,0 +1,40 @@
+/* timer.h - system timer */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_TIMER_H
+#define RASPBOOTIN_TIMER_H
+
+#include <stdint.h>
+
+namespace Timer {
+    /*
+     * Read the free running 1MHz system timer.
+     *
+     * Returns:
+     * uint32_t: time in microseconds, wraps every ~71 minutes.
+     */
+    uint32_t now(void);
+
+    /*
+     * Busy wait.
+     * uint32_t usecs: microseconds to wait
+     */
+    void delay(uint32_t usecs);
+}
+
+#endif // #ifndef RASPBOOTIN_TIMER_H
@@ -22,10 +22,39 @@
 #include <stdint.h>
 
 namespace UART {
+    // error flags in the upper bits of getc_raw()
+    enum {
+	DR_FE = 1 << 8,  // framing error
+	DR_PE = 1 << 9,  // parity error
+	DR_BE = 1 << 10, // break
+	DR_OE = 1 << 11, // overrun
+	DR_ERRORS = DR_FE | DR_PE | DR_BE | DR_OE,
+    };
+
     /*
      * Initialize UART0.
+     * bool flow_control: enable automatic RTS/CTS flow control
+     */
+    void init(bool flow_control);
+
+    /*
+     * Change the baud rate. Waits for pending output to be send first.
+     * uint32_t baud: new baud rate
+     *
+     * Returns:
+     * bool: false if the clock can't generate the baud rate.
+     */
+    bool set_baud(uint32_t baud);
+
+    /*
+     * Highest baud rate the UART clock can generate.
      */
-    void init(void);
+    uint32_t max_baud(void);
+
+    /*
+     * Wait for all output to be send.
+     */
+    void flush(void);
 
     /*
      * Transmit a byte via UART0.
@@ -33,6 +62,24 @@ namespace UART {
      */
     void putc(uint8_t byte);
 
+    /*
+     * Transmit up to 15 bytes without waiting, all or nothing. Used
+     * from the FIQ handler, so the bytes can't get mixed with the
+     * output of the interrupted code.
+     * const uint8_t *data: bytes to send
+     * uint32_t len: number of bytes
+     *
+     * Returns:
+     * bool: false if the transmit FIFO is not empty (or disabled).
+     */
+    bool put_burst(const uint8_t *data, uint32_t len);
+
+    /*
+     * Hold the line low (BREAK) for a while, outside of the data. The
+     * host sees it as a BREAK condition, not as a byte.
+     */
+    void send_break(void);
+
     /*
      * Receive a byte via UART0.
      *
@@ -41,6 +88,86 @@ namespace UART {
      */
     uint8_t getc(void);
 
+    /*
+     * Wait for the start of a reply of the host (ESCAPE, ESCAPE, type).
+     * Whatever comes in front of it is console input, it is kept for
+     * console_getc() and console_getc_raw().
+     * uint8_t type: Protocol::Frame of the reply
+     * uint32_t usecs: how long to wait, 0 for as long as it takes
+     *
+     * Returns:
+     * bool: false if the reply didn't come in time.
+     */
+    bool wait_reply(uint8_t type, uint32_t usecs);
+
+    /*
+     * Receive a byte of console input, the bytes kept by wait_reply()
+     * come first.
+     *
+     * Returns:
+     * uint8_t: byte received.
+     */
+    uint8_t console_getc(void);
+
+    /*
+     * Receive a byte of console input and its error flags, the bytes
+     * kept by wait_reply() come first (without flags).
+     *
+     * Returns:
+     * uint32_t: byte received in bits 0-7, DR_* error flags.
+     */
+    uint32_t console_getc_raw(void);
+
+    /*
+     * Check for console input, kept or received.
+     *
+     * Returns:
+     * bool: true if console_getc() won't block.
+     */
+    bool can_console_getc(void);
+
+    /*
+     * Check for received data.
+     *
+     * Returns:
+     * bool: true if getc() won't block.
+     */
+    bool can_getc(void);
+
+    /*
+     * Receive a byte and its error flags via UART0.
+     *
+     * Returns:
+     * uint32_t: byte received in bits 0-7, DR_* error flags.
+     */
+    uint32_t getc_raw(void);
+
+    /*
+     * Receive a byte and its error flags, giving up after a while.
+     * uint32_t &data: byte received in bits 0-7, DR_* error flags
+     * uint32_t usecs: how long to wait
+     *
+     * Returns:
+     * bool: false if nothing arrived in time.
+     */
+    bool getc_timeout(uint32_t &data, uint32_t usecs);
+
+    /*
+     * Receive errors since the last call.
+     *
+     * Returns:
+     * uint8_t: Protocol::RxError flags (UART0_RSRECR layout).
+     */
+    uint8_t rx_errors(void);
+
+    /*
+     * Receive errors since the last rx_errors(), without clearing them.
+     *
+     * Returns:
+     * uint8_t: Protocol::RxError flags (UART0_RSRECR layout).
+     */
+    uint8_t peek_rx_errors(void);
+
     /*
      * print a string to the UART one character at a time
      * const char *str: 0-terminated string
@@ -0,0 +1,43 @@
+/* watchdog.h - PM watchdog that resets a hung board */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef RASPBOOTIN_WATCHDOG_H
+#define RASPBOOTIN_WATCHDOG_H
+
+#include <stdint.h>
+
+namespace Watchdog {
+    enum {
+	// the counter has 20 bits of 1/65536s
+	MAX_MSECS = 15999,
+    };
+
+    /*
+     * (Re)start the watchdog. The board resets unless start() or stop()
+     * is called again in time.
+     * uint32_t msecs: time until the reset, at most MAX_MSECS
+     */
+    void start(uint32_t msecs);
+
+    /*
+     * Stop the watchdog.
+     */
+    void stop(void);
+}
+
+#endif // #ifndef RASPBOOTIN_WATCHDOG_H
@@ -0,0 +1,112 @@
+/* xxh32.h - xxHash32 digests of kernel blocks */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* This header is shared with raspbootcom and must only depend on
+ * <stddef.h> and <stdint.h>.
+ *
+ * XXH32 as specified by Yann Collet. The bulk of the work are the four
+ * independent lanes of each 16 byte stripe, hash() takes the function
+ * that runs them so the loader can use its NEON version.
+ */
+
+#ifndef RASPBOOTIN_XXH32_H
+#define RASPBOOTIN_XXH32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace XXH32 {
+    enum : uint32_t {
+	PRIME1 = 0x9E3779B1,
+	PRIME2 = 0x85EBCA77,
+	PRIME3 = 0xC2B2AE3D,
+	PRIME4 = 0x27D4EB2F,
+	PRIME5 = 0x165667B1,
+	STRIPE_SIZE = 16,
+    };
+
+    // runs count stripes from p through the lanes v
+    typedef void (*StripeFn)(uint32_t v[4], const uint8_t *p, size_t count);
+
+    static inline uint32_t rotl(uint32_t x, int r) {
+	return (x << r) | (x >> (32 - r));
+    }
+
+    static inline uint32_t read32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static inline void stripes(uint32_t v[4], const uint8_t *p,
+			       size_t count) {
+	uint32_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+	while(count-- > 0) {
+	    v1 = rotl(v1 + read32(p) * PRIME2, 13) * PRIME1;
+	    v2 = rotl(v2 + read32(p + 4) * PRIME2, 13) * PRIME1;
+	    v3 = rotl(v3 + read32(p + 8) * PRIME2, 13) * PRIME1;
+	    v4 = rotl(v4 + read32(p + 12) * PRIME2, 13) * PRIME1;
+	    p += STRIPE_SIZE;
+	}
+	v[0] = v1;
+	v[1] = v2;
+	v[2] = v3;
+	v[3] = v4;
+    }
+
+    /*
+     * Hash a block.
+     * const void *data: the data
+     * size_t len: length of the data
+     * uint32_t seed: seed of the hash
+     * StripeFn fn: function running the lanes
+     *
+     * Returns:
+     * uint32_t: the digest
+     */
+    static inline uint32_t hash(const void *data, size_t len,
+				uint32_t seed = 0, StripeFn fn = stripes) {
+	const uint8_t *p = (const uint8_t*)data;
+	uint32_t h;
+	if (len >= STRIPE_SIZE) {
+	    uint32_t v[4] = {
+		seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1,
+	    };
+	    size_t count = len / STRIPE_SIZE;
+	    fn(v, p, count);
+	    p += count * STRIPE_SIZE;
+	    h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+	} else {
+	    h = seed + PRIME5;
+	}
+	h += len;
+	len %= STRIPE_SIZE;
+	for(; len >= 4; len -= 4, p += 4) {
+	    h = rotl(h + read32(p) * PRIME3, 17) * PRIME4;
+	}
+	for(; len > 0; --len) {
+	    h = rotl(h + *p++ * PRIME5, 11) * PRIME1;
+	}
+	h ^= h >> 15;
+	h *= PRIME2;
+	h ^= h >> 13;
+	h *= PRIME3;
+	h ^= h >> 16;
+	return h;
+    }
+}
+
+#endif // #ifndef RASPBOOTIN_XXH32_H
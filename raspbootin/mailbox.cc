@@ -0,0 +1,82 @@
+/* mailbox.cc - property interface to the VideoCore firmware */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Reference material:
+ * https://github.com/raspberrypi/firmware/wiki/Mailbox-property-interface
+ */
+
+#include <stdint.h>
+#include <mmio.h>
+#include <archinfo.h>
+#include <mailbox.h>
+
+namespace Mailbox {
+    enum {
+	// The base address for mailbox 0.
+	MAILBOX_OFFSET = 0x0000B880,
+    };
+
+    typedef MMIO::Register<MAILBOX_OFFSET + 0x00> MAILBOX_READ;
+    typedef MMIO::Register<MAILBOX_OFFSET + 0x18> MAILBOX_STATUS;
+    typedef MMIO::Register<MAILBOX_OFFSET + 0x20> MAILBOX_WRITE;
+
+    typedef MMIO::Field<MAILBOX_STATUS, 30> STATUS_EMPTY;
+    typedef MMIO::Field<MAILBOX_STATUS, 31> STATUS_FULL;
+
+    enum {
+	// property tags, ARM to VideoCore
+	CHANNEL_PROPERTY = 8,
+
+	REQUEST  = 0x00000000,
+	RESPONSE_OK = 0x80000000,
+	TAG_GET_CLOCK_RATE = 0x00030002,
+	TAG_END = 0,
+    };
+
+    /*
+     * Send a property buffer and wait for the answer.
+     * uint32_t *buf: 16 byte aligned property buffer
+     *
+     * Returns:
+     * bool: true if the firmware processed the buffer.
+     */
+    static bool property(volatile uint32_t *buf) {
+	uint32_t addr = (uint32_t)buf | arch_info->bus_alias;
+	{
+	    MMIO::Guard guard;
+	    while(STATUS_FULL::read()) { }
+	    MAILBOX_WRITE::write(addr | CHANNEL_PROPERTY);
+	    while(true) {
+		while(STATUS_EMPTY::read()) { }
+		uint32_t data = MAILBOX_READ::read();
+		if (data == (addr | CHANNEL_PROPERTY)) break;
+	    }
+	}
+	return buf[1] == RESPONSE_OK;
+    }
+
+    uint32_t get_clock_rate(Clock clock) {
+	volatile uint32_t buf[8] __attribute__((aligned(16))) = {
+	    sizeof(buf), REQUEST,
+	    TAG_GET_CLOCK_RATE, 8, 0, clock, 0,
+	    TAG_END,
+	};
+	if (!property(buf)) return 0;
+	return buf[6];
+    }
+}
@@ -21,6 +21,9 @@
 #include <uart.h>
 #include <kprintf.h>
 #include <atag.h>
+#include <digest.h>
+#include <string.h>
+#include <resident.h>
 
 extern "C" {
     // kernel_main gets called from boot.S. Declaring it extern "C" avoid
@@ -28,21 +31,11 @@ extern "C" {
     void kernel_main(uint32_t r0, uint32_t r1, const Header *atags);
 }
 
+const char hello[] = "\r\nRaspbootin V1.3\r\n";
 
-#define LOADER_ADDR 0x2000000
-
-const char hello[] = "\r\nRaspbootin V1.1\r\n";
-const char halting[] = "\r\n*** system halting ***";
-
-typedef void (*entry_fn)(uint32_t r0, uint32_t r1, const Header *atags);
-
-static constexpr ArchInfo arch_infos[ArchInfo::NUM_ARCH_INFOS] = {
-    ArchInfo("Raspberry Pi b", 0x20000000, 16, 1),
-    ArchInfo("Raspberry Pi b+", 0x20000000, 47, 0),
-    ArchInfo("Raspberry Pi b 2", 0x3F000000, 47, 0),
-};
-
+#ifndef RASPBOOTIN_BOARD
 const ArchInfo *arch_info;
+#endif
 
 const char *find(const char *str, const char *token) {
     while(*str) {
@@ -65,58 +58,43 @@ const char *find(const char *str, const char *token) {
 
 // kernel main function, it all begins here
 void kernel_main(uint32_t r0, uint32_t r1, const Header *atags) {
+    const Cmdline *cmdline = atags->find<Cmdline>();
+#ifndef RASPBOOTIN_BOARD
     // Fixgure out what kind of Raspberry we are booting on
     // default to basic Raspberry Pi
     arch_info = &arch_infos[ArchInfo::RPI];
-    const Cmdline *cmdline = atags->find<Cmdline>();
     if (find(cmdline->cmdline, "bcm2708.disk_led_gpio=47")) {
 	arch_info = &arch_infos[ArchInfo::RPIplus];
     }
     if (find(cmdline->cmdline, "bcm2709.disk_led_gpio=47")) {
 	arch_info = &arch_infos[ArchInfo::RPI2];
     }
-    
-    UART::init();
-again:
+#endif
+    mem_init();
+    Digest::init();
+
+    // RTS/CTS flow control is opt-in, add raspbootin.crtscts to
+    // cmdline.txt to enable it.
+    bool flow_control = find(cmdline->cmdline, "raspbootin.crtscts") != NULL;
+    // On the original Pi B GPIO 16 (CTS0) is the ACT LED and not on the
+    // header, so the option is refused there.
+    bool no_cts = flow_control && arch_info->disk_led_gpio == 16;
+    if (no_cts) flow_control = false;
+    UART::init(flow_control);
     kprintf(hello);
     kprintf("######################################################################\n");
     kprintf("R0 = %#010lx, R1 = %#010lx, ATAGs @ %p\n", r0, r1, atags);
     atags->print_all();
-    kprintf("Detected '%s'\n", arch_info->model);
-    kprintf("######################################################################\n");
-
-    // request kernel by sending 3 breaks
-    UART::puts("\x03\x03\x03");
-
-    // get kernel size
-    uint32_t size = UART::getc();
-    size |= UART::getc() << 8;
-    size |= UART::getc() << 16;
-    size |= UART::getc() << 24;
-
-    if (0x8000 + size > LOADER_ADDR) {
-	UART::puts("SE");
-	goto again;
-    } else {
-	UART::puts("OK");
-    }
-    
-    // get kernel
-    uint8_t *kernel = (uint8_t*)0x8000;
-    while(size-- > 0) {
-	*kernel++ = UART::getc();
+    kprintf("Detected '%s', max %lu baud\n", arch_info->model,
+	    UART::max_baud());
+    if (flow_control) kprintf("RTS/CTS flow control enabled\n");
+    if (no_cts) {
+	kprintf("No RTS/CTS flow control, GPIO 16 is the ACT LED here\n");
     }
+    kprintf("######################################################################\n");
 
-    // Kernel is loaded at 0x8000, call it via function pointer
-    UART::puts("booting...");
-    entry_fn fn = (entry_fn)0x8000;
-    fn(r0, r1, atags);
-
-    // fn() should never return. But it might, so make sure we catch it.
-    // Wait a bit
-    for(int i = 0; i < 10000000; ++i) { asm(""); }
-
-    // Say goodbye and return to boot.S to halt.
-    UART::puts(halting);
+    // Load and boot kernels, stay resident while they run.
+    Resident::init(r0, r1, atags, flow_control);
+    Resident::run();
 }
 
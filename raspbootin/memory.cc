@@ -0,0 +1,41 @@
+/* memory.cc - select memcpy/memset variants */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <archinfo.h>
+
+typedef void *(*memcpy_fn)(void *dst, const void *src, size_t n);
+typedef void *(*memset_fn)(void *dst, int c, size_t n);
+
+// defined in memory.S
+extern "C" {
+    extern memcpy_fn memcpy_impl;
+    extern memset_fn memset_impl;
+}
+
+void mem_init(void) {
+    if (arch_info->has_neon) {
+	neon_enable();
+	memcpy_impl = memcpy_neon;
+	memset_impl = memset_neon;
+    } else {
+	memcpy_impl = memcpy_armv6;
+	memset_impl = memset_armv6;
+    }
+}
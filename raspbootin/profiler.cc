@@ -0,0 +1,204 @@
+/* profiler.cc - sample the PC of a running kernel */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The ARM timer (SP804 like) fires the FIQ, which leaves the kernel's
+ * own IRQ handling alone. Each FIQ stores the interrupted PC and LR in
+ * a ring buffer and, if the UART's transmit FIFO is empty, sends as
+ * many of them as fit into one FRAME_PROFILE frame (see protocol.h).
+ * A kernel that keeps the FIFO busy gets fewer but longer bursts of
+ * samples, when the ring is full new samples are dropped.
+ */
+
+#include <stdint.h>
+#include <exceptions.h>
+#include <mailbox.h>
+#include <mmio.h>
+#include <protocol.h>
+#include <uart.h>
+#include <profiler.h>
+
+namespace Profiler {
+    using namespace Protocol;
+
+    enum {
+	// ARM timer
+	ARM_TIMER_OFFSET = 0x0000B400,
+	// interrupt controller
+	IRQ_OFFSET = 0x0000B000,
+
+	FIQ_SOURCE_ARM_TIMER = 64,
+
+	// the timer runs from the core clock, divided down to 1MHz
+	TIMER_HZ = 1000000,
+	DEFAULT_CORE_CLOCK = 250000000,
+
+	RING_SIZE = 4096,
+	// longest encoding of one sample
+	SAMPLE_MAX = 10,
+    };
+
+    typedef MMIO::Register<ARM_TIMER_OFFSET + 0x00> ARM_TIMER_LOAD;
+    typedef MMIO::Register<ARM_TIMER_OFFSET + 0x08> ARM_TIMER_CONTROL;
+    typedef MMIO::Register<ARM_TIMER_OFFSET + 0x0C> ARM_TIMER_IRQ_CLEAR;
+    typedef MMIO::Register<ARM_TIMER_OFFSET + 0x14> ARM_TIMER_MASKED_IRQ;
+    typedef MMIO::Register<ARM_TIMER_OFFSET + 0x18> ARM_TIMER_RELOAD;
+    typedef MMIO::Register<ARM_TIMER_OFFSET + 0x1C> ARM_TIMER_PREDIVIDER;
+    typedef MMIO::Register<IRQ_OFFSET + 0x20C> FIQ_CONTROL;
+
+    // ARM_TIMER_CONTROL bits
+    typedef MMIO::Field<ARM_TIMER_CONTROL, 1> CONTROL_32BIT;
+    typedef MMIO::Field<ARM_TIMER_CONTROL, 5> CONTROL_IRQ_ENABLE;
+    typedef MMIO::Field<ARM_TIMER_CONTROL, 7> CONTROL_ENABLE;
+
+    // FIQ_CONTROL fields
+    typedef MMIO::Field<FIQ_CONTROL, 0, 7> FIQ_SOURCE;
+    typedef MMIO::Field<FIQ_CONTROL, 7> FIQ_ENABLE;
+
+    static uint32_t rate;
+    static bool running;
+
+    // samples not sent yet
+    static uint32_t ring[RING_SIZE][2];
+    static uint32_t head;
+    static uint32_t tail;
+
+    bool configure(uint32_t hz) {
+	if (hz > PROFILE_MAX_HZ) return false;
+	rate = hz;
+	return true;
+    }
+
+    void start(void) {
+	if (rate == 0) return;
+	head = tail = 0;
+
+	uint32_t core = Mailbox::get_clock_rate(Mailbox::CLOCK_CORE);
+	if (core == 0) core = DEFAULT_CORE_CLOCK;
+	{
+	    MMIO::Guard guard;
+	    ARM_TIMER_CONTROL::write(0);
+	    ARM_TIMER_PREDIVIDER::write(core / TIMER_HZ - 1);
+	    ARM_TIMER_LOAD::write(TIMER_HZ / rate - 1);
+	    ARM_TIMER_RELOAD::write(TIMER_HZ / rate - 1);
+	    ARM_TIMER_IRQ_CLEAR::write(1);
+	    ARM_TIMER_CONTROL::write(CONTROL_32BIT::bits() |
+				     CONTROL_IRQ_ENABLE::bits() |
+				     CONTROL_ENABLE::bits());
+	    FIQ_CONTROL::write(FIQ_ENABLE::bits() |
+			       FIQ_SOURCE::bits(FIQ_SOURCE_ARM_TIMER));
+	}
+	running = true;
+	asm volatile("cpsie f");
+    }
+
+    static uint8_t *put_varint(uint8_t *p, int32_t x) {
+	// zigzag, small negative numbers become small too
+	uint32_t z = ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);
+	while(z >= 0x80) {
+	    *p++ = z | 0x80;
+	    z >>= 7;
+	}
+	*p++ = z;
+	return p;
+    }
+
+    /*
+     * Encode buffered samples into a frame.
+     * uint8_t *frame: PROFILE_FRAME_MAX bytes
+     * uint32_t &count: number of samples encoded
+     *
+     * Returns:
+     * uint32_t: size of the frame, 0 if there is nothing to send.
+     */
+    static uint32_t make_frame(uint8_t *frame, uint32_t &count) {
+	uint8_t *payload = frame + FRAME_HEADER_SIZE;
+	uint8_t *p = payload;
+	uint32_t prev = KERNEL_ADDR;
+	count = 0;
+	for(uint32_t i = tail; i != head; i = (i + 1) % RING_SIZE) {
+	    uint8_t sample[SAMPLE_MAX];
+	    uint8_t *end = put_varint(sample, ring[i][0] - prev);
+	    end = put_varint(end, ring[i][1] - ring[i][0]);
+	    uint32_t len = end - sample;
+	    if (p + len > frame + PROFILE_FRAME_MAX) break;
+	    for(uint32_t k = 0; k < len; ++k) *p++ = sample[k];
+	    prev = ring[i][0];
+	    ++count;
+	}
+	if (count == 0) return 0;
+	frame[0] = ESCAPE;
+	frame[1] = ESCAPE;
+	frame[2] = FRAME_PROFILE;
+	put_u16(&frame[3], p - payload);
+	return p - frame;
+    }
+
+    void stop(void) {
+	if (!running) {
+	    rate = 0;
+	    return;
+	}
+	{
+	    MMIO::Guard guard;
+	    FIQ_CONTROL::write(0);
+	    ARM_TIMER_CONTROL::write(0);
+	    ARM_TIMER_IRQ_CLEAR::write(1);
+	}
+	running = false;
+	rate = 0;
+    }
+
+    void flush(void) {
+	// the rest goes out the slow way
+	while(true) {
+	    uint8_t frame[PROFILE_FRAME_MAX];
+	    uint32_t count;
+	    uint32_t len = make_frame(frame, count);
+	    if (len == 0) break;
+	    for(uint32_t i = 0; i < len; ++i) UART::putc(frame[i]);
+	    tail = (tail + count) % RING_SIZE;
+	}
+    }
+}
+
+void profile_sample(uint32_t pc, uint32_t lr) {
+    using namespace Profiler;
+    {
+	// the interrupted code may be in the middle of another peripheral
+	MMIO::Guard guard;
+	// the kernel may have routed something else to the FIQ
+	if (!(ARM_TIMER_MASKED_IRQ::read() & 1)) {
+	    exception_handler(EXC_FIQ, pc);
+	}
+	ARM_TIMER_IRQ_CLEAR::write(1);
+    }
+
+    uint32_t next = (head + 1) % RING_SIZE;
+    if (next != tail) {
+	ring[head][0] = pc;
+	ring[head][1] = lr;
+	head = next;
+    }
+
+    uint8_t frame[PROFILE_FRAME_MAX];
+    uint32_t count;
+    uint32_t len = make_frame(frame, count);
+    if (len != 0 && UART::put_burst(frame, len)) {
+	tail = (tail + count) % RING_SIZE;
+    }
+}
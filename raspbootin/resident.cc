@@ -0,0 +1,163 @@
+/* resident.cc - the loader stays in memory while the kernel runs */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <archinfo.h>
+#include <cache.h>
+#include <commands.h>
+#include <exceptions.h>
+#include <gdbstub.h>
+#include <kprintf.h>
+#include <mmio.h>
+#include <profiler.h>
+#include <protocol.h>
+#include <services.h>
+#include <uart.h>
+#include <resident.h>
+#include <watchdog.h>
+
+extern "C" {
+    extern const raspbootin_services loader_services;
+}
+
+namespace Resident {
+    enum {
+	// interrupt controller
+	IRQ_OFFSET = 0x0000B000,
+
+	// room for a copy of the ATAGs
+	ATAGS_MAX = 4096,
+    };
+
+    typedef MMIO::Register<IRQ_OFFSET + 0x20C> FIQ_CONTROL;
+    typedef MMIO::Register<IRQ_OFFSET + 0x21C> DISABLE_IRQS_1;
+    typedef MMIO::Register<IRQ_OFFSET + 0x220> DISABLE_IRQS_2;
+    typedef MMIO::Register<IRQ_OFFSET + 0x224> DISABLE_BASIC_IRQS;
+
+    typedef int (*entry_fn)(uint32_t r0, uint32_t r1, const Header *atags,
+			    const raspbootin_services *services);
+
+    static uint32_t boot_r0;
+    static uint32_t boot_r1;
+    static Header *boot_atags;
+    static bool boot_flow_control;
+
+    // The kernel may overwrite the ATAGs, restore them for the next one.
+    static uint32_t atags_copy[ATAGS_MAX / 4];
+    static uint32_t atags_size;
+
+    void init(uint32_t r0, uint32_t r1, const Header *atags,
+	      bool flow_control) {
+	boot_r0 = r0;
+	boot_r1 = r1;
+	boot_atags = (Header*)atags;
+	boot_flow_control = flow_control;
+
+	// find the end tag
+	const uint32_t *p = (const uint32_t*)atags;
+	while(p[1] != NONE) {
+	    p += p[0];
+	}
+	uint32_t size = (p + 2 - (const uint32_t*)atags) * 4;
+	if (size <= sizeof(atags_copy)) {
+	    memcpy(atags_copy, atags, size);
+	    atags_size = size;
+	}
+    }
+
+    void run(void) {
+	while(true) {
+	    // request kernel with a BREAK, the 3 ESCAPEs are for links
+	    // that can't pass a BREAK on (ptys, raw TCP)
+	    UART::send_break();
+	    UART::puts("\x03\x03\x03");
+
+	    // load the kernel as directed by the host, who also decides
+	    // about profiling and debugging it
+	    Profiler::configure(0);
+	    GdbStub::arm(false);
+	    uint32_t entry;
+	    if (!Commands::run(RASPBOOTIN_LOADER_ADDR - Protocol::KERNEL_ADDR,
+			       entry)) {
+		// the host is gone, ask again
+		continue;
+	    }
+
+	    memcpy(boot_atags, atags_copy, atags_size);
+	    // semihosting and crash reports until the kernel has its own
+	    vectors_install();
+	    // the old kernel may have left code in the I cache
+	    icache_invalidate();
+	    Profiler::start();
+
+	    // Kernel is loaded at 0x8000 (or the host picked another
+	    // address), call it via function pointer
+	    UART::puts("booting...");
+	    if (GdbStub::armed()) {
+		// the kernel waits for GDB, it can't feed the watchdog
+		Watchdog::stop();
+		GdbStub::boot(entry, boot_r0, boot_r1, boot_atags,
+			      &loader_services);
+	    }
+	    entry_fn fn = (entry_fn)entry;
+	    int code = fn(boot_r0, boot_r1, boot_atags, &loader_services);
+
+	    // Returning is the same as calling exit().
+	    Reenter(code);
+	}
+    }
+}
+
+void loader_reenter(int code) {
+    // Quiet whatever interrupt sources the kernel left enabled.
+    {
+	MMIO::Guard guard;
+	Resident::FIQ_CONTROL::write(0);
+	Resident::DISABLE_IRQS_1::write(0xFFFFFFFF);
+	Resident::DISABLE_IRQS_2::write(0xFFFFFFFF);
+	Resident::DISABLE_BASIC_IRQS::write(0xFFFFFFFF);
+    }
+    // no samples while the UART is set up again
+    Profiler::stop();
+
+    // The kernel may have reprogrammed the UART and turned off NEON.
+    mem_init();
+    Watchdog::stop();
+    UART::init(Resident::boot_flow_control);
+    Profiler::flush();
+    GdbStub::exited(code);
+    if (code == RASPBOOTIN_EXIT_BREAK) {
+	kprintf("\r\n*** BREAK, back in Raspbootin ***\r\n");
+    } else if (code == RASPBOOTIN_EXIT_CRASH) {
+	kprintf("*** back in Raspbootin ***\r\n");
+    } else {
+	kprintf("\r\n*** kernel exited with code %d, back in Raspbootin ***\r\n",
+		code);
+    }
+    Resident::run();
+}
+
+void exception_handler(uint32_t type, uint32_t pc) {
+    static const char *names[] = {
+	"reset", "undefined instruction", "prefetch abort", "data abort",
+	"IRQ", "FIQ",
+    };
+    kprintf("\r\n*** kernel crashed: %s at %#010lx ***\r\n", names[type], pc);
+    Reenter(RASPBOOTIN_EXIT_CRASH);
+}
@@ -0,0 +1,281 @@
+/* semihost.cc - ARM semihosting over the serial link */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Reference material:
+ * ARM Developer Suite Debug Target Guide, Chapter 5: Semihosting
+ *
+ * The console (":tt") is served by the loader itself, file operations
+ * are forwarded to raspbootcom as frames (see protocol.h), which serves
+ * them from the directory given with --semihost.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <exceptions.h>
+#include <protocol.h>
+#include <resident.h>
+#include <timer.h>
+#include <uart.h>
+
+namespace Semihost {
+    using namespace Protocol;
+
+    enum {
+	SYS_OPEN = 0x01,
+	SYS_CLOSE = 0x02,
+	SYS_WRITEC = 0x03,
+	SYS_WRITE0 = 0x04,
+	SYS_WRITE = 0x05,
+	SYS_READ = 0x06,
+	SYS_READC = 0x07,
+	SYS_ISTTY = 0x09,
+	SYS_SEEK = 0x0A,
+	SYS_FLEN = 0x0C,
+	SYS_CLOCK = 0x10,
+	SYS_ERRNO = 0x13,
+	SYS_EXIT = 0x18,
+	SYS_EXIT_EXTENDED = 0x20,
+
+	ADP_Stopped_ApplicationExit = 0x20026,
+
+	// handle of ":tt"
+	CONSOLE = 1,
+	// read-ahead buffer, also the largest block per frame
+	READ_AHEAD = 16384,
+	WRITE_CHUNK = 16384,
+    };
+
+    static int32_t last_errno;
+
+    // data the host sent ahead for ahead_handle
+    static uint8_t ahead[READ_AHEAD];
+    static uint32_t ahead_handle;
+    static uint32_t ahead_pos;
+    static uint32_t ahead_len;
+
+    static void put_u32(uint32_t x) {
+	uint8_t buf[4];
+	Protocol::put_u32(buf, x);
+	for(int i = 0; i < 4; ++i) {
+	    UART::putc(buf[i]);
+	}
+    }
+
+    static uint32_t get_u32(void) {
+	uint8_t buf[4];
+	for(int i = 0; i < 4; ++i) {
+	    buf[i] = UART::getc();
+	}
+	return Protocol::get_u32(buf);
+    }
+
+    /*
+     * Start a frame, the caller sends the rest of the payload.
+     * uint8_t op: SemihostOp
+     * uint32_t handle: first argument
+     * uint16_t len: length of the payload after op and handle
+     */
+    static void start_frame(uint8_t op, uint32_t handle, uint16_t len) {
+	UART::putc(ESCAPE);
+	UART::putc(ESCAPE);
+	UART::putc(FRAME_SEMIHOST);
+	uint8_t buf[2];
+	put_u16(buf, 1 + 4 + len);
+	UART::putc(buf[0]);
+	UART::putc(buf[1]);
+	UART::putc(op);
+	put_u32(handle);
+    }
+
+    /*
+     * Wait for the host's reply.
+     * uint8_t *data: buffer for the data
+     * uint32_t max: size of the buffer, the rest is dropped
+     * uint32_t *len: bytes received
+     *
+     * Returns:
+     * int32_t: result of the operation
+     */
+    static int32_t get_reply(uint8_t *data = 0, uint32_t max = 0,
+			     uint32_t *len = 0) {
+	UART::wait_reply(SEMIHOST_REPLY, 0);
+	int32_t res = get_u32();
+	last_errno = get_u32();
+	uint16_t count = UART::getc();
+	count |= UART::getc() << 8;
+	for(uint32_t i = 0; i < count; ++i) {
+	    uint8_t byte = UART::getc();
+	    if (i < max) data[i] = byte;
+	}
+	if (len) *len = count < max ? count : max;
+	return res;
+    }
+
+    /*
+     * Forget the read-ahead data of a file.
+     * uint32_t handle: the file
+     * bool rewind: move the host's file position back to the data not
+     *              used yet
+     */
+    static void drop_ahead(uint32_t handle, bool rewind) {
+	if (ahead_handle != handle) return;
+	if (rewind && ahead_pos < ahead_len) {
+	    start_frame(SH_UNREAD, handle, 4);
+	    put_u32(ahead_len - ahead_pos);
+	}
+	ahead_handle = 0;
+	ahead_pos = ahead_len = 0;
+    }
+
+    static int32_t open(const char *name, uint32_t mode, uint32_t len) {
+	if (len == 3 && memcmp(name, ":tt", 3) == 0) return CONSOLE;
+	if (len > MAX_PAYLOAD - 6 || mode > 11) {
+	    last_errno = 22; // EINVAL
+	    return -1;
+	}
+	// the mode takes the place of the handle
+	start_frame(SH_OPEN, mode, len);
+	for(uint32_t i = 0; i < len; ++i) {
+	    UART::putc(name[i]);
+	}
+	return get_reply();
+    }
+
+    static int32_t close(uint32_t handle) {
+	if (handle == CONSOLE) return 0;
+	drop_ahead(handle, false);
+	start_frame(SH_CLOSE, handle, 0);
+	return get_reply();
+    }
+
+    // Returns the number of bytes not written.
+    static uint32_t write(uint32_t handle, const uint8_t *buf, uint32_t len) {
+	if (handle == CONSOLE) {
+	    for(uint32_t i = 0; i < len; ++i) {
+		UART::putc(buf[i]);
+	    }
+	    return 0;
+	}
+	drop_ahead(handle, true);
+	while(len > 0) {
+	    uint32_t count = len;
+	    if (count > WRITE_CHUNK) count = WRITE_CHUNK;
+	    start_frame(SH_WRITE, handle, count);
+	    for(uint32_t i = 0; i < count; ++i) {
+		UART::putc(buf[i]);
+	    }
+	    buf += count;
+	    len -= count;
+	}
+	return 0;
+    }
+
+    // Returns the number of bytes not read.
+    static uint32_t read(uint32_t handle, uint8_t *buf, uint32_t len) {
+	if (handle == CONSOLE) {
+	    // a line at a time
+	    uint32_t i = 0;
+	    while(i < len) {
+		buf[i] = UART::console_getc();
+		if (buf[i++] == '\n') break;
+	    }
+	    return len - i;
+	}
+
+	uint32_t done = 0;
+	while(done < len) {
+	    if (ahead_handle == handle && ahead_pos < ahead_len) {
+		uint32_t count = ahead_len - ahead_pos;
+		if (count > len - done) count = len - done;
+		memcpy(buf + done, ahead + ahead_pos, count);
+		ahead_pos += count;
+		done += count;
+		continue;
+	    }
+	    // Ask for what is missing, take as much as fits.
+	    uint32_t want = len - done;
+	    if (want > READ_AHEAD) want = READ_AHEAD;
+	    drop_ahead(ahead_handle, true);
+	    start_frame(SH_READ, handle, 8);
+	    put_u32(want);
+	    put_u32(READ_AHEAD);
+	    uint32_t count;
+	    if (get_reply(ahead, READ_AHEAD, &count) < 0 || count == 0) {
+		break; // error or end of file
+	    }
+	    ahead_handle = handle;
+	    ahead_pos = 0;
+	    ahead_len = count;
+	}
+	return len - done;
+    }
+
+    static int32_t seek(uint32_t handle, uint32_t pos) {
+	if (handle == CONSOLE) return 0;
+	drop_ahead(handle, false);
+	start_frame(SH_SEEK, handle, 4);
+	put_u32(pos);
+	return get_reply();
+    }
+
+    static int32_t flen(uint32_t handle) {
+	if (handle == CONSOLE) return 0;
+	start_frame(SH_FLEN, handle, 0);
+	return get_reply();
+    }
+}
+
+uint32_t semihost_call(uint32_t op, uint32_t param) {
+    using namespace Semihost;
+    uint32_t *args = (uint32_t*)param;
+    switch(op) {
+    case SYS_OPEN:
+	return open((const char*)args[0], args[1], args[2]);
+    case SYS_CLOSE:
+	return close(args[0]);
+    case SYS_WRITEC:
+	UART::putc(*(const char*)param);
+	return 0;
+    case SYS_WRITE0:
+	UART::puts((const char*)param);
+	return 0;
+    case SYS_WRITE:
+	return write(args[0], (const uint8_t*)args[1], args[2]);
+    case SYS_READ:
+	return read(args[0], (uint8_t*)args[1], args[2]);
+    case SYS_READC:
+	return UART::console_getc();
+    case SYS_ISTTY:
+	return args[0] == CONSOLE;
+    case SYS_SEEK:
+	return seek(args[0], args[1]);
+    case SYS_FLEN:
+	return flen(args[0]);
+    case SYS_CLOCK:
+	// centiseconds, wraps with the timer
+	return Timer::now() / 10000;
+    case SYS_ERRNO:
+	return last_errno;
+    case SYS_EXIT:
+	Reenter(param == ADP_Stopped_ApplicationExit ? 0 : 1);
+    case SYS_EXIT_EXTENDED:
+	Reenter(args[0] == ADP_Stopped_ApplicationExit ? args[1] : 1);
+    default:
+	return -1;
+    }
+}
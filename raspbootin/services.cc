@@ -0,0 +1,92 @@
+/* services.cc - services of the resident loader for kernels */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <stdint.h>
+#include <cache.h>
+#include <channel.h>
+#include <timer.h>
+#include <uart.h>
+#include <watchdog.h>
+#include <resident.h>
+#include <services.h>
+
+namespace Services {
+    static void putc(int c) {
+	UART::putc(c);
+    }
+
+    static int getc(void) {
+	// input that came in front of a reply of the host comes first
+	uint32_t data = UART::console_getc_raw();
+	if (data & UART::DR_BE) {
+	    // the host wants the loader back
+	    Reenter(RASPBOOTIN_EXIT_BREAK);
+	}
+	return data & 0xFF;
+    }
+
+    static int try_getc(void) {
+	if (!UART::can_console_getc()) return -1;
+	return getc();
+    }
+
+    static void write(const void *buf, size_t len) {
+	const uint8_t *p = (const uint8_t*)buf;
+	while(len-- > 0) {
+	    UART::putc(*p++);
+	}
+    }
+
+    static uint32_t timer_now(void) {
+	return Timer::now();
+    }
+
+    static void delay(uint32_t usecs) {
+	Timer::delay(usecs);
+    }
+
+    static void watchdog(unsigned msecs) {
+	if (msecs == 0) {
+	    Watchdog::stop();
+	} else {
+	    Watchdog::start(msecs);
+	}
+    }
+}
+
+extern "C" {
+    // LOADER_ADDR + 8 points here, see boot.S
+    const raspbootin_services loader_services = {
+	RASPBOOTIN_SERVICES_MAGIC,
+	RASPBOOTIN_SERVICES_VERSION,
+	sizeof(raspbootin_services),
+	Services::putc,
+	Services::getc,
+	Services::try_getc,
+	Services::write,
+	Services::timer_now,
+	Services::delay,
+	dcache_clean_range,
+	dcache_invalidate_range,
+	icache_invalidate,
+	Reenter,
+	Channel::write,
+	Channel::read,
+	Services::watchdog,
+    };
+}
@@ -0,0 +1,48 @@
+/* timer.cc - system timer */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Reference material:
+ * http://www.raspberrypi.org/wp-content/uploads/2012/02/BCM2835-ARM-Peripherals.pdf
+ * Chapter 12: System Timer
+ */
+
+#include <stdint.h>
+#include <mmio.h>
+#include <timer.h>
+
+namespace Timer {
+    enum {
+	// The system timer base address.
+	SYSTIMER_OFFSET = 0x00003000,
+    };
+
+    // Lower 32 bits of the free running counter.
+    typedef MMIO::Register<SYSTIMER_OFFSET + 0x04> SYSTIMER_CLO;
+
+    uint32_t now(void) {
+	MMIO::Guard guard;
+	return SYSTIMER_CLO::read();
+    }
+
+    void delay(uint32_t usecs) {
+	MMIO::Guard guard;
+	uint32_t start = SYSTIMER_CLO::read();
+	// unsigned arithmetic handles the wrap around
+	while(SYSTIMER_CLO::read() - start < usecs) { }
+    }
+}
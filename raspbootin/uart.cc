@@ -23,6 +23,9 @@
 
 #include <stdint.h>
 #include <mmio.h>
+#include <mailbox.h>
+#include <protocol.h>
+#include <timer.h>
 #include <uart.h>
 
 namespace UART {
@@ -30,37 +33,57 @@ namespace UART {
 	// The GPIO registers base address.
 	GPIO_OFFSET = 0x00200000,
 
-	// The offsets for reach register.
+	// The base address for UART.
+	UART0_OFFSET = GPIO_OFFSET + 0x00001000,
+    };
 
-	// Controls actuation of pull up/down to ALL GPIO pins.
-	GPPUD = (GPIO_OFFSET + 0x94),
+    // Function select for GPIO pins 10-19.
+    typedef MMIO::Register<GPIO_OFFSET + 0x04> GPFSEL1;
+    // Controls actuation of pull up/down to ALL GPIO pins.
+    typedef MMIO::Register<GPIO_OFFSET + 0x94> GPPUD;
+    // Controls actuation of pull up/down for specific GPIO pin.
+    typedef MMIO::Register<GPIO_OFFSET + 0x98> GPPUDCLK0;
 
-	// Controls actuation of pull up/down for specific GPIO pin.
-	GPPUDCLK0 = (GPIO_OFFSET + 0x98),
+    // The registers of the UART.
+    typedef MMIO::Register<UART0_OFFSET + 0x00> UART0_DR;
+    typedef MMIO::Register<UART0_OFFSET + 0x04> UART0_RSRECR;
+    typedef MMIO::Register<UART0_OFFSET + 0x18> UART0_FR;
+    typedef MMIO::Register<UART0_OFFSET + 0x24> UART0_IBRD;
+    typedef MMIO::Register<UART0_OFFSET + 0x28> UART0_FBRD;
+    typedef MMIO::Register<UART0_OFFSET + 0x2C> UART0_LCRH;
+    typedef MMIO::Register<UART0_OFFSET + 0x30> UART0_CR;
+    typedef MMIO::Register<UART0_OFFSET + 0x34> UART0_IFLS;
+    typedef MMIO::Register<UART0_OFFSET + 0x38> UART0_IMSC;
+    typedef MMIO::Register<UART0_OFFSET + 0x44> UART0_ICR;
 
-	// The base address for UART.
-	UART0_OFFSET = GPIO_OFFSET + 0x00001000,
+    // GPIO 16 and 17 in ALT3 are CTS0 and RTS0.
+    typedef MMIO::Field<GPFSEL1, 3 * (16 - 10), 3> FSEL_CTS0;
+    typedef MMIO::Field<GPFSEL1, 3 * (17 - 10), 3> FSEL_RTS0;
 
-	// The offsets for reach register for the UART.
-	UART0_DR     = (UART0_OFFSET + 0x00),
-	UART0_RSRECR = (UART0_OFFSET + 0x04),
-	UART0_FR     = (UART0_OFFSET + 0x18),
-	UART0_ILPR   = (UART0_OFFSET + 0x20),
-	UART0_IBRD   = (UART0_OFFSET + 0x24),
-	UART0_FBRD   = (UART0_OFFSET + 0x28),
-	UART0_LCRH   = (UART0_OFFSET + 0x2C),
-	UART0_CR     = (UART0_OFFSET + 0x30),
-	UART0_IFLS   = (UART0_OFFSET + 0x34),
-	UART0_IMSC   = (UART0_OFFSET + 0x38),
-	UART0_RIS    = (UART0_OFFSET + 0x3C),
-	UART0_MIS    = (UART0_OFFSET + 0x40),
-	UART0_ICR    = (UART0_OFFSET + 0x44),
-	UART0_DMACR  = (UART0_OFFSET + 0x48),
-	UART0_ITCR   = (UART0_OFFSET + 0x80),
-	UART0_ITIP   = (UART0_OFFSET + 0x84),
-	UART0_ITOP   = (UART0_OFFSET + 0x88),
-	UART0_TDR    = (UART0_OFFSET + 0x8C),
-    };
+    // UART0_FR bits.
+    typedef MMIO::Field<UART0_FR, 3> FR_BUSY;
+    typedef MMIO::Field<UART0_FR, 4> FR_RXFE;
+    typedef MMIO::Field<UART0_FR, 5> FR_TXFF;
+    typedef MMIO::Field<UART0_FR, 7> FR_TXFE;
+
+    // UART0_LCRH bits.
+    typedef MMIO::Field<UART0_LCRH, 0> LCRH_BRK;
+    typedef MMIO::Field<UART0_LCRH, 4> LCRH_FEN;
+    typedef MMIO::Field<UART0_LCRH, 5, 2> LCRH_WLEN;
+
+    // UART0_IFLS receive and transmit FIFO levels, 2 is half full
+    typedef MMIO::Field<UART0_IFLS, 0, 3> IFLS_TXIFLSEL;
+    typedef MMIO::Field<UART0_IFLS, 3, 3> IFLS_RXIFLSEL;
+
+    // UART0_RSRECR error flags
+    typedef MMIO::Field<UART0_RSRECR, 0, 4> RSRECR_ERRORS;
+
+    // UART0_CR bits.
+    typedef MMIO::Field<UART0_CR, 0> CR_UARTEN;
+    typedef MMIO::Field<UART0_CR, 8> CR_TXE;
+    typedef MMIO::Field<UART0_CR, 9> CR_RXE;
+    typedef MMIO::Field<UART0_CR, 14> CR_RTSEN;
+    typedef MMIO::Field<UART0_CR, 15> CR_CTSEN;
 
     /*
      * delay function
@@ -74,48 +97,166 @@ namespace UART {
 		     : : [count]"r"(count));
     }
     
+    enum {
+	GPIO_CTS0 = 16,
+	GPIO_RTS0 = 17,
+	GPFSEL_ALT3 = 7,
+
+	// depth of the transmit FIFO
+	TX_FIFO_SIZE = 16,
+
+	// UART0_LCRH: enable FIFO & 8 bit data transmission
+	// (1 stop bit, no parity).
+	LCRH_8N1_FIFO = LCRH_FEN::bits() | LCRH_WLEN::bits(3),
+
+	// all interrupts of UART0_IMSC and UART0_ICR
+	INT_ALL = 0x7F2,
+	INT_CLEAR_ALL = 0x7FF,
+
+	// BREAK long enough for a host at 9600 baud, then a few bit times
+	// of idle line before the next character
+	BREAK_USECS = 2000,
+	BREAK_IDLE_USECS = 100,
+
+	// clock assumed by old firmware without mailbox support
+	DEFAULT_CLOCK = 3000000,
+
+	// console input kept by wait_reply(), a power of 2
+	KEEP_SIZE = 64,
+    };
+
+    // UART reference clock in Hz
+    static uint32_t clock;
+
+    // receive errors seen by getc() since the last rx_errors()
+    static uint32_t errors;
+
+    // console input that came in front of a reply of the host
+    static uint8_t kept[KEEP_SIZE];
+    static uint32_t kept_head;
+    static uint32_t kept_tail;
+
+    /*
+     * Keep a byte of console input for console_getc(), drop it if
+     * there is no room.
+     * uint8_t byte: byte to keep
+     */
+    static void keep(uint8_t byte) {
+	if (kept_head - kept_tail == KEEP_SIZE) return;
+	kept[kept_head++ % KEEP_SIZE] = byte;
+    }
+
+    /*
+     * Set integer & fractional part of baud rate.
+     * Divider = UART_CLOCK/(16 * Baud)
+     * Fraction part register = (Fractional part * 64) + 0.5
+     * Only takes effect with the next write to UART0_LCRH.
+     * uint32_t baud: baud rate
+     *
+     * Returns:
+     * bool: false if the clock can't generate the baud rate.
+     */
+    static bool set_divisor(uint32_t baud) {
+	// divisor in 1/64th, rounded
+	uint32_t div = (clock * 4 + baud / 2) / baud;
+	uint32_t ibrd = div >> 6;
+	if (ibrd == 0 || ibrd > 0xFFFF) return false;
+	UART0_IBRD::write(ibrd);
+	UART0_FBRD::write(div & 63);
+	return true;
+    }
+
     /*
      * Initialize UART0.
+     * bool flow_control: enable automatic RTS/CTS flow control
      */
-    void init(void) {
+    void init(bool flow_control) {
+	MMIO::Guard guard;
 	// Disable UART0.
-	MMIO::write(UART0_CR, 0x00000000);
+	UART0_CR::write(0x00000000);
+	MMIO::barrier();
 	// Setup the GPIO pin 14 && 15.
-    
+	uint32_t pins = (1 << 14) | (1 << 15);
+
+	// Setup the GPIO pin 16 && 17 for CTS0 and RTS0.
+	if (flow_control) {
+	    GPFSEL1::modify(FSEL_CTS0::mask | FSEL_RTS0::mask,
+			    FSEL_CTS0::bits(GPFSEL_ALT3) |
+			    FSEL_RTS0::bits(GPFSEL_ALT3));
+	    pins |= (1 << GPIO_CTS0) | (1 << GPIO_RTS0);
+	}
+
 	// Disable pull up/down for all GPIO pins & delay for 150 cycles.
-	MMIO::write(GPPUD, 0x00000000);
+	GPPUD::write(0x00000000);
 	delay(150);
 
-	// Disable pull up/down for pin 14,15 & delay for 150 cycles.
-	MMIO::write(GPPUDCLK0, (1 << 14) | (1 << 15));
+	// Disable pull up/down for the pins & delay for 150 cycles.
+	GPPUDCLK0::write(pins);
 	delay(150);
 
 	// Write 0 to GPPUDCLK0 to make it take effect.
-	MMIO::write(GPPUDCLK0, 0x00000000);
+	GPPUDCLK0::write(0x00000000);
+	MMIO::barrier();
     
 	// Clear pending interrupts.
-	MMIO::write(UART0_ICR, 0x7FF);
-
-	// Set integer & fractional part of baud rate.
-	// Divider = UART_CLOCK/(16 * Baud)
-	// Fraction part register = (Fractional part * 64) + 0.5
-	// UART_CLOCK = 3000000; Baud = 115200.
+	UART0_ICR::write(INT_CLEAR_ALL);
 
-	// Divider = 3000000/(16 * 115200) = 1.627 = ~1.
-	// Fractional part register = (.627 * 64) + 0.5 = 40.6 = ~40.
-	MMIO::write(UART0_IBRD, 1);
-	MMIO::write(UART0_FBRD, 40);
+	// Ask the firmware how fast the UART is clocked, newer firmware
+	// defaults to 48MHz instead of 3MHz.
+	clock = Mailbox::get_clock_rate(Mailbox::CLOCK_UART);
+	if (clock == 0) clock = DEFAULT_CLOCK;
 
-	// Enable FIFO & 8 bit data transmissio (1 stop bit, no parity).
-	MMIO::write(UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
+	// Set baud rate and 8 bit data transmission.
+	set_divisor(Protocol::DEFAULT_BAUD);
+	UART0_LCRH::write(LCRH_8N1_FIFO);
 
 	// Mask all interrupts.
-	MMIO::write(UART0_IMSC, (1 << 1) | (1 << 4) | (1 << 5) |
-		    (1 << 6) | (1 << 7) | (1 << 8) |
-		    (1 << 9) | (1 << 10));
+	UART0_IMSC::write(INT_ALL);
+
+	// Deassert RTS once the receive FIFO is half full, which leaves
+	// room for the bytes the other side sends before it reacts.
+	UART0_IFLS::write(IFLS_RXIFLSEL::bits(2) | IFLS_TXIFLSEL::bits(2));
 
 	// Enable UART0, receive & transfer part of UART.
-	MMIO::write(UART0_CR, (1 << 0) | (1 << 8) | (1 << 9));
+	uint32_t cr = CR_UARTEN::bits() | CR_TXE::bits() | CR_RXE::bits();
+	if (flow_control) {
+	    // Let the hardware handle RTS and CTS.
+	    cr |= CR_RTSEN::bits() | CR_CTSEN::bits();
+	}
+	UART0_CR::write(cr);
+    }
+
+    /*
+     * Change the baud rate. Waits for pending output to be send first.
+     * uint32_t baud: new baud rate
+     *
+     * Returns:
+     * bool: false if the clock can't generate the baud rate.
+     */
+    bool set_baud(uint32_t baud) {
+	flush();
+	MMIO::Guard guard;
+	uint32_t cr = UART0_CR::read();
+	UART0_CR::write(0);
+	bool res = set_divisor(baud);
+	UART0_LCRH::write(LCRH_8N1_FIFO);
+	UART0_CR::write(cr);
+	return res;
+    }
+
+    /*
+     * Highest baud rate the UART clock can generate.
+     */
+    uint32_t max_baud(void) {
+	return clock / 16;
+    }
+
+    /*
+     * Wait for all output to be send.
+     */
+    void flush(void) {
+	MMIO::Guard guard;
+	while(FR_BUSY::read()) { }
     }
 
     /*
@@ -123,13 +264,86 @@ namespace UART {
      * uint8_t Byte: byte to send.
      */
     void putc(uint8_t byte) {
+	MMIO::Guard guard;
 	// wait for UART to become ready to transmit
-	while(true) {
-	    if (!(MMIO::read(UART0_FR) & (1 << 5))) {
-		break;
-	    }
+	while(FR_TXFF::read()) { }
+	UART0_DR::write(byte);
+    }
+
+    bool put_burst(const uint8_t *data, uint32_t len) {
+	// putc() may have seen room for one byte before the FIQ came
+	if (len >= TX_FIFO_SIZE) return false;
+	MMIO::Guard guard;
+	// without the FIFO only one byte fits
+	if (!LCRH_FEN::read()) return false;
+	if (!FR_TXFE::read()) return false;
+	for(uint32_t i = 0; i < len; ++i) {
+	    UART0_DR::write(data[i]);
+	}
+	return true;
+    }
+
+    /*
+     * Hold the line low (BREAK) for a while, outside of the data.
+     */
+    void send_break(void) {
+	flush();
+	{
+	    MMIO::Guard guard;
+	    LCRH_BRK::write(1);
 	}
-	MMIO::write(UART0_DR, byte);
+	Timer::delay(BREAK_USECS);
+	{
+	    MMIO::Guard guard;
+	    LCRH_BRK::write(0);
+	}
+	Timer::delay(BREAK_IDLE_USECS);
+    }
+
+    /*
+     * Check for received data.
+     *
+     * Returns:
+     * bool: true if getc() won't block.
+     */
+    bool can_getc(void) {
+	MMIO::Guard guard;
+	return !FR_RXFE::read();
+    }
+
+    /*
+     * Receive a byte and its error flags via UART0.
+     *
+     * Returns:
+     * uint32_t: byte received in bits 0-7, DR_* error flags.
+     */
+    uint32_t getc_raw(void) {
+	MMIO::Guard guard;
+	// wait for UART to have recieved something
+	while(FR_RXFE::read()) { }
+	uint32_t data = UART0_DR::read();
+	errors |= data;
+	return data;
+    }
+
+    /*
+     * Receive a byte and its error flags, giving up after a while.
+     * uint32_t &data: byte received in bits 0-7, DR_* error flags
+     * uint32_t usecs: how long to wait
+     *
+     * Returns:
+     * bool: false if nothing arrived in time.
+     */
+    bool getc_timeout(uint32_t &data, uint32_t usecs) {
+	uint32_t start = Timer::now();
+	MMIO::Guard guard;
+	while(FR_RXFE::read()) {
+	    // Timer::now() puts barriers around its access
+	    if (Timer::now() - start >= usecs) return false;
+	}
+	data = UART0_DR::read();
+	errors |= data;
+	return true;
     }
 
     /*
@@ -139,13 +353,78 @@ namespace UART {
      * uint8_t: byte received.
      */
     uint8_t getc(void) {
-	// wait for UART to have recieved something
+	return getc_raw();
+    }
+
+    bool wait_reply(uint8_t type, uint32_t usecs) {
+	uint32_t start = Timer::now();
+	// ESCAPEs seen in a row, at most 2 matter
+	uint32_t escapes = 0;
 	while(true) {
-	    if (!(MMIO::read(UART0_FR) & (1 << 4))) {
-		break;
+	    uint32_t data;
+	    if (usecs == 0) {
+		data = getc_raw();
+	    } else {
+		uint32_t spent = Timer::now() - start;
+		if (spent >= usecs || !getc_timeout(data, usecs - spent)) {
+		    return false;
+		}
+	    }
+	    uint8_t byte = data;
+	    if (byte == Protocol::ESCAPE) {
+		if (escapes == 2) {
+		    keep(byte);
+		} else {
+		    ++escapes;
+		}
+		continue;
 	    }
+	    if (escapes == 2 && byte == type) return true;
+	    while(escapes > 0) {
+		keep(Protocol::ESCAPE);
+		--escapes;
+	    }
+	    keep(byte);
 	}
-	return MMIO::read(UART0_DR);
+    }
+
+    uint8_t console_getc(void) {
+	return console_getc_raw();
+    }
+
+    uint32_t console_getc_raw(void) {
+	if (kept_tail != kept_head) return kept[kept_tail++ % KEEP_SIZE];
+	return getc_raw();
+    }
+
+    bool can_console_getc(void) {
+	return kept_tail != kept_head || can_getc();
+    }
+
+    /*
+     * Receive errors since the last call.
+     *
+     * Returns:
+     * uint8_t: Protocol::RxError flags (UART0_RSRECR layout).
+     */
+    uint8_t rx_errors(void) {
+	uint8_t res = peek_rx_errors();
+	MMIO::Guard guard;
+	UART0_RSRECR::write(0);
+	errors = 0;
+	return res;
+    }
+
+    /*
+     * Receive errors since the last rx_errors(), without clearing them.
+     *
+     * Returns:
+     * uint8_t: Protocol::RxError flags (UART0_RSRECR layout).
+     */
+    uint8_t peek_rx_errors(void) {
+	MMIO::Guard guard;
+	// overruns are only flagged in UART0_RSRECR
+	return ((errors & DR_ERRORS) >> 8) | RSRECR_ERRORS::read();
     }
 
     /*
@@ -0,0 +1,64 @@
+/* watchdog.cc - PM watchdog that resets a hung board */
+/* Copyright (C) 2013 Goswin von Brederlow <goswin-v-b@web.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The BCM2835 datasheet doesn't document the power management block,
+ * the registers are the ones the Linux bcm2835_wdt driver uses.
+ */
+
+#include <stdint.h>
+#include <mmio.h>
+#include <watchdog.h>
+
+namespace Watchdog {
+    enum {
+	PM_OFFSET = 0x00100000,
+    };
+
+    typedef MMIO::Register<PM_OFFSET + 0x1C> PM_RSTC;
+    typedef MMIO::Register<PM_OFFSET + 0x24> PM_WDOG;
+
+    // every write needs the password in the top byte
+    typedef MMIO::Field<PM_RSTC, 24, 8> PM_PASSWD;
+    typedef MMIO::Field<PM_RSTC, 4, 2> PM_RSTC_WRCFG;
+    typedef MMIO::Field<PM_WDOG, 0, 20> PM_WDOG_TIME;
+
+    enum {
+	PASSWORD = 0x5A,
+	WRCFG_FULL_RESET = 2,
+	// stops the watchdog (as Linux does)
+	PM_RSTC_RESET = 0x00000102,
+
+	TICKS_PER_SEC = 65536,
+    };
+
+    void start(uint32_t msecs) {
+	if (msecs > MAX_MSECS) msecs = MAX_MSECS;
+	uint32_t ticks = msecs * TICKS_PER_SEC / 1000;
+	MMIO::Guard guard;
+	PM_WDOG::write(PM_PASSWD::bits(PASSWORD) | PM_WDOG_TIME::bits(ticks));
+	uint32_t rstc = PM_RSTC::read();
+	rstc &= ~(PM_PASSWD::mask | PM_RSTC_WRCFG::mask);
+	PM_RSTC::write(rstc | PM_PASSWD::bits(PASSWORD) |
+		       PM_RSTC_WRCFG::bits(WRCFG_FULL_RESET));
+    }
+
+    void stop(void) {
+	MMIO::Guard guard;
+	PM_RSTC::write(PM_PASSWD::bits(PASSWORD) | PM_RSTC_RESET);
+    }
+}